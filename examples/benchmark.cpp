@@ -4,11 +4,18 @@
 
 #include <vector>
 #include <chrono>
+#include <cstring>
+#include <thread>
+#include <future>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <functional>
 
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "table.h"
 
 using namespace std;
@@ -81,7 +88,7 @@ static void put_benchmark(int entry_num, int test_times) {
     }
 }
 
-void get_benchmark(int entry_num, int get_times, int test_times) {
+void get_benchmark(int entry_num, int get_times, int test_times, bool hash_index = false) {
     vector<string> keys;
     vector<string> values;
     keys.resize(entry_num);
@@ -92,6 +99,7 @@ void get_benchmark(int entry_num, int get_times, int test_times) {
     Options options;
     options.create_if_missing = true;
     options.dump_when_close = false;
+    options.hash_index = hash_index;
     Table table(options, "table_benchmark");
     Status s = table.open();
     assert_fatal(s);
@@ -100,7 +108,8 @@ void get_benchmark(int entry_num, int get_times, int test_times) {
         assert_fatal(s);
     }
 
-    cout << "get: " << entry_num << " entries, get " << get_times << " times" << endl;
+    cout << "get: " << entry_num << " entries, get " << get_times << " times" <<
+        (hash_index ? ", with hash index" : "") << endl;
     for (int times = 1; times <= test_times; ++times) {
         int random_index[get_times];
         srand(time(nullptr));
@@ -121,11 +130,816 @@ void get_benchmark(int entry_num, int get_times, int test_times) {
     }
 }
 
+static void concurrent_put_benchmark(int entry_num, int max_threads) {
+    vector<string> keys;
+    vector<string> values;
+    keys.resize(entry_num);
+    values.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    generate_n(values.begin(), values.size(), bind(random_string, 100));
+
+    cout << "concurrent put: " << entry_num << " entries" << endl;
+    for (int nthread = 1; nthread <= max_threads; nthread *= 2) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        Table table(options, "table_benchmark");
+        Status s = table.open();
+        assert_fatal(s);
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < nthread; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = t; i < entry_num; i += nthread) {
+                    assert_fatal(table.put(keys[i], values[i]));
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+
+        auto msec = duration_cast<milliseconds>(end - start).count();
+        cout << nthread << " threads: spend " << msec << "ms, " <<
+            (msec ? entry_num / msec : 0) << " puts/ms" << endl;
+    }
+}
+
+static void wal_put_benchmark(int entry_num, int nthread) {
+    vector<string> keys;
+    vector<string> values;
+    keys.resize(entry_num);
+    values.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    generate_n(values.begin(), values.size(), bind(random_string, 100));
+
+    cout << "write-ahead log: " << entry_num << " entries, " << nthread << " threads" << endl;
+    const char *names[] = {"no log", "sync none", "sync per write", "sync interval"};
+    for (int mode = 0; mode < 4; ++mode) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.write_ahead_log = mode > 0;
+        if (mode > 0) {
+            options.wal_sync = static_cast<Options::WalSync>(mode - 1);
+        }
+        Table table(options, "table_wal_benchmark_" + to_string(mode));
+        Status s = table.open();
+        assert_fatal(s);
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < nthread; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = t; i < entry_num; i += nthread) {
+                    assert_fatal(table.put(keys[i], values[i]));
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+
+        auto msec = duration_cast<milliseconds>(end - start).count();
+        cout << names[mode] << ": spend " << msec << "ms, " <<
+            (msec ? entry_num / msec : 0) << " puts/ms" << endl;
+
+        // the dump discards the log, so the next run starts without replaying it
+        assert_fatal(table.dump());
+    }
+}
+
+static void incremental_dump_benchmark(int entry_num, int change_num, int test_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.incremental_dump = true;
+    Table table(options, "table_dump_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    for (const string& key : keys) {
+        assert_fatal(table.put(key, value));
+    }
+
+    cout << "dump: " << entry_num << " entries, " << change_num << " changed between dumps" << endl;
+    for (int times = 1; times <= test_times; ++times) {
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        assert_fatal(table.full_dump());
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        auto full_msec = duration_cast<milliseconds>(end - start).count();
+
+        for (int i = 0; i < change_num; ++i) {
+            assert_fatal(table.put(keys[rand() % entry_num], random_string(100)));
+        }
+        start = high_resolution_clock::now();
+        assert_fatal(table.dump());
+        end = high_resolution_clock::now();
+        auto delta_msec = duration_cast<milliseconds>(end - start).count();
+
+        cout << ordinal(times) << ": full dump spend " << full_msec << "ms, incremental dump spend " <<
+            delta_msec << "ms" << endl;
+    }
+}
+
+static void dump_latency_benchmark(int entry_num, int put_num) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_dump_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    for (const string& key : keys) {
+        assert_fatal(table.put(key, value));
+    }
+
+    cout << "put latency: " << entry_num << " entries, " << put_num << " puts" << endl;
+    for (int dumping = 0; dumping < 2; ++dumping) {
+        promise<DumpProgress> result;
+        if (dumping) {
+            assert_fatal(table.dump_async([&result](const DumpProgress& progress) {
+                if (progress.done) {
+                    result.set_value(progress);
+                }
+            }));
+        }
+
+        vector<int64_t> latencies(put_num);
+        for (int i = 0; i < put_num; ++i) {
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            assert_fatal(table.put(keys[rand() % entry_num], value));
+            high_resolution_clock::time_point end = high_resolution_clock::now();
+            latencies[i] = duration_cast<nanoseconds>(end - start).count();
+        }
+        if (dumping) {
+            assert_fatal(result.get_future().get().status);
+        }
+
+        sort(latencies.begin(), latencies.end());
+        cout << (dumping ? "during dump_async: " : "no dump: ") <<
+            "p50 " << latencies[put_num / 2] << "ns, p99 " << latencies[put_num * 99 / 100] <<
+            "ns, max " << latencies.back() << "ns" << endl;
+    }
+}
+
+static void open_benchmark(int entry_num, const vector<off_t>& file_sizes,
+                           const vector<int>& thread_nums, bool lazy_load = false) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    cout << (lazy_load ? "lazy open: " : "open: ") << entry_num << " entries" << endl;
+    for (off_t file_size : file_sizes) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.max_file_size = file_size;
+        string table_name = "table_open_benchmark_" + to_string(file_size) +
+                            (lazy_load ? "_lazy" : "");
+        {
+            Table table(options, table_name);
+            assert_fatal(table.open());
+            for (const string& key : keys) {
+                assert_fatal(table.put(key, value));
+            }
+            assert_fatal(table.full_dump());
+        }
+
+        off_t file_num = (static_cast<off_t>(entry_num) * (16 + 100 + sizeof(size_t) * 2) +
+                          file_size - 1) / file_size;
+        for (int thread_num : thread_nums) {
+            options.open_threads = thread_num;
+            options.lazy_load = lazy_load;
+            Table table(options, table_name);
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            assert_fatal(table.open());
+            high_resolution_clock::time_point end = high_resolution_clock::now();
+
+            auto msec = duration_cast<milliseconds>(end - start).count();
+            cout << file_num << " files, " << thread_num << " threads: spend " << msec << "ms" << endl;
+        }
+    }
+}
+
+static void out_of_core_benchmark(int entry_num, int get_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    string table_name = "table_out_of_core_benchmark";
+    {
+        Table table(options, table_name);
+        assert_fatal(table.open());
+        for (const string& key : keys) {
+            assert_fatal(table.put(key, value));
+        }
+        assert_fatal(table.full_dump());
+    }
+
+    vector<string> missing(get_times);
+    generate_n(missing.begin(), missing.size(), bind(random_string, 15));
+
+    cout << "out of core: " << entry_num << " entries, get " << get_times << " keys" << endl;
+    for (bool out_of_core : {false, true}) {
+        options.out_of_core = out_of_core;
+        Table table(options, table_name);
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        assert_fatal(table.open());
+        high_resolution_clock::time_point opened = high_resolution_clock::now();
+        string v;
+        for (int i = 0; i < get_times; ++i) {
+            assert_fatal(table.get(keys[rand() % entry_num], &v));
+        }
+        high_resolution_clock::time_point found = high_resolution_clock::now();
+        for (int i = 0; i < get_times; ++i) {
+            table.get(missing[i], &v);
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+
+        cout << (out_of_core ? "files:  " : "memory: ") <<
+            "open " << duration_cast<milliseconds>(opened - start).count() << "ms, " <<
+            "get " << duration_cast<milliseconds>(found - opened).count() << "ms, " <<
+            "get missing " << duration_cast<milliseconds>(end - found).count() << "ms" << endl;
+    }
+}
+
+// bytes of the files in directory "name"
+static off_t directory_size(const string& name) {
+    off_t size = 0;
+    DIR *dir = opendir(name.c_str());
+    for (struct dirent *entry = dir ? readdir(dir) : nullptr; entry; entry = readdir(dir)) {
+        struct stat info;
+        if (stat((name + "/" + entry->d_name).c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            size += info.st_size;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return size;
+}
+
+static void compression_benchmark(int entry_num) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    // JSON documents, as many tables hold
+    vector<string> values(entry_num);
+    for (int i = 0; i < entry_num; ++i) {
+        string name = random_string(8);
+        values[i] = "{\"id\":" + to_string(i) + ",\"name\":\"" + name + "\",\"email\":\"" + name +
+                    "@example.com\",\"active\":" + (i % 2 ? "true" : "false") +
+                    ",\"score\":" + to_string(rand() % 1000) + ",\"tags\":[\"user\",\"table\"]}";
+    }
+
+    cout << "compression: " << entry_num << " entries" << endl;
+    const pair<Options::Compression, const char*> codecs[] = {
+        {Options::NO_COMPRESSION, "none"},
+        {Options::LZ_COMPRESSION, "lz"},
+        {Options::ZSTD_COMPRESSION, "zstd"},
+        {Options::LZ4_COMPRESSION, "lz4"},
+    };
+    for (auto& codec : codecs) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.compression = codec.first;
+        string table_name = string("table_compression_benchmark_") + codec.second;
+        long long dump_msec = 0;
+        {
+            Table table(options, table_name);
+            Status s = table.open();
+            if (!s.good()) {
+                cout << codec.second << ": " << s.string() << endl;
+                continue;
+            }
+            for (int i = 0; i < entry_num; ++i) {
+                assert_fatal(table.put(keys[i], values[i]));
+            }
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            assert_fatal(table.full_dump());
+            dump_msec = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+        }
+
+        Table table(options, table_name);
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        assert_fatal(table.open());
+        auto open_msec = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+        cout << codec.second << ": dump " << dump_msec << "ms, open " << open_msec << "ms, " <<
+            directory_size(table_name) / (1024 * 1024) << "MB" << endl;
+    }
+}
+
+static void verify_benchmark(int entry_num) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.max_file_size = 64 * 1024 * 1024;
+    string table_name = "table_verify_benchmark";
+    {
+        Table table(options, table_name);
+        assert_fatal(table.open());
+        for (const string& key : keys) {
+            assert_fatal(table.put(key, value));
+        }
+        assert_fatal(table.full_dump());
+    }
+    off_t mb = directory_size(table_name) / (1024 * 1024);
+
+    cout << "verify: " << entry_num << " entries, " << mb << "MB" << endl;
+    for (bool verify_on_open : {false, true}) {
+        options.verify_on_open = verify_on_open;
+        Table table(options, table_name);
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        assert_fatal(table.open());
+        auto msec = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+        cout << (verify_on_open ? "open, verified: " : "open: ") << msec << "ms" << endl;
+        if (verify_on_open) {
+            start = high_resolution_clock::now();
+            assert_fatal(table.verify());
+            msec = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+            cout << "verify(): " << msec << "ms, " << mb * 1000 / max<long long>(1, msec) <<
+                "MB/s" << endl;
+        }
+    }
+}
+
+static void dump_throughput_benchmark(int entry_num, int test_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    struct Writer {
+        const char *name;
+        size_t      buffer_size;
+        bool        direct_io;
+        bool        drop_cache;
+    };
+    const Writer writers[] = {
+        {"write() per entry", 0, false, false},
+        {"1MB buffer", 1024 * 1024, false, false},
+        {"1MB buffer, O_DIRECT", 1024 * 1024, true, false},
+        {"1MB buffer, drop cache", 1024 * 1024, false, true},
+    };
+
+    cout << "dump throughput: " << entry_num << " entries" << endl;
+    for (const Writer& writer : writers) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.dump_buffer_size = writer.buffer_size;
+        options.dump_direct_io = writer.direct_io;
+        options.dump_drop_cache = writer.drop_cache;
+        string table_name = "table_dump_throughput_benchmark_" + to_string(&writer - writers);
+        Table table(options, table_name);
+        assert_fatal(table.open());
+        for (const string& key : keys) {
+            assert_fatal(table.put(key, value));
+        }
+
+        double mb_per_sec = 0;
+        for (int i = 0; i < test_times; ++i) {
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            assert_fatal(table.full_dump());
+            auto usec = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+            mb_per_sec += static_cast<double>(directory_size(table_name)) / max<long long>(1, usec);
+        }
+        cout << writer.name << ": " << static_cast<int>(mb_per_sec / test_times) << "MB/s" << endl;
+    }
+}
+
+// resident set size of the process, in MB
+static long rss_mb() {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*d %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static void memory_release_benchmark(int entry_num, size_t max_retained_memory) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.max_retained_memory = max_retained_memory;
+    Table table(options, "table_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+
+    cout << "memory release: " << entry_num << " entries, max_retained_memory " <<
+        max_retained_memory / (1024 * 1024) << "MB" << endl;
+    long before = rss_mb();
+    for (int i = 0; i < entry_num; ++i) {
+        s = table.put(keys[i], value);
+        assert_fatal(s);
+    }
+    cout << "after put: " << rss_mb() - before << "MB" << endl;
+
+    // delete 90% of the entries, the puts after reclaim their memory
+    for (int i = 0; i < entry_num / 10 * 9; ++i) {
+        s = table.del(keys[i]);
+        assert_fatal(s);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        s = table.put(random_string(16), value);
+        assert_fatal(s);
+    }
+    cout << "after delete: " << rss_mb() - before << "MB" << endl;
+
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for (int i = 0; i < entry_num / 10 * 9; ++i) {
+        s = table.put(keys[i], value);
+        assert_fatal(s);
+    }
+    high_resolution_clock::time_point end = high_resolution_clock::now();
+    cout << "after put again: " << rss_mb() - before << "MB, spend " <<
+        duration_cast<milliseconds>(end - start).count() << "ms" << endl;
+}
+
+static void memory_usage_benchmark(int entry_num, int call_times) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    string value = random_string(100);
+    for (int i = 0; i < entry_num; ++i) {
+        s = table.put(random_string(16), value);
+        assert_fatal(s);
+    }
+
+    MemoryUsage usage;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for (int i = 0; i < call_times; ++i) {
+        s = table.memory_usage(&usage);
+        assert_fatal(s);
+    }
+    high_resolution_clock::time_point end = high_resolution_clock::now();
+
+    size_t free_bytes = 0;
+    for (size_t bytes : usage.free_bytes) {
+        free_bytes += bytes;
+    }
+    cout << "memory usage: " << entry_num << " entries, " << call_times << " calls, spend " <<
+        duration_cast<microseconds>(end - start).count() / call_times << "us per call" << endl;
+    cout << "keys " << usage.key_bytes / 1024 << "KB, values " << usage.value_bytes / 1024 <<
+        "KB, overhead " << usage.overhead_bytes / 1024 << "KB, pool " << usage.pool_bytes / 1024 <<
+        "KB, free " << free_bytes / 1024 << "KB, pending " << usage.reclaim_pending_bytes / 1024 <<
+        "KB" << endl;
+}
+
+static void huge_pages_benchmark(int entry_num, int get_times, int test_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+    vector<int> random_index(get_times);
+
+    for (bool huge_pages : {false, true}) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.huge_pages = huge_pages;
+        Table table(options, "table_benchmark");
+        Status s = table.open();
+        assert_fatal(s);
+        for (int i = 0; i < entry_num; ++i) {
+            s = table.put(keys[i], value);
+            assert_fatal(s);
+        }
+
+        cout << "get: " << entry_num << " entries, get " << get_times << " times" <<
+            (huge_pages ? ", with huge pages" : "") << endl;
+        for (int times = 1; times <= test_times; ++times) {
+            srand(times);
+            for (int i = 0; i < get_times; ++i) {
+                random_index[i] = rand() % entry_num;
+            }
+
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            string v;
+            for (int i = 0; i < get_times; ++i) {
+                s = table.get(keys[random_index[i]], &v);
+                assert_fatal(s);
+            }
+            high_resolution_clock::time_point end = high_resolution_clock::now();
+
+            cout << ordinal(times) <<  ": spend " << duration_cast<milliseconds>(end - start).count()
+                << "ms" << endl;
+        }
+    }
+}
+
+static void multi_get_benchmark(int entry_num, int get_times, int batch_size, int test_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    for (int i = 0; i < entry_num; ++i) {
+        s = table.put(keys[i], value);
+        assert_fatal(s);
+    }
+
+    cout << "multi_get: " << entry_num << " entries, get " << get_times << " times, " <<
+        batch_size << " keys per multi_get" << endl;
+    for (int times = 1; times <= test_times; ++times) {
+        vector<ByteArray> lookup_keys(get_times);
+        for (int i = 0; i < get_times; ++i) {
+            lookup_keys[i] = keys[rand() % entry_num];
+        }
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        string v;
+        for (int i = 0; i < get_times; ++i) {
+            assert_fatal(table.get(lookup_keys[i], &v));
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        auto get_msec = duration_cast<milliseconds>(end - start).count();
+
+        start = high_resolution_clock::now();
+        vector<ByteArray> batch;
+        vector<string> values;
+        vector<Status> statuses;
+        for (int i = 0; i < get_times; i += batch_size) {
+            batch.assign(lookup_keys.begin() + i, lookup_keys.begin() + min(get_times, i + batch_size));
+            assert_fatal(table.multi_get(batch, &values, &statuses));
+        }
+        end = high_resolution_clock::now();
+        auto multi_get_msec = duration_cast<milliseconds>(end - start).count();
+
+        cout << ordinal(times) << ": get() spend " << get_msec << "ms, multi_get() spend " <<
+            multi_get_msec << "ms" << endl;
+    }
+}
+
+// the same order as the builtin comparator, but Table can only call it virtually
+class UserComparator : public Comparator {
+public:
+    int compare(const ByteArray& lhs, const ByteArray& rhs) const override {
+        size_t size = min(lhs.size(), rhs.size());
+        int cmp = memcmp(lhs.data(), rhs.data(), size);
+        if (cmp != 0) {
+            return cmp;
+        }
+        return static_cast<int>(lhs.size()) - static_cast<int>(rhs.size());
+    }
+};
+
+static void comparator_benchmark(int entry_num, int get_times, int test_times) {
+    // keys share a prefix longer than the cached 8 bytes, so every step compares key bytes
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), [] { return "user:0000" + random_string(16); });
+    string value = random_string(100);
+
+    UserComparator user_cmp;
+    vector<pair<string, Comparator*>> comparators = {
+        {"builtin comparator", bytewise_comparator()}, {"user comparator", &user_cmp}};
+    for (auto& comparator : comparators) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.comparator = comparator.second;
+        Table table(options, "table_benchmark");
+        Status s = table.open();
+        assert_fatal(s);
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        for (int i = 0; i < entry_num; ++i) {
+            s = table.put(keys[i], value);
+            assert_fatal(s);
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        cout << comparator.first << ": " << entry_num << " entries, put spend " <<
+            duration_cast<milliseconds>(end - start).count() << "ms" << endl;
+
+        for (int times = 1; times <= test_times; ++times) {
+            start = high_resolution_clock::now();
+            string v;
+            for (int i = 0; i < get_times; ++i) {
+                assert_fatal(table.get(keys[rand() % entry_num], &v));
+            }
+            end = high_resolution_clock::now();
+            cout << ordinal(times) << ": get " << get_times << " times spend " <<
+                duration_cast<milliseconds>(end - start).count() << "ms" << endl;
+        }
+    }
+}
+
+static void overwrite_benchmark(int entry_num, int put_times, int test_times) {
+    vector<string> keys;
+    vector<string> values;
+    keys.resize(entry_num);
+    values.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    generate_n(values.begin(), values.size(), bind(random_string, 100));
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    for (int i = 0; i < entry_num; ++i) {
+        s = table.put(keys[i], values[i]);
+        assert_fatal(s);
+    }
+
+    cout << "overwrite: " << entry_num << " entries, put " << put_times << " times" << endl;
+    for (int times = 1; times <= test_times; ++times) {
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        for (int i = 0; i < put_times; ++i) {
+            // same value length as before
+            s = table.put(keys[i % entry_num], values[(i + times) % entry_num]);
+            assert_fatal(s);
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+
+        cout << ordinal(times) << ": spend " << duration_cast<milliseconds>(end - start).count()
+            << "ms" << endl;
+    }
+}
+
+static void write_batch_benchmark(int entry_num, int batch_size) {
+    vector<string> sequential(entry_num);
+    for (int i = 0; i < entry_num; ++i) {
+        char key[17];
+        snprintf(key, sizeof(key), "%016d", i);
+        sequential[i] = key;
+    }
+    vector<string> random_keys(entry_num);
+    generate_n(random_keys.begin(), random_keys.size(), bind(random_string, 16));
+    // runs of 100 sequential keys at random places
+    vector<string> clustered(entry_num);
+    for (int i = 0; i < entry_num; i += 100) {
+        string prefix = random_string(12);
+        for (int j = i; j < min(entry_num, i + 100); ++j) {
+            char suffix[12];
+            snprintf(suffix, sizeof(suffix), "%04d", j - i);
+            clustered[j] = prefix + suffix;
+        }
+    }
+    string value = random_string(100);
+
+    cout << "write batch: " << entry_num << " entries, " << batch_size << " entries per batch" << endl;
+    vector<pair<string, vector<string>*>> workloads = {
+        {"sequential", &sequential}, {"random", &random_keys}, {"clustered", &clustered}};
+    for (auto& workload : workloads) {
+        const vector<string>& keys = *workload.second;
+        long long spend[2];
+        for (int batched = 0; batched < 2; ++batched) {
+            Options options;
+            options.create_if_missing = true;
+            options.dump_when_close = false;
+            Table table(options, "table_benchmark");
+            Status s = table.open();
+            assert_fatal(s);
+
+            high_resolution_clock::time_point start = high_resolution_clock::now();
+            WriteBatch batch;
+            for (int i = 0; i < entry_num; ++i) {
+                if (!batched) {
+                    assert_fatal(table.put(keys[i], value));
+                    continue;
+                }
+                batch.put(keys[i], value);
+                if (static_cast<int>(batch.count()) == batch_size || i == entry_num - 1) {
+                    assert_fatal(table.write(batch));
+                    batch.clear();
+                }
+            }
+            high_resolution_clock::time_point end = high_resolution_clock::now();
+            spend[batched] = duration_cast<milliseconds>(end - start).count();
+        }
+        cout << workload.first << ": put() spend " << spend[0] << "ms, write() spend " <<
+            spend[1] << "ms" << endl;
+    }
+}
+
+static void reverse_scan_benchmark(int entry_num, int scan_len, int test_times) {
+    vector<string> keys;
+    keys.resize(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string value = random_string(100);
+
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_benchmark");
+    Status s = table.open();
+    assert_fatal(s);
+    for (int i = 0; i < entry_num; ++i) {
+        s = table.put(keys[i], value);
+        assert_fatal(s);
+    }
+    sort(keys.begin(), keys.end());
+
+    cout << "reverse scan: " << entry_num << " entries, scan " << scan_len << " entries" << endl;
+    for (int times = 1; times <= test_times; ++times) {
+        int from = scan_len + rand() % (entry_num - scan_len);
+
+        // walk back with the level-0 back pointers
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        Table::Iterator it(&table);
+        it.seek(keys[from]);
+        for (int i = 0; i < scan_len && it.valid(); ++i) {
+            it.prev();
+        }
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        auto prev_usec = duration_cast<microseconds>(end - start).count();
+
+        // a fresh search for every step
+        start = high_resolution_clock::now();
+        for (int i = 0; i < scan_len; ++i) {
+            it.seek(keys[from - i - 1]);
+        }
+        end = high_resolution_clock::now();
+        auto seek_usec = duration_cast<microseconds>(end - start).count();
+
+        cout << ordinal(times) << ": prev() spend " << prev_usec << "us, seek() spend " <<
+            seek_usec << "us" << endl;
+    }
+}
+
 int main() {
     put_benchmark(100000, 5);
     put_benchmark(1000000, 5);
 
+    concurrent_put_benchmark(1000000, max(4u, thread::hardware_concurrency()));
+
+    wal_put_benchmark(10000, 1);
+    wal_put_benchmark(10000, 16);
+
     get_benchmark(100000, 10000, 5);
     get_benchmark(1000000, 10000, 5);
+    get_benchmark(1000000, 10000, 5, true);
+    huge_pages_benchmark(10000000, 1000000, 3);
+
+    comparator_benchmark(10000, 3000000, 3);
+    comparator_benchmark(1000000, 1000000, 3);
+
+    multi_get_benchmark(1000000, 1000000, 32, 3);
+    multi_get_benchmark(10000000, 1000000, 32, 3);
+
+    overwrite_benchmark(1000, 1000000, 5);
+    overwrite_benchmark(1000000, 1000000, 5);
+
+    write_batch_benchmark(1000000, 1000);
+
+    memory_usage_benchmark(1000000, 1000);
+    memory_release_benchmark(1000000, 16 * 1024 * 1024);
+    memory_release_benchmark(1000000, 1024 * 1024 * 1024);
+
+    incremental_dump_benchmark(1000000, 10000, 3);
+    dump_latency_benchmark(1000000, 100000);
+    dump_throughput_benchmark(1000000, 3);
+
+    open_benchmark(1000000, {1024 * 1024 * 1024, 16 * 1024 * 1024, 1024 * 1024}, {1, 2, 4, 8});
+    open_benchmark(1000000, {1024 * 1024 * 1024, 16 * 1024 * 1024}, {1, 4}, true);
+    out_of_core_benchmark(1000000, 1000000);
+    compression_benchmark(1000000);
+    verify_benchmark(1000000);
+
+    reverse_scan_benchmark(1000000, 100000, 5);
     return 0;
 }
\ No newline at end of file
@@ -21,6 +21,10 @@ public:
     virtual int compare(const ByteArray& lhs, const ByteArray& rhs) const = 0;
 };
 
+// Returns the builtin comparator that uses lexicographic byte-wise ordering.
+// Table recognizes it and orders most keys by their cached prefix without calling it.
+Comparator* bytewise_comparator();
+
 } // namespace table
 
 #endif
\ No newline at end of file
@@ -8,11 +8,50 @@
 #ifndef TABLE_OPTIONS_H
 #define TABLE_OPTIONS_H
 
+#include <functional>
+
+#include "status.h"
 #include "comparator.h"
 
 namespace table {
 
+// Progress of a dump in the background, see Table::dump_async().
+struct DumpProgress {
+    DumpProgress() : entries(0), bytes(0), done(false) {  }
+
+    // entries and bytes written so far
+    size_t  entries;
+    size_t  bytes;
+    // true in the last report, which carries the result of the dump
+    bool    done;
+    Status  status;
+};
+
+// Called on the dump thread after every 65536 entries written, and once more when the dump is done.
+typedef std::function<void(const DumpProgress&)> DumpCallback;
+
 struct Options {
+    // When the write-ahead log is flushed to disk.
+    enum WalSync {
+        // left to the operating system, writes survive a crash of the process but not of the machine
+        WAL_SYNC_NONE = 0,
+        // put(), del() and write() return after fdatasync(), concurrent writers share one
+        WAL_SYNC_PER_WRITE = 1,
+        // fdatasync() runs in the background every wal_sync_interval_msec,
+        // a crash of the machine loses at most that much
+        WAL_SYNC_INTERVAL = 2,
+    };
+
+    // Codec of the data blocks of dump files.
+    enum Compression {
+        NO_COMPRESSION = 0,
+        // a fast LZ77 built into the library
+        LZ_COMPRESSION = 1,
+        // zstd and lz4, if the library was built with them
+        ZSTD_COMPRESSION = 2,
+        LZ4_COMPRESSION = 3,
+    };
+
     // Comparator used to define the order of keys in the table.
     // Default: a comparator that uses lexicographic byte-wise ordering
     Comparator* comparator;
@@ -29,14 +68,133 @@ struct Options {
     // Default: true
     bool dump_when_close;
 
-    // Time-To-Live of a read operation.
-    // Default: 2000
+    // Deprecated and ignored.
+    // Freed memory is reclaimed once no reader can see it, regardless of time.
     int read_ttl_msec;
 
+    // If true, dump() only writes the entries changed since the last dump into new delta files,
+    // with tombstones for deleted keys, and open() applies them on top of the full dump in order.
+    // Table::full_dump() folds them back into a fresh full dump.
+    // The first dump of a table is always a full one.
+    // Default: false
+    bool incremental_dump;
+
+    // If positive, the table is dumped in the background every dump_interval_msec,
+    // from a snapshot as Table::dump_async() does, reporting to dump_callback.
+    // Default: 0
+    int dump_interval_msec;
+
+    // Progress of the dumps started by dump_interval_msec.
+    // Default: nullptr
+    DumpCallback dump_callback;
+
+    // Number of threads that load the dump files in open(), each file is loaded by one of them.
+    // 0 uses one thread per CPU.
+    // Default: 0
+    int open_threads;
+
+    // If true, open() maps the dump files for the lifetime of the table and the loaded entries
+    // point into the mappings instead of being copied into memory, so open() only touches
+    // the keys and the pages are read on demand by the kernel.
+    // Values written after open() are copied as usual. Delta files are always copied.
+    // The dump files must not be changed by others while the table is open.
+    // Default: false
+    bool lazy_load;
+
     // Maximum size of a single file.
     // Default: 1073741824(1GB)
     off_t max_file_size;
 
+    // Dump files are cut into data blocks of about block_size bytes,
+    // and a search in a file scans a single block after a binary search of the block index.
+    // Default: 4096
+    size_t block_size;
+
+    // Bits of the bloom filter of a dump file per key, 0 writes no filter.
+    // 10 bits make about 1% of the searches for a missing key read a block.
+    // Requires a comparator that considers keys equal only if their bytes are equal.
+    // Default: 10
+    int bloom_bits_per_key;
+
+    // Codec the data blocks of dump files are written with, a block is stored raw
+    // if it doesn't shrink by an eighth. open() decompresses the blocks in parallel and
+    // reads files of any codec, it fails if a codec is not available in this build.
+    // With lazy_load, the entries of compressed files are held decompressed in memory.
+    // Delta files are not compressed. Ignored with out_of_core, which searches
+    // the files in place and can't open compressed ones.
+    // Default: NO_COMPRESSION
+    Compression compression;
+
+    // If true, open() checks every dump file against the crc32c checksums of its blocks
+    // before loading it, and fails on a mismatch, see also Table::verify().
+    // Files written before there were checksums are not checked.
+    // Default: false
+    bool verify_on_open;
+
+    // Dumps gather entries in a buffer of dump_buffer_size bytes and write it out when it is full,
+    // 0 writes every entry on its own.
+    // Default: 1048576(1MB)
+    size_t dump_buffer_size;
+
+    // If true, dump files are written with O_DIRECT, bypassing the page cache,
+    // where the file system supports it. Requires a dump_buffer_size.
+    // Default: false
+    bool dump_direct_io;
+
+    // If true, the pages of dump files are dropped from the page cache as they are written
+    // with sync_file_range() and posix_fadvise(), so a dump doesn't evict the pages of others.
+    // Only on Linux.
+    // Default: false
+    bool dump_drop_cache;
+
+    // If true, open() doesn't load the dump files but maps them, and get(), multi_get()
+    // and iterators look up the entries written since in memory first, then the files.
+    // A full dump merges both into new files and drops the entries it wrote from memory,
+    // so the table can be several times larger than memory.
+    // The dump files must not be changed by others while the table is open.
+    // Default: false
+    bool out_of_core;
+
+    // If true, entries are carved from 4MB chunks by bumping a pointer, without any bookkeeping
+    // per entry, and the chunks are freed at once with the table. The memory of overwritten
+    // and deleted entries is not reused until then, so it suits tables that are only appended to.
+    // Default: false
+    bool memory_arena;
+
+    // Memory of deleted and overwritten entries is reused for new ones, and memory left free
+    // beyond max_retained_memory bytes is returned to the system, so the memory used
+    // follows the size of the table. Ignored with memory_arena.
+    // Default: 16777216(16MB)
+    size_t max_retained_memory;
+
+    // If true, entries are stored on 2MB huge pages, fewer TLB misses make lookups in large tables
+    // faster. The pages are reserved huge pages if the system has any left, otherwise transparent
+    // huge pages, when they are enabled. Memory is then returned to the system 2MB at a time.
+    // Default: false
+    bool huge_pages;
+
+    // If true, a hash index from key to entry is kept besides the sorted entries,
+    // so get() and multi_get() take one probe instead of O(log n) comparisons.
+    // It costs about 16 bytes per entry, iteration and dumps don't use it.
+    // Requires a comparator that considers keys equal only if their bytes are equal.
+    // Default: false
+    bool hash_index;
+
+    // If true, put(), del() and write() are appended to a log in the table directory,
+    // open() replays it after loading the dumped entries and dump() discards it,
+    // so writes since the last dump survive a crash.
+    // Logs left by an earlier run are replayed regardless of this option.
+    // Default: false
+    bool write_ahead_log;
+
+    // When the write-ahead log is flushed to disk, see WalSync.
+    // Default: WAL_SYNC_PER_WRITE
+    WalSync wal_sync;
+
+    // Interval of the background flush with WAL_SYNC_INTERVAL.
+    // Default: 100
+    int wal_sync_interval_msec;
+
     // Create an Options object with default values for all fields.
     Options();
 };
@@ -4,20 +4,99 @@
 //
 // Thread safety of Table
 // ------------------------
-// Writers require external synchronization
-// Readers require time of a read operation less than Options::read_ttl_msec
+// put(), del() and write() may be called concurrently from multiple threads
+// puts of new and existing keys run in parallel, an overwrite replaces the value in place,
+// deletes, batches holding a delete and growing the hash index wait for the other writers
+// and run alone, as does a dump for the moment it takes its snapshot
+// open() and close() require external synchronization
+// Readers need no synchronization
 
 #ifndef TABLE_TABLE_H
 #define TABLE_TABLE_H
 
+#include <vector>
+
 #include "status.h"
 #include "options.h"
 #include "byte_array.h"
+#include "write_batch.h"
 
 namespace table {
 
+// Memory held by a table, see Table::memory_usage().
+struct MemoryUsage {
+    MemoryUsage() : entries(0), key_bytes(0), value_bytes(0), overhead_bytes(0), pool_bytes(0),
+                    reclaim_pending_bytes(0), mapped_bytes(0) {  }
+
+    // entries in memory, and the bytes of their keys and values,
+    // entries loaded by options.lazy_load point to their keys and values in mapped_bytes instead
+    size_t  entries;
+    size_t  key_bytes;
+    size_t  value_bytes;
+    // node headers and towers, lengths and padding, values replaced in place and the hash index
+    size_t  overhead_bytes;
+    // memory the table has taken from the system for the entries, it holds all of the above
+    size_t  pool_bytes;
+    // of pool_bytes, memory ready for new entries, free_bytes[i] in blocks of 8 * (i + 1) bytes
+    std::vector<size_t>  free_bytes;
+    // of pool_bytes, memory freed while readers may still see it, reused once they can't
+    size_t  reclaim_pending_bytes;
+    // dump files mapped by open() with options.lazy_load or options.out_of_core,
+    // and compressed files decompressed by options.lazy_load
+    size_t  mapped_bytes;
+};
+
 class Table {
 public:
+    // An iterator over the entries of a table in key order.
+    // Entries seen by an iterator stay readable until it is destroyed,
+    // memory freed by concurrent writers is not reclaimed meanwhile, so don't keep it for long.
+    // The iterator must be destroyed before the table is closed.
+    class Iterator {
+    public:
+        explicit Iterator(Table* table);
+        ~Iterator();
+
+        // Returns true if the iterator is positioned at an entry.
+        bool valid() const;
+
+        // Position at the first entry with a key >= "key".
+        void seek(const ByteArray& key);
+
+        // Position at the first entry.
+        void seek_to_first();
+
+        // Position at the last entry.
+        void seek_to_last();
+
+        // Position at the last entry with a key <= "key".
+        void seek_for_prev(const ByteArray& key);
+
+        // Advances to the next entry.
+        // REQUIRES: valid()
+        void next();
+
+        // Moves to the previous entry.
+        // REQUIRES: valid()
+        void prev();
+
+        // Returns the key of the current entry, it points into the table without copying.
+        // REQUIRES: valid()
+        ByteArray key() const;
+
+        // Returns the value of the current entry, it points into the table without copying.
+        // REQUIRES: valid()
+        ByteArray value() const;
+
+        // Non-copying
+        Iterator(const Iterator&) = delete;
+        Iterator& operator=(const Iterator&) = delete;
+
+    private:
+        class IteratorImpl;
+        IteratorImpl *_impl;
+    };
+
     Table(const Options& options, const std::string& filename);
 
     ~Table();
@@ -33,14 +112,43 @@ public:
     Status close();
 
     // Persist the entries to disk.
+    // With options.incremental_dump, only the entries changed since the last dump are written.
     // Returns OK on success.
     Status dump();
 
+    // Persist all entries to disk as a fresh full dump, the incremental dumps are discarded.
+    // Returns OK on success.
+    Status full_dump();
+
+    // Dump the table on a background thread, as dump() would do.
+    // The entries are taken from a snapshot at the time the dump starts,
+    // writers go on meanwhile and their changes are left to the next dump.
+    // "callback", if any, is called on that thread with the progress and the result.
+    // Returns OK if the dump was scheduled, an error if one is already waiting to start.
+    Status dump_async(const DumpCallback& callback = DumpCallback());
+
+    // Check the dump files against their checksums and the entries of all files to be whole,
+    // the files are read on up to options.open_threads threads, dumps wait meanwhile.
+    // Returns OK if no file is corrupted.
+    Status verify();
+
+    // Store the memory held by the table in *usage.
+    // It only sums counters, so it may be called every second while the table is in use.
+    // Returns OK unless the table is closed.
+    Status memory_usage(MemoryUsage* usage);
+
     // Store the corresponding value in *value if the table contains an entry for "key".
     // If value == nullptr, the corresponding value is not set.
     // Returns OK on success.
     Status get(const ByteArray& key, std::string* value);
 
+    // Look up all "keys" at once, the lookups are interleaved to overlap their cache misses.
+    // (*values)[i] and (*statuses)[i] are set as get() would do for keys[i],
+    // either of values and statuses may be nullptr.
+    // Returns OK unless the table is closed.
+    Status multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                     std::vector<Status>* statuses);
+
     // Set the table entry for "key" to "value".
     // Returns OK on success.
     Status put(const ByteArray& key, const ByteArray& value);
@@ -50,6 +158,12 @@ public:
     // Returns OK on success.
     Status del(const ByteArray& key);
 
+    // Apply all records of "batch", in key order with each search resuming from the last one.
+    // Records of the same key are applied in the order they were added.
+    // Unlike del(), deleting a key that does not exist is not an error.
+    // Returns OK on success.
+    Status write(const WriteBatch& batch);
+
     // Non-copying
     Table(const Table&) = delete;
     Table& operator=(const Table&) = delete;
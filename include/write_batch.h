@@ -0,0 +1,62 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// WriteBatch holds a collection of updates to apply to a table with Table::write().
+// Keys and values are copied into the batch, so the arguments may be released after put()/del().
+
+#ifndef TABLE_WRITE_BATCH_H
+#define TABLE_WRITE_BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "byte_array.h"
+
+namespace table {
+
+class WriteBatch {
+public:
+    enum Type {
+        PUT = 0,
+        DEL = 1,
+    };
+
+    WriteBatch();
+    ~WriteBatch();
+
+    // Store the mapping "key->value" in the table.
+    void put(const ByteArray& key, const ByteArray& value);
+
+    // Remove the entry for "key" from the table, if any.
+    void del(const ByteArray& key);
+
+    // Remove all records from the batch.
+    void clear();
+
+    // Returns the number of records in the batch.
+    size_t count() const;
+
+    // Returns the type, key and value of the "i"th record, in the order they were added.
+    // The value of a DEL record is empty.
+    // REQUIRES: i < count()
+    Type type(size_t i) const;
+    ByteArray key(size_t i) const;
+    ByteArray value(size_t i) const;
+
+private:
+    struct Record {
+        Type    type;
+        size_t  offset;
+        size_t  key_size;
+        size_t  value_size;
+    };
+
+    // keys and values of all records back to back
+    std::string          _rep;
+    std::vector<Record>  _records;
+};
+
+} // namespace table
+
+#endif
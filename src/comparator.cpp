@@ -0,0 +1,28 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "comparator.h"
+
+#include "common.h"
+
+namespace table {
+
+class ByteWiseComparator : public Comparator {
+public:
+    int compare(const ByteArray& lhs, const ByteArray& rhs) const override {
+        size_t size = std::min(lhs.size(), rhs.size());
+        int cmp = memcmp(lhs.data(), rhs.data(), size);
+        if (cmp != 0) {
+            return cmp;
+        }
+        return static_cast<int>(lhs.size()) - static_cast<int>(rhs.size());
+    }
+};
+
+Comparator* bytewise_comparator() {
+    static ByteWiseComparator cmp;
+    return &cmp;
+}
+
+} // namespace table
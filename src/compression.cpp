@@ -0,0 +1,237 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "compression.h"
+
+#ifdef TABLE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef TABLE_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace table {
+
+enum {
+    MIN_MATCH  = 4,
+    MAX_OFFSET = 65535,
+    HASH_BITS  = 14,
+    // the last bytes are left to literals, so a match never reads past the end
+    LAST_LITERALS = 8,
+};
+
+static uint32_t load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void put_length(std::string* out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        out->push_back(static_cast<char>(255));
+    }
+    out->push_back(static_cast<char>(length));
+}
+
+static void put_sequence(std::string* out, const char* literals, size_t literal_size,
+                         size_t offset, size_t match_size) {
+    size_t match_code = match_size == 0 ? 0 : match_size - MIN_MATCH;
+    char token = static_cast<char>((std::min<size_t>(literal_size, 15) << 4) |
+                                   std::min<size_t>(match_code, 15));
+    out->push_back(token);
+    if (literal_size >= 15) {
+        put_length(out, literal_size - 15);
+    }
+    out->append(literals, literal_size);
+    if (match_size == 0) {
+        return;
+    }
+    out->push_back(static_cast<char>(offset & 0xff));
+    out->push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15) {
+        put_length(out, match_code - 15);
+    }
+}
+
+static void lz_compress(const char* in, size_t size, std::string* out) {
+    std::vector<uint32_t> table(1 << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (size > LAST_LITERALS && pos + MIN_MATCH < size - LAST_LITERALS) {
+        uint32_t seq = load32(in + pos);
+        uint32_t h = hash32(seq);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(pos);
+
+        if (candidate >= pos || pos - candidate > MAX_OFFSET || load32(in + candidate) != seq) {
+            // skip faster through data that doesn't compress
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t match_size = MIN_MATCH;
+        while (pos + match_size < size - LAST_LITERALS &&
+                in[candidate + match_size] == in[pos + match_size]) {
+            ++match_size;
+        }
+        put_sequence(out, in + anchor, pos - anchor, pos - candidate, match_size);
+        pos += match_size;
+        anchor = pos;
+    }
+    put_sequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+static bool get_length(const char** p, const char* end, size_t* length) {
+    while (true) {
+        if (*p == end) {
+            return false;
+        }
+        unsigned char c = static_cast<unsigned char>(*(*p)++);
+        *length += c;
+        if (c < 255) {
+            return true;
+        }
+    }
+}
+
+static bool lz_decompress(const char* in, size_t size, char* out, size_t raw_size) {
+    const char *p = in;
+    const char *end = in + size;
+    size_t pos = 0;
+    while (p < end) {
+        unsigned char token = static_cast<unsigned char>(*p++);
+        size_t literal_size = token >> 4;
+        if (literal_size == 15 && !get_length(&p, end, &literal_size)) {
+            return false;
+        }
+        if (static_cast<size_t>(end - p) < literal_size || raw_size - pos < literal_size) {
+            return false;
+        }
+        memcpy(out + pos, p, literal_size);
+        p += literal_size;
+        pos += literal_size;
+        if (p == end) {
+            break;
+        }
+
+        if (end - p < 2) {
+            return false;
+        }
+        size_t offset = static_cast<unsigned char>(p[0]) |
+                        (static_cast<size_t>(static_cast<unsigned char>(p[1])) << 8);
+        p += 2;
+        size_t match_size = token & 0x0f;
+        if (match_size == 15 && !get_length(&p, end, &match_size)) {
+            return false;
+        }
+        match_size += MIN_MATCH;
+        if (offset == 0 || offset > pos || raw_size - pos < match_size) {
+            return false;
+        }
+        // the match may overlap the bytes it produces
+        const char *from = out + pos - offset;
+        if (offset >= match_size) {
+            memcpy(out + pos, from, match_size);
+        } else {
+            for (size_t i = 0; i < match_size; ++i) {
+                out[pos + i] = from[i];
+            }
+        }
+        pos += match_size;
+    }
+    return pos == raw_size;
+}
+
+bool compression_supported(Options::Compression type) {
+    switch (type) {
+    case Options::NO_COMPRESSION:
+    case Options::LZ_COMPRESSION:
+        return true;
+#ifdef TABLE_HAVE_ZSTD
+    case Options::ZSTD_COMPRESSION:
+        return true;
+#endif
+#ifdef TABLE_HAVE_LZ4
+    case Options::LZ4_COMPRESSION:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool compress(Options::Compression type, const char* in, size_t size, std::string* out) {
+    switch (type) {
+    case Options::NO_COMPRESSION:
+        out->append(in, size);
+        return true;
+    case Options::LZ_COMPRESSION:
+        lz_compress(in, size, out);
+        return true;
+#ifdef TABLE_HAVE_ZSTD
+    case Options::ZSTD_COMPRESSION: {
+        size_t offset = out->size();
+        out->resize(offset + ZSTD_compressBound(size));
+        size_t n = ZSTD_compress(&(*out)[offset], out->size() - offset, in, size, 1);
+        if (ZSTD_isError(n)) {
+            out->resize(offset);
+            return false;
+        }
+        out->resize(offset + n);
+        return true;
+    }
+#endif
+#ifdef TABLE_HAVE_LZ4
+    case Options::LZ4_COMPRESSION: {
+        if (size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+            return false;
+        }
+        size_t offset = out->size();
+        int bound = LZ4_compressBound(static_cast<int>(size));
+        out->resize(offset + bound);
+        int n = LZ4_compress_default(in, &(*out)[offset], static_cast<int>(size), bound);
+        if (n <= 0) {
+            out->resize(offset);
+            return false;
+        }
+        out->resize(offset + n);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool decompress(Options::Compression type, const char* in, size_t size,
+                char* out, size_t raw_size) {
+    switch (type) {
+    case Options::NO_COMPRESSION:
+        if (size != raw_size) {
+            return false;
+        }
+        memcpy(out, in, size);
+        return true;
+    case Options::LZ_COMPRESSION:
+        return lz_decompress(in, size, out, raw_size);
+#ifdef TABLE_HAVE_ZSTD
+    case Options::ZSTD_COMPRESSION:
+        return ZSTD_decompress(out, raw_size, in, size) == raw_size;
+#endif
+#ifdef TABLE_HAVE_LZ4
+    case Options::LZ4_COMPRESSION:
+        return raw_size <= static_cast<size_t>(LZ4_MAX_INPUT_SIZE) &&
+            LZ4_decompress_safe(in, out, static_cast<int>(size), static_cast<int>(raw_size)) ==
+                static_cast<int>(raw_size);
+#endif
+    default:
+        return false;
+    }
+}
+
+} // namespace table
@@ -0,0 +1,102 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TABLE_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+namespace table {
+namespace crc32c {
+
+// reversed polynomial of crc32c
+static const uint32_t POLY = 0x82f63b78;
+
+// tables[k][b] is the crc of byte b followed by k zero bytes, for slicing by 8
+struct Tables {
+    Tables() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; ++i) {
+                crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+            }
+            t[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) {
+                t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+            }
+        }
+    }
+
+    uint32_t t[8][256];
+};
+
+static uint32_t load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t extend_software(uint32_t crc, const char* data, size_t n) {
+    static const Tables tables;
+    const uint32_t (*t)[256] = tables.t;
+    uint32_t l = ~crc;
+    for (; n >= 8; data += 8, n -= 8) {
+        uint32_t lo = load32(data) ^ l;
+        uint32_t hi = load32(data + 4);
+        l = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; n > 0; ++data, --n) {
+        l = t[0][(l ^ static_cast<unsigned char>(*data)) & 0xff] ^ (l >> 8);
+    }
+    return ~l;
+}
+
+#ifdef TABLE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+uint32_t extend_hardware(uint32_t crc, const char* data, size_t n) {
+    uint64_t l = ~crc;
+    for (; n >= 8; data += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, data, sizeof(w));
+        l = _mm_crc32_u64(l, w);
+    }
+    uint32_t l32 = static_cast<uint32_t>(l);
+    for (; n > 0; ++data, --n) {
+        l32 = _mm_crc32_u8(l32, static_cast<unsigned char>(*data));
+    }
+    return ~l32;
+}
+#else
+uint32_t extend_hardware(uint32_t crc, const char* data, size_t n) {
+    return extend_software(crc, data, n);
+}
+#endif
+
+typedef uint32_t (*ExtendFunc)(uint32_t crc, const char* data, size_t n);
+
+static ExtendFunc choose_extend() {
+#ifdef TABLE_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return extend_hardware;
+    }
+#endif
+    return extend_software;
+}
+
+uint32_t extend(uint32_t crc, const char* data, size_t n) {
+    static const ExtendFunc func = choose_extend();
+    return func(crc, data, n);
+}
+
+bool accelerated() {
+    return choose_extend() != extend_software;
+}
+
+} // namespace crc32c
+} // namespace table
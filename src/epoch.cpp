@@ -0,0 +1,62 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "epoch.h"
+
+namespace table {
+
+// blocks allocated fresh are tagged with epoch 0, start at 2 so they are reclaimable at once
+Epoch::Epoch() : _epoch(2) {
+    for (int i = 0; i < NSLOT; ++i) {
+        for (int j = 0; j < NSTRIPE; ++j) {
+            _readers[i][j].n.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+int Epoch::stripe() {
+    static std::atomic<int> next_stripe(0);
+    static thread_local int stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % NSTRIPE;
+    return stripe;
+}
+
+uint64_t Epoch::enter() {
+    int s = stripe();
+    while (true) {
+        uint64_t e = _epoch.load();
+        _readers[e % NSLOT][s].n.fetch_add(1);
+        // the epoch may have moved on before our counter became visible
+        if (_epoch.load() == e) {
+            return e * NSTRIPE + s;
+        }
+        _readers[e % NSLOT][s].n.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void Epoch::leave(uint64_t token) {
+    _readers[(token / NSTRIPE) % NSLOT][token % NSTRIPE].n.fetch_sub(1, std::memory_order_release);
+}
+
+uint64_t Epoch::current() const {
+    return _epoch.load(std::memory_order_acquire);
+}
+
+bool Epoch::reclaimable(uint64_t epoch) const {
+    return epoch + 2 <= current();
+}
+
+bool Epoch::try_advance() {
+    uint64_t e = _epoch.load();
+    // every pinned reader must be at the current epoch
+    for (uint64_t slot = e + 1; slot < e + NSLOT; ++slot) {
+        for (int j = 0; j < NSTRIPE; ++j) {
+            if (_readers[slot % NSLOT][j].n.load() != 0) {
+                return false;
+            }
+        }
+    }
+    return _epoch.compare_exchange_strong(e, e + 1);
+}
+
+} // namespace table
@@ -0,0 +1,164 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "file_writer.h"
+
+#include <sys/uio.h>
+
+namespace table {
+
+FileWriter::FileWriter(size_t buffer_size, bool direct_io, bool drop_cache) :
+    _buffer_size(buffer_size), _direct_io(direct_io && buffer_size > 0), _drop_cache(drop_cache),
+    _fd(-1), _direct(false), _buffer(nullptr, free), _buffered(0),
+    _written(0), _writeback(0), _dropped(0) {
+    if (_buffer_size > 0) {
+        // O_DIRECT writes whole aligned blocks
+        _buffer_size = (_buffer_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT *
+            DIRECT_IO_ALIGNMENT;
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, _buffer_size) == 0) {
+            _buffer.reset(static_cast<char*>(buffer));
+        } else {
+            _buffer_size = 0;
+            _direct_io = false;
+        }
+    }
+}
+
+FileWriter::~FileWriter() {
+    if (_fd != -1) {
+        ::close(_fd);
+    }
+}
+
+Status FileWriter::open(const std::string& path) {
+    _path = path;
+    _buffered = 0;
+    _written = 0;
+    _writeback = 0;
+    _dropped = 0;
+    _direct = false;
+#ifdef O_DIRECT
+    if (_direct_io) {
+        _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        // tmpfs and others refuse O_DIRECT
+        _direct = _fd != -1;
+    }
+#endif
+    if (_fd == -1) {
+        _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (_fd == -1) {
+        return Status::io_error("open " + _path + " error, " + strerror(errno));
+    }
+    return Status::ok();
+}
+
+Status FileWriter::append(const char* data, size_t size) {
+    if (_buffer_size == 0) {
+        struct iovec iov = {const_cast<char*>(data), size};
+        return write(&iov, 1);
+    }
+
+    // O_DIRECT can't write from "data", so it is always copied
+    if (!_direct && _buffered + size > _buffer_size && size >= _buffer_size) {
+        struct iovec iov[2] = {{_buffer.get(), _buffered}, {const_cast<char*>(data), size}};
+        _buffered = 0;
+        return write(iov, 2);
+    }
+    while (size > 0) {
+        size_t n = std::min(size, _buffer_size - _buffered);
+        memcpy(_buffer.get() + _buffered, data, n);
+        _buffered += n;
+        data += n;
+        size -= n;
+        if (_buffered == _buffer_size) {
+            Status s = flush();
+            if (!s.good()) {
+                return s;
+            }
+        }
+    }
+    return Status::ok();
+}
+
+Status FileWriter::close(bool sync) {
+    if (_fd == -1) {
+        return Status::ok();
+    }
+
+#ifdef O_DIRECT
+    if (_direct && _buffered % DIRECT_IO_ALIGNMENT != 0) {
+        // the tail is not a whole block
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+        _direct = false;
+    }
+#endif
+    Status s = flush();
+    if (s.good() && sync && fdatasync(_fd) == -1) {
+        s = Status::io_error("fdatasync " + _path + " error, " + strerror(errno));
+    }
+    if (s.good() && _drop_cache) {
+        drop_cache();
+        drop_cache();
+    }
+    ::close(_fd);
+    _fd = -1;
+    return s;
+}
+
+Status FileWriter::flush() {
+    if (_buffered == 0) {
+        return Status::ok();
+    }
+    struct iovec iov = {_buffer.get(), _buffered};
+    _buffered = 0;
+    return write(&iov, 1);
+}
+
+Status FileWriter::write(struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = ::writev(_fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return Status::io_error("write " + _path + " error, " + strerror(errno));
+        }
+        _written += n;
+        // skip what was written, writev() may stop short
+        for (; iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len; ++iov, --iovcnt) {
+            n -= iov->iov_len;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    if (_drop_cache && _written - _writeback >= DROP_CACHE_INTERVAL) {
+        drop_cache();
+    }
+    return Status::ok();
+}
+
+void FileWriter::drop_cache() {
+#ifdef __linux__
+    // the pages are only dropped once they are clean, so writeback of the newest bytes
+    // is started and the bytes before them, likely written back by now, are waited for
+    if (_writeback > _dropped) {
+        sync_file_range(_fd, _dropped, _writeback - _dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(_fd, _dropped, _writeback - _dropped, POSIX_FADV_DONTNEED);
+        _dropped = _writeback;
+    }
+    if (_written > _writeback) {
+        sync_file_range(_fd, _writeback, _written - _writeback, SYNC_FILE_RANGE_WRITE);
+        _writeback = _written;
+    }
+#endif
+}
+
+} // namespace table
@@ -0,0 +1,291 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "log.h"
+#include "crc32c.h"
+
+namespace table {
+
+const char LOG_MAGIC[8] = {'T', 'A', 'B', 'L', 'E', 'L', 'O', 'G'};
+
+static uint32_t record_crc(size_t size, const char* body) {
+    uint32_t crc = crc32c::value(reinterpret_cast<const char*>(&size), sizeof(size));
+    return crc32c::extend(crc, body, size);
+}
+
+LogWriter::LogWriter(const std::string& path, const Options& options) :
+    _path(path), _sync(options.wal_sync), _sync_interval_msec(options.wal_sync_interval_msec),
+    _fd(-1), _closing(false) {
+}
+
+LogWriter::~LogWriter() {
+    close();
+}
+
+Status LogWriter::open() {
+    _fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (_fd == -1) {
+        return Status::io_error("open " + _path + " error, " + strerror(errno));
+    }
+    struct stat info;
+    if (fstat(_fd, &info) != 0) {
+        return Status::io_error("stat " + _path + " error, " + strerror(errno));
+    }
+    if (info.st_size == 0) {
+        _buffer.assign(LOG_MAGIC, sizeof(LOG_MAGIC));
+        Status s = write_buffer();
+        if (!s.good()) {
+            return s;
+        }
+    }
+    if (_sync == Options::WAL_SYNC_INTERVAL) {
+        _sync_thread = std::thread(&LogWriter::sync_loop, this);
+    }
+    return Status::ok();
+}
+
+Status LogWriter::close() {
+    if (_fd == -1) {
+        return Status::ok();
+    }
+
+    if (_sync_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closing = true;
+        }
+        _sync_cv.notify_one();
+        _sync_thread.join();
+    }
+
+    Status s = _status;
+    if (s.good() && _sync != Options::WAL_SYNC_NONE && fdatasync(_fd) == -1) {
+        s = Status::io_error("fdatasync " + _path + " error, " + strerror(errno));
+    }
+    ::close(_fd);
+    _fd = -1;
+    return s;
+}
+
+static void encode_entry(std::string* body, WriteBatch::Type type,
+                         const ByteArray& key, const ByteArray& value) {
+    body->push_back(static_cast<char>(type));
+    size_t size = key.size();
+    body->append(reinterpret_cast<const char*>(&size), sizeof(size));
+    body->append(key.data(), size);
+    size = value.size();
+    body->append(reinterpret_cast<const char*>(&size), sizeof(size));
+    body->append(value.data(), size);
+}
+
+void LogWriter::encode_put(std::string* body, const ByteArray& key, const ByteArray& value) {
+    encode_entry(body, WriteBatch::PUT, key, value);
+}
+
+void LogWriter::encode_del(std::string* body, const ByteArray& key) {
+    encode_entry(body, WriteBatch::DEL, key, ByteArray());
+}
+
+void LogWriter::encode(std::string* body, const WriteBatch& batch) {
+    for (size_t i = 0; i < batch.count(); ++i) {
+        encode_entry(body, batch.type(i), batch.key(i), batch.value(i));
+    }
+}
+
+Status LogWriter::add_record(const std::string& body, const std::function<void()>& apply) {
+    // checksummed before queuing, so the leader doesn't do it for everyone under the mutex
+    Writer w(&body, record_crc(body.size(), body.data()), &apply);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _writers.push_back(&w);
+    while (!w.done && &w != _writers.front()) {
+        w.cv.wait(lock);
+    }
+    if (w.done) {
+        return w.status;
+    }
+
+    // we are the leader, write the records of everyone queued behind us as well
+    Writer *last = _writers.back();
+    std::vector<Writer*> group(_writers.begin(), _writers.end());
+    _buffer.clear();
+    for (Writer *writer : group) {
+        size_t size = writer->body->size();
+        _buffer.append(reinterpret_cast<const char*>(&writer->crc), sizeof(writer->crc));
+        _buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        _buffer.append(*writer->body);
+    }
+
+    Status s = _status;
+    if (s.good()) {
+        // newcomers queue up behind us meanwhile and form the next group,
+        // which is only written once this one is applied
+        lock.unlock();
+        s = write_buffer();
+        if (s.good()) {
+            for (Writer *writer : group) {
+                (*writer->apply)();
+            }
+        }
+        lock.lock();
+        if (!s.good()) {
+            _status = s;
+        }
+    }
+
+    while (true) {
+        Writer *writer = _writers.front();
+        _writers.pop_front();
+        if (writer != &w) {
+            writer->status = s;
+            writer->done = true;
+            writer->cv.notify_one();
+        }
+        if (writer == last) {
+            break;
+        }
+    }
+    if (!_writers.empty()) {
+        _writers.front()->cv.notify_one();
+    }
+    return s;
+}
+
+Status LogWriter::write_buffer() {
+    const char *data = _buffer.data();
+    size_t left = _buffer.size();
+    while (left > 0) {
+        ssize_t n = ::write(_fd, data, left);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return Status::io_error("write " + _path + " error, " + strerror(errno));
+        }
+        data += n;
+        left -= n;
+    }
+
+    if (_sync == Options::WAL_SYNC_PER_WRITE && fdatasync(_fd) == -1) {
+        return Status::io_error("fdatasync " + _path + " error, " + strerror(errno));
+    }
+    return Status::ok();
+}
+
+void LogWriter::sync_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_closing) {
+        _sync_cv.wait_for(lock, std::chrono::milliseconds(_sync_interval_msec));
+        lock.unlock();
+        // a failure will show up again at the next write or at close()
+        fdatasync(_fd);
+        lock.lock();
+    }
+}
+
+Status read_log(const std::string& path, const std::function<void(const WriteBatch&)>& apply) {
+    auto close_func = [](int* fd) {
+        if (fd) {
+            ::close(*fd);
+            delete fd;
+        }
+    };
+    std::shared_ptr<int> fd(new int(::open(path.c_str(), O_RDONLY)), close_func);
+    if (*fd == -1) {
+        return Status::io_error("open " + path + " error, " + strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(*fd, &info) != 0) {
+        return Status::io_error("stat " + path + " error, " + strerror(errno));
+    }
+    if (info.st_size == 0) {
+        return Status::ok();
+    }
+
+    auto munmap_func = [&info](char *data) {
+        if (data != MAP_FAILED) {
+            munmap(data, info.st_size);
+        }
+    };
+    std::shared_ptr<char> data(
+        reinterpret_cast<char*>(mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, *fd, 0)),
+        munmap_func);
+    if (data.get() == MAP_FAILED) {
+        return Status::io_error("mmap " + path + " error, " + strerror(errno));
+    }
+
+    // a length that runs past the end marks a torn record, nothing after it was acknowledged
+    auto read_size = [](const char** p, const char* end, size_t* size) {
+        if (static_cast<size_t>(end - *p) < sizeof(size_t)) {
+            return false;
+        }
+        memcpy(size, *p, sizeof(size_t));
+        *p += sizeof(size_t);
+        return *size <= static_cast<size_t>(end - *p);
+    };
+
+    const char *p = data.get();
+    const char *end = p + info.st_size;
+    bool checksummed = static_cast<size_t>(info.st_size) >= sizeof(LOG_MAGIC) &&
+                       memcmp(p, LOG_MAGIC, sizeof(LOG_MAGIC)) == 0;
+    if (checksummed) {
+        p += sizeof(LOG_MAGIC);
+    }
+    WriteBatch batch;
+    while (p < end) {
+        // a zero-filled or garbage tail fails the crc32c even where its lengths look plausible
+        uint32_t crc = 0;
+        if (checksummed) {
+            if (static_cast<size_t>(end - p) < sizeof(crc)) {
+                break;
+            }
+            memcpy(&crc, p, sizeof(crc));
+            p += sizeof(crc);
+        }
+        size_t body_size;
+        if (!read_size(&p, end, &body_size)) {
+            break;
+        }
+        if (checksummed ? record_crc(body_size, p) != crc : body_size == 0) {
+            break;
+        }
+        const char *body_end = p + body_size;
+
+        batch.clear();
+        bool torn = false;
+        while (p < body_end && !torn) {
+            WriteBatch::Type type = static_cast<WriteBatch::Type>(*p++);
+            size_t key_size, value_size;
+            if (!read_size(&p, body_end, &key_size)) {
+                torn = true;
+                break;
+            }
+            ByteArray key(p, key_size);
+            p += key_size;
+            if (!read_size(&p, body_end, &value_size)) {
+                torn = true;
+                break;
+            }
+            ByteArray value(p, value_size);
+            p += value_size;
+
+            if (type == WriteBatch::PUT) {
+                batch.put(key, value);
+            } else if (type == WriteBatch::DEL) {
+                batch.del(key);
+            } else {
+                torn = true;
+            }
+        }
+        if (torn) {
+            break;
+        }
+
+        apply(batch);
+    }
+
+    return Status::ok();
+}
+
+} // namespace table
@@ -6,66 +6,278 @@
 
 namespace table {
 
+constexpr uint64_t MemoryPool::NO_EPOCH;
+
 static inline size_t round_up(size_t n, size_t align) {
     return (n + align - 1) & ~(align - 1);
 }
 
-MemoryPool::MemoryPool(int ttl_msec) : _ttl_msec(ttl_msec) {  }
+// Map "size" bytes aligned to "align", both multiples of the page size.
+// With "huge_pages", the memory is backed by huge pages of HUGE_PAGE_SIZE bytes:
+// reserved ones if the system has any left, otherwise transparent ones.
+static char* map_aligned(size_t size, size_t align, bool huge_pages) {
+    void *p;
+#ifdef MAP_HUGETLB
+    if (huge_pages) {
+        // huge page mappings are aligned to the huge page size
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return static_cast<char*>(p);
+        }
+    }
+#endif
+
+    // map more and trim it to an aligned range
+    p = mmap(nullptr, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    char *addr = static_cast<char*>(p);
+    char *base = reinterpret_cast<char*>(round_up(reinterpret_cast<uintptr_t>(addr), align));
+    if (base > addr) {
+        munmap(addr, base - addr);
+    }
+    munmap(base + size, addr + align - base);
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+#endif
+    return base;
+}
+
+MemoryPool::MemoryPool(Epoch* epoch, bool arena, size_t max_retained, bool huge_pages) :
+    _epoch(epoch), _ndealloc(0), _arena(arena), _huge_pages(huge_pages),
+    _slab_size(huge_pages ? HUGE_PAGE_SIZE : SLAB_SIZE),
+    _arena_chunk(nullptr), _max_retained(max_retained), _retained(0),
+    _slab_head(), _slab_tail(), _reclaim_epoch(NO_EPOCH), _free_blocks(),
+    _retired_bytes(0), _persist_bytes(0), _large_bytes(0) {
+    for (auto& cache : _caches) {
+        cache.ndealloc = 0;
+        cache.npending = 0;
+    }
+}
 
 MemoryPool::~MemoryPool() {
-    for (const auto& p : _blocks) {
-        delete[] p;
+    for (const auto& slab : _slabs) {
+        munmap(slab, _slab_size);
+    }
+    for (const auto& block : _blocks) {
+        delete[] block.first;
+    }
+    for (const auto& chunk : _arena_chunks) {
+        munmap(chunk->addr, ARENA_CHUNK_SIZE);
     }
 }
 
 char* MemoryPool::alloc(size_t size) {
-    free_expired_block();
+    if (_arena && size <= ARENA_MAX_BLOCK_SIZE) {
+        return alloc_arena(round_up(size, ALIGN));
+    }
 
     size = round_up(size, ALIGN);
-    if (size > MAX_BLOCK_SIZE) {
-        return alloc_large(size);
+    if (size <= MAX_BLOCK_SIZE) {
+        uint64_t epoch = _reclaim_epoch.load(std::memory_order_relaxed);
+        if (epoch != NO_EPOCH && _epoch->reclaimable(epoch)) {
+            // blocks retired to the pool are waiting to be freed
+            std::lock_guard<std::mutex> guard(_mutex);
+            free_reclaimable_block();
+        }
+        return alloc_small(size);
+    }
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    free_reclaimable_block();
+    return alloc_large(size);
+}
+
+char* MemoryPool::alloc_arena(size_t size) {
+    while (true) {
+        ArenaChunk *chunk = _arena_chunk.load(std::memory_order_acquire);
+        if (chunk) {
+            size_t offset = chunk->used.fetch_add(size, std::memory_order_relaxed);
+            if (offset + size <= ARENA_CHUNK_SIZE) {
+                return chunk->addr + offset;
+            }
+        }
+
+        // the chunk is full, the first thread to get here replaces it and the rest retry
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_arena_chunk.load(std::memory_order_relaxed) == chunk) {
+            std::unique_ptr<ArenaChunk> next(new ArenaChunk);
+            next->addr = map_aligned(ARENA_CHUNK_SIZE, HUGE_PAGE_SIZE, _huge_pages);
+            next->used = 0;
+            _arena_chunk.store(next.get(), std::memory_order_release);
+            _arena_chunks.push_back(std::move(next));
+        }
     }
-    return alloc_small(size);
 }
 
 char* MemoryPool::alloc_small(size_t size) {
     size_t index = size / ALIGN - 1;
-    if (_block_queue[index].empty() ||
-            _block_queue[index].front().expire_at > std::chrono::steady_clock::now()) {
-        refill(&_block_queue[index], size);
+    Cache& cache = _caches[Epoch::stripe() % NCACHE];
+    std::lock_guard<std::mutex> guard(cache.mutex);
+    std::deque<Block>& blocks = cache.blocks[index];
+    if (!blocks.empty() && !_epoch->reclaimable(blocks.front().epoch) &&
+            ++cache.npending % ADVANCE_INTERVAL == 0) {
+        // give the retired blocks a chance before taking new ones, now and then
+        // as a long-lived reader keeps them pending
+        _epoch->try_advance();
+    }
+    if (blocks.empty() || !_epoch->reclaimable(blocks.front().epoch)) {
+        char *batch[TRANSFER_BATCH];
+        {
+            std::lock_guard<std::mutex> pool_guard(_mutex);
+            free_reclaimable_block();
+            for (int i = 0; i < TRANSFER_BATCH; ++i) {
+                batch[i] = take_block(size);
+            }
+        }
+        for (int i = TRANSFER_BATCH - 1; i >= 0; --i) {
+            blocks.emplace_front(Block{batch[i], 0});
+        }
     }
-    char *addr = _block_queue[index].front().addr;
-    _block_queue[index].pop_front();
+    char *addr = blocks.front().addr;
+    blocks.pop_front();
     return addr;
 }
 
+char* MemoryPool::take_block(size_t size) {
+    size_t index = size / ALIGN - 1;
+    Slab *slab = _slab_head[index];
+    if (!slab && !_block_retired.empty()) {
+        // give the retired blocks a chance before mapping a new slab
+        _epoch->try_advance();
+        free_reclaimable_block();
+        slab = _slab_head[index];
+    }
+    if (!slab) {
+        slab = new_slab(size);
+    }
+
+    char *p;
+    if (slab->free_head) {
+        p = slab->free_head;
+        slab->free_head = *reinterpret_cast<char**>(p);
+        if (!slab->free_head) {
+            slab->free_tail = nullptr;
+        }
+    } else {
+        p = slab->unused;
+        slab->unused += size;
+    }
+    --_free_blocks[index];
+    if (slab->used++ == 0) {
+        _retained -= _slab_size;
+    }
+    if (!slab->free_head && slab->unused + size > reinterpret_cast<char*>(slab) + _slab_size) {
+        unlink_slab(slab);
+    }
+    return p;
+}
+
 char* MemoryPool::alloc_large(size_t size) {
     char *p = new char[size];
-    _blocks.insert(p);
+    _blocks.emplace(p, size);
+    _large_bytes += size;
     return p;
 }
 
 void MemoryPool::dealloc(char *p, size_t size) {
-    free_expired_block();
+    if (_arena && size <= ARENA_MAX_BLOCK_SIZE) {
+        return;
+    }
 
     size = round_up(size, ALIGN);
-    if (size > MAX_BLOCK_SIZE) {
-        return dealloc_large(p, size);
+    if (size <= MAX_BLOCK_SIZE) {
+        return dealloc_small(p, size);
     }
-    return dealloc_small(p, size);
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (++_ndealloc % ADVANCE_INTERVAL == 0) {
+        _epoch->try_advance();
+    }
+    free_reclaimable_block();
+    return dealloc_large(p, size);
 }
 
 void MemoryPool::dealloc_small(char *p, size_t size) {
     size_t index = size / ALIGN - 1;
-    _block_queue[index].emplace_back(Block{p,
-        std::chrono::steady_clock::now() + std::chrono::milliseconds(_ttl_msec)});
+    Cache& cache = _caches[Epoch::stripe() % NCACHE];
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    std::deque<Block>& blocks = cache.blocks[index];
+    blocks.emplace_back(Block{p, _epoch->current()});
+    if (++cache.ndealloc % ADVANCE_INTERVAL == 0) {
+        _epoch->try_advance();
+    }
+    if (blocks.size() <= CACHE_LIMIT) {
+        return;
+    }
+
+    // hand the oldest blocks back to the slabs
+    char *batch[TRANSFER_BATCH];
+    for (int i = 0; i < TRANSFER_BATCH; ++i) {
+        batch[i] = blocks.front().addr;
+        blocks.pop_front();
+    }
+    lock.unlock();
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    // retired no later than now, so they are reclaimable once the current epoch is
+    uint64_t epoch = _epoch->current();
+    for (char *addr : batch) {
+        _block_retired.emplace(Block{addr, epoch});
+    }
+    _retired_bytes += size * TRANSFER_BATCH;
+    free_reclaimable_block();
+}
+
+void MemoryPool::update_reclaim_epoch() {
+    uint64_t epoch = NO_EPOCH;
+    if (!_block_retired.empty()) {
+        epoch = _block_retired.front().epoch;
+    }
+    if (!_block_persist.empty()) {
+        epoch = std::min(epoch, _block_persist.front().epoch);
+    }
+    _reclaim_epoch.store(epoch, std::memory_order_relaxed);
 }
 
 void MemoryPool::dealloc_large(char *p, size_t size) {
-    _block_persist.emplace(Block{p,
-        std::chrono::steady_clock::now() + std::chrono::milliseconds(_ttl_msec)});
+    _block_persist.emplace(Block{p, _epoch->current()});
+    _persist_bytes += size;
+    update_reclaim_epoch();
+}
 
-    (void)size;
+void MemoryPool::usage(Usage* usage) {
+    for (size_t i = 0; i < NCLASS; ++i) {
+        usage->free_bytes[i] = 0;
+    }
+    usage->reclaim_pending_bytes = 0;
+
+    for (auto& cache : _caches) {
+        std::lock_guard<std::mutex> guard(cache.mutex);
+        for (size_t i = 0; i < NCLASS; ++i) {
+            const std::deque<Block>& blocks = cache.blocks[i];
+            // the blocks retired at epochs not yet reclaimable are at the back
+            size_t pending = 0;
+            for (auto it = blocks.rbegin();
+                 it != blocks.rend() && !_epoch->reclaimable(it->epoch); ++it) {
+                ++pending;
+            }
+            usage->free_bytes[i] += (blocks.size() - pending) * (i + 1) * ALIGN;
+            usage->reclaim_pending_bytes += pending * (i + 1) * ALIGN;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    usage->system_bytes = _slabs.size() * _slab_size + _arena_chunks.size() * ARENA_CHUNK_SIZE +
+        _large_bytes;
+    for (size_t i = 0; i < NCLASS; ++i) {
+        usage->free_bytes[i] += _free_blocks[i] * (i + 1) * ALIGN;
+    }
+    usage->reclaim_pending_bytes += _retired_bytes + _persist_bytes;
 }
 
 char* MemoryPool::dup(const char* p, size_t size) {
@@ -74,32 +286,111 @@ char* MemoryPool::dup(const char* p, size_t size) {
     return new_p;
 }
 
-void MemoryPool::refill(std::deque<Block>* que, size_t size) {
-    // we refill NBLOCK blocks at a time
-    static constexpr int NBLOCK = 20;
+size_t MemoryPool::slab_capacity(size_t size) const {
+    return (_slab_size - SLAB_HEADER_SIZE) / size;
+}
 
-    char *p = new char[size * NBLOCK];
-    _blocks.insert(p);
-    auto now = std::chrono::steady_clock::now();
-    for (int i = 0; i < NBLOCK; ++i) {
-        que->emplace_front(Block{p, now});
-        p += size;
+MemoryPool::Slab* MemoryPool::new_slab(size_t size) {
+    char *base = map_aligned(_slab_size, _slab_size, _huge_pages);
+
+    Slab *slab = reinterpret_cast<Slab*>(base);
+    slab->prev = nullptr;
+    slab->next = nullptr;
+    slab->free_head = nullptr;
+    slab->free_tail = nullptr;
+    slab->unused = base + SLAB_HEADER_SIZE;
+    slab->size = size;
+    slab->used = 0;
+    slab->listed = false;
+    _slabs.insert(slab);
+    _free_blocks[size / ALIGN - 1] += slab_capacity(size);
+    _retained += _slab_size;
+    link_slab(slab);
+    return slab;
+}
+
+void MemoryPool::release_slab(Slab* slab) {
+    if (slab->listed) {
+        unlink_slab(slab);
+    }
+    _slabs.erase(slab);
+    _free_blocks[slab->size / ALIGN - 1] -= slab_capacity(slab->size);
+    munmap(slab, _slab_size);
+}
+
+void MemoryPool::link_slab(Slab* slab) {
+    size_t index = slab->size / ALIGN - 1;
+    slab->prev = _slab_tail[index];
+    slab->next = nullptr;
+    if (_slab_tail[index]) {
+        _slab_tail[index]->next = slab;
+    } else {
+        _slab_head[index] = slab;
+    }
+    _slab_tail[index] = slab;
+    slab->listed = true;
+}
+
+void MemoryPool::unlink_slab(Slab* slab) {
+    size_t index = slab->size / ALIGN - 1;
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        _slab_head[index] = slab->next;
     }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    } else {
+        _slab_tail[index] = slab->prev;
+    }
+    slab->listed = false;
 }
 
-void MemoryPool::free_expired_block() {
-    auto now = std::chrono::steady_clock::now();
+void MemoryPool::free_reclaimable_block() {
+    while (!_block_retired.empty()) {
+        char *p = _block_retired.front().addr;
+        if (!_epoch->reclaimable(_block_retired.front().epoch)) {
+            // subsequent blocks were retired at the same or a later epoch
+            break;
+        }
+        _block_retired.pop();
+
+        Slab *slab = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) & ~(_slab_size - 1));
+        _retired_bytes -= slab->size;
+        ++_free_blocks[slab->size / ALIGN - 1];
+        *reinterpret_cast<char**>(p) = nullptr;
+        if (slab->free_tail) {
+            *reinterpret_cast<char**>(slab->free_tail) = p;
+        } else {
+            slab->free_head = p;
+        }
+        slab->free_tail = p;
+        if (!slab->listed) {
+            link_slab(slab);
+        }
+        if (--slab->used == 0) {
+            if (_retained + _slab_size > _max_retained) {
+                release_slab(slab);
+            } else {
+                _retained += _slab_size;
+            }
+        }
+    }
+
     while (!_block_persist.empty()) {
         const Block& front = _block_persist.front();
-        if (front.expire_at > now) {
-            // subsequent blocks has not expired
+        if (!_epoch->reclaimable(front.epoch)) {
             break;
         }
 
+        auto it = _blocks.find(front.addr);
+        _persist_bytes -= it->second;
+        _large_bytes -= it->second;
         delete[] front.addr;
-        _blocks.erase(front.addr);
+        _blocks.erase(it);
         _block_persist.pop();
     }
+    update_reclaim_epoch();
 }
 
 } // namespace table
\ No newline at end of file
@@ -8,30 +8,33 @@
 
 namespace table {
 
-class ByteWiseComparator : public Comparator {
-public:
-    int compare(const ByteArray& lhs, const ByteArray& rhs) const override {
-        size_t size = std::min(lhs.size(), rhs.size());
-        int cmp = memcmp(lhs.data(), rhs.data(), size);
-        if (cmp != 0) {
-            return cmp;
-        }
-        return static_cast<int>(lhs.size()) - static_cast<int>(rhs.size());
-    }
-};
-
-static Comparator* default_comparator() {
-    static ByteWiseComparator cmp;
-    return &cmp;
-}
-
 Options::Options() :
-    comparator(default_comparator()),
+    comparator(bytewise_comparator()),
     create_if_missing(false),
     error_if_exists(false),
     dump_when_close(true),
     read_ttl_msec(2000),
-    max_file_size(1024 * 1024 * 1024) {
+    incremental_dump(false),
+    dump_interval_msec(0),
+    dump_callback(nullptr),
+    open_threads(0),
+    lazy_load(false),
+    max_file_size(1024 * 1024 * 1024),
+    block_size(4096),
+    bloom_bits_per_key(10),
+    compression(NO_COMPRESSION),
+    verify_on_open(false),
+    dump_buffer_size(1024 * 1024),
+    dump_direct_io(false),
+    dump_drop_cache(false),
+    out_of_core(false),
+    memory_arena(false),
+    max_retained_memory(16 * 1024 * 1024),
+    huge_pages(false),
+    hash_index(false),
+    write_ahead_log(false),
+    wal_sync(WAL_SYNC_PER_WRITE),
+    wal_sync_interval_msec(100) {
 }
 
 } // namespace table
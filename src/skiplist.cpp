@@ -6,75 +6,389 @@
 
 namespace table {
 
-SkipList::Iterator::Iterator() : _node(nullptr) {  }
-SkipList::Iterator::Iterator(Node* node) : _node(node) {  }
+SkipList::Iterator::Iterator() : _list(nullptr), _node(nullptr) {  }
+SkipList::Iterator::Iterator(SkipList* list, Node* node) : _list(list), _node(node) {  }
 SkipList::Iterator::~Iterator() {  }
-void SkipList::Iterator::next() { _node = _node->next[0]; }
-bool SkipList::Iterator::good() { return _node != nullptr; }
-const ByteArray& SkipList::Iterator::key() { return _node->key; }
-const ByteArray& SkipList::Iterator::value() { return _node->value; }
+void SkipList::Iterator::next() { _node = _node->next[0].load(std::memory_order_acquire); }
+void SkipList::Iterator::prev() { _node = _list->find_prev(_node); }
+bool SkipList::Iterator::good() const { return _node != nullptr; }
+ByteArray SkipList::Iterator::key() const { return _node->key(); }
+ByteArray SkipList::Iterator::value() const {
+    return value_of(_node->value.load(std::memory_order_acquire));
+}
+uint64_t SkipList::Iterator::version() const {
+    return _node->version.load(std::memory_order_relaxed);
+}
+
+SkipList::Finger::Finger(SkipList* list) {
+    std::fill_n(_prev, static_cast<int>(MAX_HEIGHT), list->_head);
+}
+
+SkipList::Run::Run(SkipList* list) : _list(list), _height(0), _size(0) {
+    std::fill_n(_first, static_cast<int>(MAX_HEIGHT), nullptr);
+    std::fill_n(_last, static_cast<int>(MAX_HEIGHT), nullptr);
+}
+
+SkipList::Run::~Run() {
+    Node *node = _first[0];
+    while (node) {
+        Node *next = node->next[0].load(std::memory_order_relaxed);
+        _list->delete_node(node);
+        node = next;
+    }
+}
+
+bool SkipList::Run::append(const ByteArray& key, const ByteArray& value) {
+    if (_last[0] && _list->compare(_last[0], key, key_prefix(key)) >= 0) {
+        return false;
+    }
+    link(_list->new_node(key, value, _list->random_height()));
+    return true;
+}
 
-SkipList::SkipList(Comparator* cmp, MemoryPool *pool) :
-        _height(1), _head(nullptr), _rand(RANDOM_SEED), _cmp(cmp), _pool(pool) {
+bool SkipList::Run::append_in_place(const ByteArray& key, const char* value) {
+    if (_last[0] && _list->compare(_last[0], key, key_prefix(key)) >= 0) {
+        return false;
+    }
+    link(_list->new_mapped_node(key, value, _list->random_height()));
+    return true;
+}
+
+void SkipList::Run::link(Node* node) {
+    node->prev.store(_last[0], std::memory_order_relaxed);
+    for (int i = 0; i < node->height; ++i) {
+        if (_last[i]) {
+            _last[i]->next[i].store(node, std::memory_order_relaxed);
+        } else {
+            _first[i] = node;
+        }
+        _last[i] = node;
+    }
+    _height = std::max(_height, node->height);
+    ++_size;
+}
+
+SkipList::Node* const SkipList::INDEX_TOMBSTONE = reinterpret_cast<SkipList::Node*>(1);
+
+SkipList::SkipList(Comparator* cmp, MemoryPool *pool, bool hash_index) :
+        _height(1), _head(nullptr), _cmp(cmp), _pool(pool), _bytewise(cmp == bytewise_comparator()),
+        _index(nullptr), _index_used(0), _version(1), _snapshot(0),
+        _removed(UndoCompare{cmp}), _removed_changes(0) {
+    for (auto& stats : _stats) {
+        stats.entries.store(0, std::memory_order_relaxed);
+        stats.key_bytes.store(0, std::memory_order_relaxed);
+        stats.value_bytes.store(0, std::memory_order_relaxed);
+        stats.overhead_bytes.store(0, std::memory_order_relaxed);
+    }
     _head = new_node("head", "head", MAX_HEIGHT);
+    // the head is no entry, its key and value are overhead
+    account(-1, -4, -4, 8);
+    if (hash_index) {
+        _index.store(new_index(MIN_INDEX_CAPACITY), std::memory_order_release);
+    }
+}
+
+void SkipList::usage(Usage* usage) const {
+    int64_t entries = 0, key_bytes = 0, value_bytes = 0, overhead_bytes = 0;
+    for (const auto& stats : _stats) {
+        entries += stats.entries.load(std::memory_order_relaxed);
+        key_bytes += stats.key_bytes.load(std::memory_order_relaxed);
+        value_bytes += stats.value_bytes.load(std::memory_order_relaxed);
+        overhead_bytes += stats.overhead_bytes.load(std::memory_order_relaxed);
+    }
+    // the stripes are read one after another, so a sum may be caught slightly off
+    usage->entries = std::max<int64_t>(entries, 0);
+    usage->key_bytes = std::max<int64_t>(key_bytes, 0);
+    usage->value_bytes = std::max<int64_t>(value_bytes, 0);
+    usage->overhead_bytes = std::max<int64_t>(overhead_bytes, 0);
 }
 
 SkipList::Iterator SkipList::begin() {
-    return Iterator(_head->next[0]);
+    return Iterator(this, _head->next[0].load(std::memory_order_acquire));
+}
+
+SkipList::Iterator SkipList::last() {
+    int height = _height.load(std::memory_order_relaxed) - 1;
+    Node *node = _head;
+
+    while (height >= 0) {
+        Node *next_node = node->next[height].load(std::memory_order_acquire);
+        if (next_node) {
+            node = next_node;
+        } else {
+            --height;
+        }
+    }
+
+    return Iterator(this, node == _head ? nullptr : node);
+}
+
+SkipList::Iterator SkipList::seek(const ByteArray& key) {
+    return Iterator(this, first_greater_or_equal(key, nullptr));
+}
+
+SkipList::Iterator SkipList::seek_for_prev(const ByteArray& key) {
+    Node *prev[MAX_HEIGHT];
+    Node *node = first_greater_or_equal(key, prev);
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        return Iterator(this, node);
+    }
+    return Iterator(this, prev[0] == _head ? nullptr : prev[0]);
 }
 
 SkipList::Iterator SkipList::insert(const ByteArray& key, const ByteArray& value) {
-    Node *prev[MAX_HEIGHT] = {nullptr};
+    Node *prev[MAX_HEIGHT];
+    std::fill_n(prev, static_cast<int>(MAX_HEIGHT), _head);
     Node *node = first_greater_or_equal(key, prev);
 
-    if (node && _cmp->compare(node->key, key) == 0) {
-        return Iterator(nullptr);
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        return Iterator(this, nullptr);
     }
 
     int new_height = random_height();
     Node *insert_node = new_node(key, value, new_height);
 
-    if (new_height > _height) {
-        for (int i = _height; i < new_height; ++i) {
-            prev[i] = _head;
+    // levels above the searched height keep _head as predecessor
+    raise_height(new_height);
+
+    if (!publish_node(insert_node, prev)) {
+        delete_node(insert_node);
+        return Iterator(this, nullptr);
+    }
+
+    return Iterator(this, insert_node);
+}
+
+bool SkipList::splice(Run* run, std::string* duplicate) {
+    Node *first = run->_first[0];
+    if (!first) {
+        return true;
+    }
+
+    // the last node of every level
+    Node *tails[MAX_HEIGHT];
+    Node *node = _head;
+    for (int i = MAX_HEIGHT - 1; i >= 0; --i) {
+        for (Node *next = node->next[i].load(std::memory_order_acquire); next;
+                next = next->next[i].load(std::memory_order_acquire)) {
+            node = next;
         }
-        _height = new_height;
+        tails[i] = node;
     }
 
-    publish_node(insert_node, prev);
+    if (node == _head || compare(node, first) < 0) {
+        first->prev.store(node, std::memory_order_relaxed);
+        raise_height(run->_height);
+        // the run is complete below each level, so readers find it whole once it is linked
+        for (int i = 0; i < run->_height; ++i) {
+            tails[i]->next[i].store(run->_first[i], std::memory_order_release);
+        }
+
+        Index *index = _index.load(std::memory_order_relaxed);
+        for (node = first; index && node; node = node->next[0].load(std::memory_order_relaxed)) {
+            index_insert(index, node);
+        }
+    } else {
+        Node *prev[MAX_HEIGHT];
+        std::fill_n(prev, static_cast<int>(MAX_HEIGHT), _head);
+        for (node = first; node; node = run->_first[0]) {
+            run->_first[0] = node->next[0].load(std::memory_order_relaxed);
+            finger_search(node->key(), prev);
+            raise_height(node->height);
+            if (!publish_node(node, prev)) {
+                duplicate->assign(node->key_data(), node->key_size);
+                delete_node(node);
+                std::fill_n(run->_first + 1, static_cast<int>(MAX_HEIGHT) - 1, nullptr);
+                return false;
+            }
+        }
+    }
 
-    return Iterator(insert_node);
+    std::fill_n(run->_first, static_cast<int>(MAX_HEIGHT), nullptr);
+    std::fill_n(run->_last, static_cast<int>(MAX_HEIGHT), nullptr);
+    run->_height = 0;
+    run->_size = 0;
+    return true;
 }
 
-SkipList::Iterator SkipList::update(const ByteArray& key, const ByteArray& new_value) {
-    Node *prev[MAX_HEIGHT] = {nullptr};
+SkipList::Iterator SkipList::update(const ByteArray& key, const ByteArray& value) {
+    Node *node = first_greater_or_equal(key, nullptr);
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        replace_value(node, value);
+        return Iterator(this, node);
+    }
+    return Iterator(this, nullptr);
+}
+
+SkipList::Iterator SkipList::upsert(const ByteArray& key, const ByteArray& value) {
+    Node *prev[MAX_HEIGHT];
+    std::fill_n(prev, static_cast<int>(MAX_HEIGHT), _head);
     Node *node = first_greater_or_equal(key, prev);
-    if (node && node != _head && _cmp->compare(node->key, key) == 0) {
-        // insert a new node with new_value and remove the old node
-        Node *insert_node = new_node(node->key, new_value, node->height);
-        Node *temp[MAX_HEIGHT];
-        std::fill_n(temp, node->height, node);
-        publish_node(insert_node, temp);
+    return upsert(key, value, node, prev);
+}
 
-        remove_node(node, prev);
-        delete_node(node);
-        return Iterator(insert_node);
+SkipList::Iterator SkipList::upsert(const ByteArray& key, const ByteArray& value, Finger* finger) {
+    Node *node = finger_search(key, finger->_prev);
+    return upsert(key, value, node, finger->_prev);
+}
+
+SkipList::Iterator SkipList::upsert(const ByteArray& key, const ByteArray& value,
+                                    Node* node, Node** prev) {
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        replace_value(node, value);
+        return Iterator(this, node);
+    }
+
+    int new_height = random_height();
+    Node *insert_node = new_node(key, value, new_height);
+
+    raise_height(new_height);
+
+    if (!publish_node(insert_node, prev)) {
+        // a concurrent writer inserted the key first, our value is the newer one
+        delete_node(insert_node);
+        return update(key, value);
     }
-    return Iterator(nullptr);
+
+    return Iterator(this, insert_node);
 }
 
 SkipList::Iterator SkipList::lookup(const ByteArray& key) {
+    if (_index.load(std::memory_order_relaxed)) {
+        return Iterator(this, index_lookup(key, hash(key)));
+    }
+
     Node *node = first_greater_or_equal(key, nullptr);
-    if (node && _cmp->compare(node->key, key) == 0) {
-        return Iterator(node);
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        return Iterator(this, node);
+    }
+    return Iterator(this, nullptr);
+}
+
+void SkipList::lookup(const ByteArray* keys, size_t n, Iterator* result) {
+    Index *index = _index.load(std::memory_order_acquire);
+    if (index) {
+        // prefetch the home slots of a group, then probe them
+        uint64_t hashes[GROUP_SIZE];
+        for (size_t base = 0; base < n; base += GROUP_SIZE) {
+            size_t m = std::min(n - base, static_cast<size_t>(GROUP_SIZE));
+            for (size_t j = 0; j < m; ++j) {
+                hashes[j] = hash(keys[base + j]);
+                __builtin_prefetch(&index->slots[hashes[j] & index->mask]);
+            }
+            for (size_t j = 0; j < m; ++j) {
+                result[base + j] = Iterator(this, index_lookup(keys[base + j], hashes[j]));
+            }
+        }
+        return;
+    }
+
+    if (_bytewise) {
+        lookup(BytewiseCompare(), keys, n, result);
+    } else {
+        lookup(VirtualCompare(_cmp), keys, n, result);
+    }
+}
+
+template <class Cmp>
+void SkipList::lookup(const Cmp& compare, const ByteArray* keys, size_t n, Iterator* result) {
+    // the lookups of a group advance one step per round in turn,
+    // so the node a lookup compares next has been prefetched while the others made their steps
+    struct Lookup {
+        Node     *prev_node;
+        Node     *next_node;
+        uint64_t  prefix;
+        int       height;
+    };
+    Lookup group[GROUP_SIZE];
+
+    for (size_t base = 0; base < n; base += GROUP_SIZE) {
+        size_t m = std::min(n - base, static_cast<size_t>(GROUP_SIZE));
+        int height = _height.load(std::memory_order_relaxed) - 1;
+        for (size_t j = 0; j < m; ++j) {
+            Node *next_node = _head->next[height].load(std::memory_order_acquire);
+            __builtin_prefetch(next_node);
+            group[j] = Lookup{_head, next_node, key_prefix(keys[base + j]), height};
+        }
+
+        size_t active = m;
+        while (active > 0) {
+            for (size_t j = 0; j < m; ++j) {
+                Lookup& l = group[j];
+                if (l.height < 0) {
+                    continue;
+                }
+
+                int cmp = l.next_node ? compare(l.next_node, keys[base + j], l.prefix) : 1;
+                if (cmp < 0) {
+                    l.prev_node = l.next_node;
+                } else if (l.height == 0) {
+                    result[base + j] = Iterator(this, cmp == 0 ? l.next_node : nullptr);
+                    l.height = -1;
+                    --active;
+                    continue;
+                } else {
+                    --l.height;
+                }
+                l.next_node = l.prev_node->next[l.height].load(std::memory_order_acquire);
+                __builtin_prefetch(l.next_node);
+            }
+        }
+    }
+}
+
+bool SkipList::index_has_room(size_t n) const {
+    Index *index = _index.load(std::memory_order_acquire);
+    // keep the load factor under 1/2
+    return !index || (_index_used.load(std::memory_order_relaxed) + n) * 2 <= index->mask + 1;
+}
+
+void SkipList::reserve_index(size_t n) {
+    Index *index = _index.load(std::memory_order_relaxed);
+    if (index_has_room(n)) {
+        return;
+    }
+
+    size_t live = 0;
+    for (size_t i = 0; i <= index->mask; ++i) {
+        Node *node = index->slots[i].load(std::memory_order_relaxed);
+        live += node && node != INDEX_TOMBSTONE;
     }
-    return Iterator(nullptr);
+    size_t capacity = index->mask + 1;
+    while ((live + n) * 4 > capacity) {
+        capacity *= 2;
+    }
+
+    Index *grown = new_index(capacity);
+    _index_used.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i <= index->mask; ++i) {
+        Node *node = index->slots[i].load(std::memory_order_relaxed);
+        if (node && node != INDEX_TOMBSTONE) {
+            index_insert(grown, node);
+        }
+    }
+
+    // readers still probing the old one have pinned the epoch
+    _index.store(grown, std::memory_order_release);
+    size_t size = sizeof(Index) + sizeof(std::atomic<Node*>) * index->mask;
+    _pool->dealloc(reinterpret_cast<char*>(index), size);
+    account(0, 0, 0, -static_cast<int64_t>(size));
 }
 
 bool SkipList::remove(const ByteArray& key) {
     Node *prev[MAX_HEIGHT] = {nullptr};
     Node *node = first_greater_or_equal(key, prev);
-    if (node && _cmp->compare(node->key, key) == 0) {
+    return remove(key, node, prev);
+}
+
+bool SkipList::remove(const ByteArray& key, Finger* finger) {
+    Node *node = finger_search(key, finger->_prev);
+    return remove(key, node, finger->_prev);
+}
+
+bool SkipList::remove(const ByteArray& key, Node* node, Node** prev) {
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        save_removed(node);
         remove_node(node, prev);
         delete_node(node);
         return true;
@@ -82,24 +396,65 @@ bool SkipList::remove(const ByteArray& key) {
     return false;
 }
 
+size_t SkipList::evict(uint64_t version) {
+    // a single pass, with the last node kept on every level as predecessor
+    Node *prev[MAX_HEIGHT];
+    std::fill_n(prev, static_cast<int>(MAX_HEIGHT), _head);
+    size_t n = 0;
+    Node *node = _head->next[0].load(std::memory_order_acquire);
+    while (node) {
+        Node *next = node->next[0].load(std::memory_order_acquire);
+        if (node->version.load(std::memory_order_relaxed) < version) {
+            remove_node(node, prev);
+            delete_node(node);
+            ++n;
+        } else {
+            std::fill_n(prev, node->height, node);
+        }
+        node = next;
+    }
+    return n;
+}
+
 int SkipList::random_height() {
+    // every writer thread owns its generator, so concurrent inserts don't race on the seed
+    static thread_local Random rand(RANDOM_SEED ^
+        static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+
     int height = 1;
     while (height < static_cast<int>(MAX_HEIGHT) &&
-                (_rand.rand() & (GROWTH_PROBABILITY - 1)) == 0) {
+                (rand.rand() & (GROWTH_PROBABILITY - 1)) == 0) {
         ++height;
     }
     return height;
 }
 
+void SkipList::raise_height(int height) {
+    int old_height = _height.load(std::memory_order_relaxed);
+    while (height > old_height &&
+            !_height.compare_exchange_weak(old_height, height, std::memory_order_relaxed)) {
+    }
+}
+
 SkipList::Node* SkipList::first_greater_or_equal(const ByteArray& key, Node** prev) {
-    int height = _height - 1;
+    if (_bytewise) {
+        return first_greater_or_equal(BytewiseCompare(), key, prev);
+    }
+    return first_greater_or_equal(VirtualCompare(_cmp), key, prev);
+}
+
+template <class Cmp>
+SkipList::Node* SkipList::first_greater_or_equal(const Cmp& compare, const ByteArray& key,
+                                                 Node** prev) {
+    uint64_t prefix = key_prefix(key);
+    int height = _height.load(std::memory_order_relaxed) - 1;
     Node *prev_node = _head;
 
     while (height >= 0) {
-        Node *next_node = prev_node->next[height];
-        while (next_node && _cmp->compare(next_node->key, key) < 0) {
+        Node *next_node = prev_node->next[height].load(std::memory_order_acquire);
+        while (next_node && compare(next_node, key, prefix) < 0) {
             prev_node = next_node;
-            next_node = next_node->next[height];
+            next_node = next_node->next[height].load(std::memory_order_acquire);
         }
 
         if (prev) {
@@ -111,40 +466,536 @@ SkipList::Node* SkipList::first_greater_or_equal(const ByteArray& key, Node** pr
         --height;
     }
 
-    return prev_node->next[0];
+    return prev_node->next[0].load(std::memory_order_acquire);
+}
+
+SkipList::Node* SkipList::finger_search(const ByteArray& key, Node** prev) {
+    if (_bytewise) {
+        return finger_search(BytewiseCompare(), key, prev);
+    }
+    return finger_search(VirtualCompare(_cmp), key, prev);
+}
+
+template <class Cmp>
+SkipList::Node* SkipList::finger_search(const Cmp& compare, const ByteArray& key, Node** prev) {
+    uint64_t prefix = key_prefix(key);
+    int height = _height.load(std::memory_order_relaxed);
+
+    // prev[] is the search path of a smaller key, and successors only get farther on higher levels,
+    // so the path stays valid from the lowest level whose successor is not less than key
+    int level = 0;
+    while (level < height - 1) {
+        Node *next_node = prev[level]->next[level].load(std::memory_order_acquire);
+        if (!next_node || compare(next_node, key, prefix) >= 0) {
+            break;
+        }
+        ++level;
+    }
+
+    Node *prev_node = prev[level];
+    Node *next_node = nullptr;
+    for (int i = level; i >= 0; --i) {
+        next_node = prev_node->next[i].load(std::memory_order_acquire);
+        while (next_node && compare(next_node, key, prefix) < 0) {
+            prev_node = next_node;
+            next_node = next_node->next[i].load(std::memory_order_acquire);
+        }
+        prev[i] = prev_node;
+    }
+
+    return next_node;
+}
+
+uint64_t SkipList::hash(const ByteArray& key) {
+    // 64-bit FNV-1a over words, finished with the murmur3 mixer
+    static const uint64_t PRIME = 0x100000001B3ULL;
+    uint64_t h = 0xCBF29CE484222325ULL ^ key.size();
+    const char *p = key.data();
+    size_t n = key.size();
+    for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        h = (h ^ word) * PRIME;
+    }
+    for (; n > 0; --n, ++p) {
+        h = (h ^ static_cast<unsigned char>(*p)) * PRIME;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+SkipList::Index* SkipList::new_index(size_t capacity) {
+    size_t size = sizeof(Index) + sizeof(std::atomic<Node*>) * (capacity - 1);
+    Index *index = reinterpret_cast<Index*>(_pool->alloc(size));
+    account(0, 0, 0, size);
+    index->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i) {
+        index->slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+    return index;
+}
+
+void SkipList::index_insert(Index* index, Node* node) {
+    size_t i = hash(node->key()) & index->mask;
+    while (true) {
+        Node *slot = index->slots[i].load(std::memory_order_relaxed);
+        if ((slot == nullptr || slot == INDEX_TOMBSTONE) &&
+                index->slots[i].compare_exchange_strong(slot, node, std::memory_order_release)) {
+            if (slot == nullptr) {
+                _index_used.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        i = (i + 1) & index->mask;
+    }
+}
+
+void SkipList::index_remove(Node* node) {
+    Index *index = _index.load(std::memory_order_relaxed);
+    size_t i = hash(node->key()) & index->mask;
+    while (index->slots[i].load(std::memory_order_relaxed) != node) {
+        i = (i + 1) & index->mask;
+    }
+    index->slots[i].store(INDEX_TOMBSTONE, std::memory_order_release);
+}
+
+SkipList::Node* SkipList::index_lookup(const ByteArray& key, uint64_t hash) const {
+    Index *index = _index.load(std::memory_order_acquire);
+    for (size_t i = hash & index->mask; ; i = (i + 1) & index->mask) {
+        Node *node = index->slots[i].load(std::memory_order_acquire);
+        if (node == nullptr) {
+            return nullptr;
+        }
+        if (node != INDEX_TOMBSTONE && node->key() == key) {
+            return node;
+        }
+    }
+}
+
+uint64_t SkipList::key_prefix(const ByteArray& key) {
+    unsigned char bytes[sizeof(uint64_t)] = {0};
+    memcpy(bytes, key.data(), std::min(key.size(), sizeof(bytes)));
+
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        prefix = (prefix << 8) | bytes[i];
+    }
+    return prefix;
+}
+
+int SkipList::compare(const Node* node, const ByteArray& key, uint64_t prefix) const {
+    if (_bytewise) {
+        return BytewiseCompare()(node, key, prefix);
+    }
+    return VirtualCompare(_cmp)(node, key, prefix);
+}
+
+int SkipList::compare(const Node* lhs, const Node* rhs) const {
+    return compare(lhs, rhs->key(), rhs->prefix);
+}
+
+SkipList::Node* SkipList::find_prev(Node* node) {
+    // the back pointer is only a hint, concurrent writers may have linked nodes after it
+    Node *prev_node = node->prev.load(std::memory_order_acquire);
+    while (prev_node) {
+        Node *next_node = prev_node->next[0].load(std::memory_order_acquire);
+        if (next_node == node) {
+            return prev_node == _head ? nullptr : prev_node;
+        }
+        if (!next_node || compare(next_node, node) >= 0) {
+            break;
+        }
+        prev_node = next_node;
+    }
+
+    // the node has been unlinked, search from the top
+    Node *prev[MAX_HEIGHT];
+    first_greater_or_equal(node->key(), prev);
+    return prev[0] == _head ? nullptr : prev[0];
+}
+
+uint64_t SkipList::version() const {
+    return _version.load(std::memory_order_relaxed);
+}
+
+uint64_t SkipList::advance_version() {
+    return _version.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+uint64_t SkipList::open_snapshot() {
+    uint64_t version = advance_version();
+    _snapshot.store(version, std::memory_order_release);
+    return version;
+}
+
+void SkipList::close_snapshot() {
+    _snapshot.store(0, std::memory_order_relaxed);
+    for (UndoShard& shard : _undo) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.undo.clear();
+    }
+    std::lock_guard<std::mutex> lock(_removed_mutex);
+    _removed.clear();
+    _removed_changes.store(0, std::memory_order_relaxed);
+}
+
+SkipList::UndoShard& SkipList::undo_shard(const Node* node) {
+    return _undo[reinterpret_cast<uintptr_t>(node) / sizeof(Node) % UNDO_SHARDS];
+}
+
+void SkipList::save_undo(Node* node) {
+    uint64_t snapshot = _snapshot.load(std::memory_order_acquire);
+    if (snapshot == 0 || node->version.load(std::memory_order_relaxed) >= snapshot) {
+        return;
+    }
+
+    UndoShard& shard = undo_shard(node);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // the snapshot may be closed, or a concurrent writer of the node saved it first
+    uint64_t version = node->version.load(std::memory_order_relaxed);
+    if (_snapshot.load(std::memory_order_relaxed) != snapshot || version >= snapshot) {
+        return;
+    }
+
+    Undo& undo = shard.undo[node];
+    ByteArray value = value_of(node->value.load(std::memory_order_acquire));
+    undo.value.assign(value.data(), value.size());
+    undo.version = version;
+    // still under the lock, so a scan that sees the new version also finds the undo entry
+    node->version.store(_version.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+void SkipList::save_removed(Node* node) {
+    uint64_t snapshot = _snapshot.load(std::memory_order_acquire);
+    if (snapshot == 0) {
+        return;
+    }
+
+    // removals run alone, so the node doesn't change meanwhile, but a scan may be at it
+    Undo undo;
+    uint64_t version = node->version.load(std::memory_order_relaxed);
+    UndoShard& shard = undo_shard(node);
+    std::unique_lock<std::mutex> shard_lock(shard.mutex, std::defer_lock);
+    std::unordered_map<Node*, Undo>::iterator it;
+    if (version < snapshot) {
+        ByteArray value = value_of(node->value.load(std::memory_order_relaxed));
+        undo.value.assign(value.data(), value.size());
+        undo.version = version;
+    } else {
+        shard_lock.lock();
+        it = shard.undo.find(node);
+        if (it == shard.undo.end()) {
+            // inserted after the snapshot
+            return;
+        }
+        undo = std::move(it->second);
+    }
+
+    // the entry moves while the shard is locked, so a scan that misses it in the shard
+    // finds it here
+    std::lock_guard<std::mutex> lock(_removed_mutex);
+    _removed.insert(std::make_pair(std::string(node->key_data(), node->key_size),
+                                   std::move(undo)));
+    _removed_changes.fetch_add(1, std::memory_order_release);
+    if (shard_lock.owns_lock()) {
+        shard.undo.erase(it);
+    }
+}
+
+bool SkipList::find_undo(Node* node, Undo* undo) {
+    {
+        UndoShard& shard = undo_shard(node);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.undo.find(node);
+        if (it != shard.undo.end()) {
+            if (undo) {
+                *undo = it->second;
+            }
+            return true;
+        }
+    }
+
+    // removed since, or the key was removed before and inserted again
+    if (_removed_changes.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_removed_mutex);
+    auto it = _removed.find(std::string(node->key_data(), node->key_size));
+    if (it == _removed.end()) {
+        return false;
+    }
+    if (undo) {
+        *undo = it->second;
+    }
+    return true;
+}
+
+bool SkipList::scan_snapshot(uint64_t since,
+                             const std::function<bool(const ByteArray&, const ByteArray&)>& f) {
+    typedef std::map<std::string, Undo, UndoCompare>::iterator RemovedIterator;
+    uint64_t snapshot = _snapshot.load(std::memory_order_relaxed);
+
+    // the key of the last node the scan has seen, in "resume_key" between batches
+    ByteArray last;
+    bool has_last = false;
+    std::string resume_key;
+
+    // undo entries of nodes removed before the scan reached them,
+    // they are emitted before the next node to keep the keys in order
+    std::vector<RemovedIterator> removed;
+    RemovedIterator next_removed;
+    uint64_t removed_changes = 0;
+    auto collect_removed = [&](const Node* node) {
+        if (_removed_changes.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_removed_mutex);
+        uint64_t changes = _removed_changes.load(std::memory_order_relaxed);
+        if (changes != removed_changes) {
+            // a new entry may be before the one the scan waits for
+            removed_changes = changes;
+            next_removed = has_last ?
+                _removed.upper_bound(std::string(last.data(), last.size())) : _removed.begin();
+        }
+        for (; next_removed != _removed.end() &&
+                (!node || compare(node, next_removed->first, key_prefix(next_removed->first)) > 0);
+                ++next_removed) {
+            removed.push_back(next_removed);
+        }
+        // the key of "node" is emitted with the node
+        if (node && next_removed != _removed.end() &&
+                compare(node, next_removed->first, key_prefix(next_removed->first)) == 0) {
+            ++next_removed;
+        }
+    };
+    auto emit_removed = [&removed, since, &f]() {
+        for (auto it : removed) {
+            // entries are not erased before close_snapshot()
+            if (it->second.version >= since && !f(it->first, it->second.value)) {
+                return false;
+            }
+        }
+        removed.clear();
+        return true;
+    };
+
+    for (;;) {
+        // a batch at a time, the scan goes on after the key of the last node it saw,
+        // which may have been removed and freed meanwhile
+        EpochGuard guard(_pool->epoch());
+        Node *node;
+        if (!has_last) {
+            node = _head->next[0].load(std::memory_order_acquire);
+        } else {
+            node = first_greater_or_equal(last, nullptr);
+            if (node && compare(node, last, key_prefix(last)) == 0) {
+                node = node->next[0].load(std::memory_order_acquire);
+            }
+        }
+
+        for (size_t n = 0; node && n < SCAN_BATCH; ++n) {
+            collect_removed(node);
+            if (!emit_removed()) {
+                return false;
+            }
+
+            // a writer publishes the version before the value, so a new value comes with a new version
+            const char *value = node->value.load(std::memory_order_acquire);
+            uint64_t version = node->version.load(std::memory_order_acquire);
+            if (version < snapshot) {
+                if (version >= since && !f(node->key(), value_of(value))) {
+                    return false;
+                }
+            } else {
+                // changed after the snapshot, or inserted after it if there is no undo entry
+                Undo undo;
+                if (find_undo(node, &undo) && undo.version >= since &&
+                        !f(node->key(), undo.value)) {
+                    return false;
+                }
+            }
+            last = node->key();
+            has_last = true;
+            node = node->next[0].load(std::memory_order_acquire);
+        }
+        if (!node) {
+            // nodes removed after the last node
+            collect_removed(nullptr);
+            break;
+        }
+        resume_key.assign(last.data(), last.size());
+        last = resume_key;
+    }
+    return emit_removed();
+}
+
+bool SkipList::snapshot_contains(const ByteArray& key) {
+    uint64_t snapshot = _snapshot.load(std::memory_order_relaxed);
+    Node *node = first_greater_or_equal(key, nullptr);
+    if (node && _cmp->compare(node->key(), key) == 0) {
+        return node->version.load(std::memory_order_acquire) < snapshot ||
+            find_undo(node, nullptr);
+    }
+    std::lock_guard<std::mutex> lock(_removed_mutex);
+    return _removed.count(std::string(key.data(), key.size())) > 0;
+}
+
+void SkipList::replace_value(Node* node, const ByteArray& value) {
+    save_undo(node);
+    node->version.store(_version.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // readers see either the old or the new value, never a mix of both
+    const char *old_value = node->value.exchange(new_value(value), std::memory_order_acq_rel);
+    if (old_value != node->first_value()) {
+        delete_value(old_value);
+    } else if (!node->mapped) {
+        // the first value stays in the node until it is freed
+        int64_t size = value_of(old_value).size();
+        account(0, 0, -size, size);
+    }
 }
 
 SkipList::Node* SkipList::new_node(const ByteArray& key, const ByteArray& value, int height) {
-    ByteArray new_key(_pool->dup(key.data(), key.size()), key.size());
-    ByteArray new_value(_pool->dup(value.data(), value.size()), value.size());
+    size_t size = Node::size(height, key.size(), value.size());
+    void *p = _pool->alloc(size);
+    Node *node = new (p) Node(height, key, value, key_prefix(key),
+                              _version.load(std::memory_order_relaxed));
+    account(1, key.size(), value.size(), Node::align(size) - key.size() - value.size());
+    return node;
+}
 
-    void *p = _pool->alloc(sizeof(Node) + sizeof(Node*) * (height - 1));
-    Node *node = new (p) Node(height, new_key, new_value);
+SkipList::Node* SkipList::new_mapped_node(const ByteArray& key, const char* value, int height) {
+    size_t size = Node::mapped_size(height);
+    void *p = _pool->alloc(size);
+    Node *node = new (p) Node(height, key, value, key_prefix(key),
+                              _version.load(std::memory_order_relaxed), true);
+    account(1, 0, 0, Node::align(size));
     return node;
 }
 
 void  SkipList::delete_node(Node* node) {
-    _pool->dealloc(node->key.data(), node->key.size());
-    _pool->dealloc(node->value.data(), node->value.size());
-    _pool->dealloc(reinterpret_cast<char*>(node),
-        sizeof(Node) + sizeof(Node*) * (node->height - 1));
+    const char *value = node->value.load(std::memory_order_relaxed);
+    if (value != node->first_value()) {
+        delete_value(value);
+    }
+    if (node->mapped) {
+        size_t size = Node::mapped_size(node->height);
+        account(-1, 0, 0, -static_cast<int64_t>(Node::align(size)));
+        _pool->dealloc(reinterpret_cast<char*>(node), size);
+        return;
+    }
+
+    size_t first_size = value_of(node->first_value()).size();
+    size_t size = Node::size(node->height, node->key_size, first_size);
+    // the first value was counted as overhead once it was replaced
+    int64_t value_bytes = value == node->first_value() ? first_size : 0;
+    account(-1, -static_cast<int64_t>(node->key_size), -value_bytes,
+            value_bytes + static_cast<int64_t>(node->key_size) -
+            static_cast<int64_t>(Node::align(size)));
+    _pool->dealloc(reinterpret_cast<char*>(node), size);
+}
+
+const char* SkipList::new_value(const ByteArray& value) {
+    size_t size = value.size();
+    char *p = _pool->alloc(sizeof(size) + size);
+    memcpy(p, &size, sizeof(size));
+    memcpy(p + sizeof(size), value.data(), size);
+    account(0, 0, size, Node::align(sizeof(size) + size) - size);
+    return p;
+}
+
+void SkipList::delete_value(const char* value) {
+    size_t size = value_of(value).size();
+    account(0, 0, -static_cast<int64_t>(size),
+            static_cast<int64_t>(size) - static_cast<int64_t>(Node::align(sizeof(size) + size)));
+    _pool->dealloc(const_cast<char*>(value), sizeof(size_t) + size);
 }
 
-void SkipList::publish_node(Node* node, Node** prev) {
+void SkipList::account(int64_t entries, int64_t key_bytes, int64_t value_bytes,
+                       int64_t overhead_bytes) {
+    Stats& stats = _stats[Epoch::stripe()];
+    if (entries != 0) {
+        stats.entries.fetch_add(entries, std::memory_order_relaxed);
+    }
+    if (key_bytes != 0) {
+        stats.key_bytes.fetch_add(key_bytes, std::memory_order_relaxed);
+    }
+    if (value_bytes != 0) {
+        stats.value_bytes.fetch_add(value_bytes, std::memory_order_relaxed);
+    }
+    stats.overhead_bytes.fetch_add(overhead_bytes, std::memory_order_relaxed);
+}
+
+ByteArray SkipList::value_of(const char* value) {
+    size_t size;
+    memcpy(&size, value, sizeof(size));
+    return ByteArray(value + sizeof(size), size);
+}
+
+bool SkipList::publish_node(Node* node, Node** prev) {
+    // link from bottom to top, so a node reachable at level i is reachable at level 0
     for (int i = 0; i < node->height; ++i) {
-        // ensure order consistency
-        atomic_thread_fence(std::memory_order_acquire);
+        Node *next = prev[i]->next[i].load(std::memory_order_acquire);
+        while (true) {
+            // concurrent writers may have linked smaller keys after prev[i] since we searched
+            while (next && compare(next, node) < 0) {
+                prev[i] = next;
+                next = next->next[i].load(std::memory_order_acquire);
+            }
+            if (i == 0 && next && compare(next, node) == 0) {
+                return false;
+            }
 
-        node->next[i] = prev[i]->next[i];
-        prev[i]->next[i] = node;
+            node->next[i].store(next, std::memory_order_relaxed);
+            if (i == 0) {
+                node->prev.store(prev[0], std::memory_order_relaxed);
+            }
+            if (prev[i]->next[i].compare_exchange_weak(next, node,
+                    std::memory_order_release, std::memory_order_acquire)) {
+                if (i == 0 && next) {
+                    raise_prev(next, node);
+                }
+                break;
+            }
+        }
+    }
 
-        atomic_thread_fence(std::memory_order_release);
+    Index *index = _index.load(std::memory_order_relaxed);
+    if (index) {
+        index_insert(index, node);
+    }
+    return true;
+}
+
+void SkipList::raise_prev(Node* node, Node* prev) {
+    // only move the hint forward, so it settles on the real predecessor
+    // once racing writers are done, and remove_node() only has to fix the successor
+    Node *hint = node->prev.load(std::memory_order_acquire);
+    while (hint == _head || compare(hint, prev) < 0) {
+        if (node->prev.compare_exchange_weak(hint, prev,
+                std::memory_order_release, std::memory_order_acquire)) {
+            break;
+        }
     }
 }
 
 void SkipList::remove_node(Node* node, Node** prev) {
     for (int i = node->height - 1; i >= 0; --i) {
-        prev[i]->next[i] = node->next[i];
+        prev[i]->next[i].store(node->next[i].load(std::memory_order_relaxed),
+            std::memory_order_release);
+    }
+
+    Node *next = node->next[0].load(std::memory_order_relaxed);
+    if (next) {
+        next->prev.store(prev[0], std::memory_order_release);
+    }
+
+    if (_index.load(std::memory_order_relaxed)) {
+        index_remove(node);
     }
 }
 
@@ -152,13 +1003,13 @@ void SkipList::remove_node(Node* node, Node** prev) {
 std::string SkipList::serialize() {
     std::stringstream sstr;
 
-    int height = _height - 1;
+    int height = _height.load() - 1;
     while (height >= 0) {
         sstr << "height " << height << ": ";
-        Node *p = _head->next[height];
+        Node *p = _head->next[height].load();
         while (p) {
-            sstr << p->key.data() << "    ";
-            p = p->next[height];
+            sstr << p->key().data() << "    ";
+            p = p->next[height].load();
         }
         if (height) {
             sstr << std::endl;
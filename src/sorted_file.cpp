@@ -0,0 +1,674 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "sorted_file.h"
+
+#include "crc32c.h"
+#include "compression.h"
+
+namespace table {
+
+constexpr size_t SortedFile::NPOS;
+
+static const uint64_t MAGIC = 0x57544142534f5233ull;
+// the footer of files written before checksums has no offset of checksums
+static const uint64_t MAGIC_V2 = 0x57544142534f5232ull;
+static const size_t FOOTER_V2_SIZE = sizeof(uint64_t) * 5;
+// and before compression no compression either
+static const uint64_t MAGIC_V1 = 0x57544142534f5254ull;
+static const size_t FOOTER_V1_SIZE = sizeof(uint64_t) * 4;
+
+// the filter of "n" keys, without the number of probes
+static size_t filter_bits(size_t n, int bits_per_key) {
+    // a tiny filter would have a high false positive rate
+    return std::max<size_t>(64, n * bits_per_key);
+}
+
+static void put_index_entry(std::string* index, const ByteArray& key, uint64_t offset) {
+    size_t key_size = key.size();
+    index->append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    index->append(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+    index->append(key.data(), key_size);
+}
+
+SortedFileBuilder::SortedFileBuilder(size_t block_size, int bloom_bits_per_key,
+                                     Options::Compression compression) :
+    _block_size(block_size), _bits_per_key(bloom_bits_per_key), _compression(compression),
+    _offset(0), _block_offset(0), _blocks(0), _entries(0), _block_crc(0) {
+}
+
+void SortedFileBuilder::add(const ByteArray& key, std::string* entry) {
+    if (_compression == Options::NO_COMPRESSION) {
+        if (_blocks == 0 || _offset - _block_offset >= _block_size) {
+            if (_blocks > 0) {
+                end_block();
+            }
+            put_index_entry(&_index, key, _offset);
+            _block_offset = _offset;
+            ++_blocks;
+        }
+        _block_crc = crc32c::extend(_block_crc, entry->data(), entry->size());
+        _offset += entry->size();
+    } else {
+        if (_block.empty()) {
+            _block_key.assign(key.data(), key.size());
+        }
+        _block.append(*entry);
+        entry->clear();
+        if (_block.size() >= _block_size) {
+            flush_block(entry);
+        }
+    }
+    if (_bits_per_key > 0) {
+        _hashes.push_back(SortedFile::hash(key));
+    }
+    ++_entries;
+}
+
+void SortedFileBuilder::flush_block(std::string* out) {
+    put_index_entry(&_index, _block_key, _offset);
+    ++_blocks;
+
+    // a block that doesn't shrink by an eighth isn't worth decompressing
+    char type = static_cast<char>(_compression);
+    _compressed.clear();
+    const std::string *payload = &_compressed;
+    if (!compress(_compression, _block.data(), _block.size(), &_compressed) ||
+            _compressed.size() >= _block.size() - _block.size() / 8) {
+        type = static_cast<char>(Options::NO_COMPRESSION);
+        payload = &_block;
+    }
+    uint64_t raw_size = _block.size();
+    size_t start = out->size();
+    out->push_back(type);
+    out->append(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+    out->append(*payload);
+    _offset += SortedFile::BLOCK_HEADER_SIZE + payload->size();
+    _block.clear();
+    _block_crc = crc32c::value(out->data() + start, out->size() - start);
+    end_block();
+}
+
+void SortedFileBuilder::end_block() {
+    _checksums.append(reinterpret_cast<const char*>(&_block_crc), sizeof(_block_crc));
+    _block_crc = 0;
+}
+
+size_t SortedFileBuilder::meta_size(size_t key_size) const {
+    size_t filter_size = _bits_per_key > 0 ?
+        (filter_bits(_hashes.size() + 1, _bits_per_key) + 7) / 8 + 1 : 0;
+    // a compressed block is never larger than its entries, but has a header
+    size_t headers = _compression == Options::NO_COMPRESSION ?
+        0 : (_blocks + 1) * SortedFile::BLOCK_HEADER_SIZE;
+    // the block being filled, the one the key may start and the meta have checksums to come
+    size_t checksums_size = _checksums.size() + sizeof(uint32_t) * 3;
+    return headers + filter_size + _index.size() + sizeof(uint64_t) + sizeof(size_t) + key_size +
+        checksums_size + SortedFile::FOOTER_SIZE;
+}
+
+void SortedFileBuilder::finish(std::string* out) {
+    if (_compression != Options::NO_COMPRESSION) {
+        if (!_block.empty()) {
+            flush_block(out);
+        }
+    } else if (_blocks > 0) {
+        end_block();
+    }
+
+    // the probes of a key are derived from one hash by double hashing
+    std::string filter;
+    if (_bits_per_key > 0) {
+        size_t bits = filter_bits(_hashes.size(), _bits_per_key);
+        bits = (bits + 7) / 8 * 8;
+        // ln(2) * bits per key minimizes the false positive rate
+        int probes = std::min(30, std::max(1, static_cast<int>(_bits_per_key * 0.69)));
+        filter.resize(bits / 8);
+        for (uint32_t h : _hashes) {
+            uint32_t delta = (h >> 17) | (h << 15);
+            for (int i = 0; i < probes; ++i) {
+                uint32_t bit = h % bits;
+                filter[bit / 8] |= static_cast<char>(1 << (bit % 8));
+                h += delta;
+            }
+        }
+        filter.push_back(static_cast<char>(probes));
+    }
+
+    uint32_t meta_crc = crc32c::value(filter.data(), filter.size());
+    meta_crc = crc32c::extend(meta_crc, _index.data(), _index.size());
+    meta_crc = crc32c::extend(meta_crc, _checksums.data(), _checksums.size());
+    uint64_t footer[6] = {_offset, _offset + filter.size(), _entries,
+                          static_cast<uint64_t>(_compression),
+                          _offset + filter.size() + _index.size(), MAGIC};
+    out->append(filter);
+    out->append(_index);
+    out->append(_checksums);
+    out->append(reinterpret_cast<const char*>(&meta_crc), sizeof(meta_crc));
+    out->append(reinterpret_cast<const char*>(footer), sizeof(footer));
+
+    _offset = 0;
+    _block_offset = 0;
+    _blocks = 0;
+    _entries = 0;
+    _index.clear();
+    _hashes.clear();
+    _checksums.clear();
+}
+
+SortedFile::SortedFile(const Comparator* cmp, char* data, size_t size) :
+    _cmp(cmp), _data(data), _size(size), _data_size(0), _entries(0), _last(0) {
+}
+
+SortedFile::~SortedFile() {
+    if (_data) {
+        munmap(_data, _size);
+    }
+}
+
+Status SortedFile::open(const std::string& path, const Comparator* cmp, size_t block_size,
+                        bool verify_checksums, std::unique_ptr<SortedFile>* file) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return Status::io_error("open " + path + " error, " + strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return Status::io_error("stat " + path + " error, " + strerror(errno));
+    }
+
+    size_t size = info.st_size;
+    char *data = nullptr;
+    if (size > 0) {
+        data = reinterpret_cast<char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return Status::io_error("mmap " + path + " error, " + strerror(errno));
+    }
+
+    file->reset(new SortedFile(cmp, data, size));
+    if (verify_checksums) {
+        Status s = verify(path, data, size);
+        if (!s.good()) {
+            return s;
+        }
+    }
+    return (*file)->load_index(path, block_size);
+}
+
+size_t SortedFile::data_size(const char* data, size_t size) {
+    Footer footer;
+    return read_footer(data, size, &footer) ? footer.filter_offset : size;
+}
+
+Options::Compression SortedFile::compression(const char* data, size_t size) {
+    Footer footer;
+    return read_footer(data, size, &footer) ?
+        static_cast<Options::Compression>(footer.compression) : Options::NO_COMPRESSION;
+}
+
+bool SortedFile::read_footer(const char* data, size_t size, Footer* footer) {
+    uint64_t magic;
+    if (size < sizeof(magic)) {
+        return false;
+    }
+    memcpy(&magic, data + size - sizeof(magic), sizeof(magic));
+    uint64_t fields[5];
+    if (magic == MAGIC && size >= FOOTER_SIZE) {
+        footer->size = FOOTER_SIZE;
+        memcpy(fields, data + size - footer->size, sizeof(uint64_t) * 5);
+    } else if (magic == MAGIC_V2 && size >= FOOTER_V2_SIZE) {
+        footer->size = FOOTER_V2_SIZE;
+        memcpy(fields, data + size - footer->size, sizeof(uint64_t) * 4);
+        fields[4] = size - footer->size;
+    } else if (magic == MAGIC_V1 && size >= FOOTER_V1_SIZE) {
+        footer->size = FOOTER_V1_SIZE;
+        memcpy(fields, data + size - footer->size, sizeof(uint64_t) * 3);
+        fields[3] = Options::NO_COMPRESSION;
+        fields[4] = size - footer->size;
+    } else {
+        return false;
+    }
+    footer->filter_offset = fields[0];
+    footer->index_offset = fields[1];
+    footer->entries = fields[2];
+    footer->compression = fields[3];
+    footer->checksums_offset = fields[4];
+    footer->has_checksums = magic == MAGIC;
+    if (footer->filter_offset > footer->index_offset ||
+            footer->index_offset > footer->checksums_offset ||
+            footer->checksums_offset > size - footer->size) {
+        return false;
+    }
+    // one checksum per block and the one of the meta
+    size_t checksums_size = size - footer->size - footer->checksums_offset;
+    return !footer->has_checksums ||
+        (checksums_size >= sizeof(uint32_t) && checksums_size % sizeof(uint32_t) == 0);
+}
+
+Status SortedFile::read_index(const std::string& path, const char* data, const Footer& footer,
+                              const std::function<void(size_t, const ByteArray&)>& f) {
+    const char *p = data + footer.index_offset;
+    const char *end = data + footer.checksums_offset;
+    while (p < end) {
+        uint64_t offset;
+        if (end - p < static_cast<ptrdiff_t>(sizeof(offset) + sizeof(size_t))) {
+            return Status::io_error("corrupted block index of " + path);
+        }
+        memcpy(&offset, p, sizeof(offset));
+        size_t key_size = read_size(p + sizeof(offset));
+        p += sizeof(offset) + sizeof(size_t);
+        if (static_cast<size_t>(end - p) < key_size || offset >= footer.filter_offset) {
+            return Status::io_error("corrupted block index of " + path);
+        }
+        f(offset, ByteArray(p, key_size));
+        p += key_size;
+    }
+    return Status::ok();
+}
+
+Status SortedFile::read_blocks(const std::string& path, const char* data, size_t size,
+                               std::vector<Block>* blocks) {
+    Footer footer;
+    if (!read_footer(data, size, &footer)) {
+        return Status::io_error("no footer in " + path);
+    }
+    std::vector<size_t> offsets;
+    Status s = read_index(path, data, footer,
+        [&offsets](size_t offset, const ByteArray&) {
+            offsets.push_back(offset);
+        });
+    if (!s.good()) {
+        return s;
+    }
+
+    blocks->clear();
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        size_t end = i + 1 < offsets.size() ? offsets[i + 1] : footer.filter_offset;
+        if (end < offsets[i] + BLOCK_HEADER_SIZE) {
+            return Status::io_error("corrupted block index of " + path);
+        }
+        Block block;
+        block.compression = static_cast<Options::Compression>(data[offsets[i]]);
+        memcpy(&block.raw_size, data + offsets[i] + 1, sizeof(uint64_t));
+        block.data = data + offsets[i] + BLOCK_HEADER_SIZE;
+        block.size = end - offsets[i] - BLOCK_HEADER_SIZE;
+        blocks->push_back(block);
+    }
+    return Status::ok();
+}
+
+Status SortedFile::verify(const std::string& path, const char* data, size_t size) {
+    Footer footer;
+    if (!read_footer(data, size, &footer) || !footer.has_checksums) {
+        return Status::ok();
+    }
+
+    // the meta first, the offsets of the blocks are taken from it
+    size_t checksum_num = (size - footer.size - footer.checksums_offset) / sizeof(uint32_t);
+    const char *checksums = data + footer.checksums_offset;
+    uint32_t expected;
+    memcpy(&expected, checksums + (checksum_num - 1) * sizeof(uint32_t), sizeof(expected));
+    size_t meta_size = footer.checksums_offset + (checksum_num - 1) * sizeof(uint32_t) -
+        footer.filter_offset;
+    if (crc32c::value(data + footer.filter_offset, meta_size) != expected) {
+        return Status::io_error("checksum mismatch in the index of " + path);
+    }
+
+    std::vector<size_t> offsets;
+    Status s = read_index(path, data, footer,
+        [&offsets](size_t offset, const ByteArray&) {
+            offsets.push_back(offset);
+        });
+    if (!s.good()) {
+        return s;
+    }
+    if (offsets.size() != checksum_num - 1) {
+        return Status::io_error("corrupted block index of " + path);
+    }
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        size_t end = i + 1 < offsets.size() ? offsets[i + 1] : footer.filter_offset;
+        if (end < offsets[i]) {
+            return Status::io_error("corrupted block index of " + path);
+        }
+        memcpy(&expected, checksums + i * sizeof(uint32_t), sizeof(expected));
+        if (crc32c::value(data + offsets[i], end - offsets[i]) != expected) {
+            return Status::io_error("checksum mismatch in block " + std::to_string(i) +
+                                    " of " + path);
+        }
+    }
+    return Status::ok();
+}
+
+Status SortedFile::load_index(const std::string& path, size_t block_size) {
+    Footer footer;
+    if (read_footer(_data, _size, &footer)) {
+        if (footer.compression != Options::NO_COMPRESSION) {
+            return Status::invalid_operation(path + " is compressed and can't be searched in place");
+        }
+        _data_size = footer.filter_offset;
+        _entries = footer.entries;
+        if (footer.index_offset > footer.filter_offset) {
+            _filter.assign(_data + footer.filter_offset,
+                           footer.index_offset - footer.filter_offset);
+        }
+
+        Status s = read_index(path, _data, footer,
+            [this](size_t offset, const ByteArray& key) {
+                _block_offsets.push_back(offset);
+                _block_keys.push_back(key);
+            });
+        if (!s.good()) {
+            return s;
+        }
+        if (empty()) {
+            return Status::ok();
+        }
+        // lengths read from the file are only trusted once they are checked against
+        // _data_size, entries past the start of a block are checked by next()
+        if (_block_offsets.empty() || _block_offsets[0] != 0) {
+            return Status::io_error("corrupted block index of " + path);
+        }
+        for (size_t i = 0; i < _block_offsets.size(); ++i) {
+            if ((i > 0 && _block_offsets[i] <= _block_offsets[i - 1]) ||
+                    entry_size(_block_offsets[i]) == 0) {
+                return Status::io_error("corrupted entry at offset " +
+                                        std::to_string(_block_offsets[i]) + " of " + path);
+            }
+        }
+        size_t offset = _block_offsets.back();
+        while (offset != _data_size) {
+            size_t size = entry_size(offset);
+            if (size == 0) {
+                return Status::io_error("corrupted entry at offset " + std::to_string(offset) +
+                                        " of " + path);
+            }
+            _last = offset;
+            offset += size;
+        }
+        return Status::ok();
+    }
+
+    // a file without blocks, every entry is checked once here
+    size_t offset = 0;
+    size_t block_offset = 0;
+    // a torn write leaves lengths that run past the end
+    auto corrupted = [&path, &offset]() {
+        return Status::io_error("corrupted entry at offset " + std::to_string(offset) +
+                                " of " + path);
+    };
+    while (offset < _size) {
+        if (_size - offset < sizeof(size_t) * 2) {
+            return corrupted();
+        }
+        size_t key_size = read_size(_data + offset);
+        if (_size - offset - sizeof(size_t) * 2 < key_size) {
+            return corrupted();
+        }
+        size_t value_size = read_size(_data + offset + sizeof(size_t) + key_size);
+        if (_size - offset - sizeof(size_t) * 2 - key_size < value_size) {
+            return corrupted();
+        }
+
+        ByteArray k(_data + offset + sizeof(size_t), key_size);
+        if (_entries > 0 && _cmp->compare(key(_last), k) >= 0) {
+            return Status::io_error(path + " is not sorted");
+        }
+        if (_block_offsets.empty() || offset - block_offset >= block_size) {
+            _block_offsets.push_back(offset);
+            _block_keys.push_back(k);
+            block_offset = offset;
+        }
+        _last = offset;
+        ++_entries;
+        offset += sizeof(size_t) * 2 + key_size + value_size;
+    }
+    _data_size = offset;
+    return Status::ok();
+}
+
+bool SortedFile::may_contain(const ByteArray& key) const {
+    if (_filter.size() < 2) {
+        return true;
+    }
+    size_t bits = (_filter.size() - 1) * 8;
+    int probes = static_cast<unsigned char>(_filter.data()[_filter.size() - 1]);
+    uint32_t h = hash(key);
+    uint32_t delta = (h >> 17) | (h << 15);
+    for (int i = 0; i < probes; ++i) {
+        uint32_t bit = h % bits;
+        if ((_filter.data()[bit / 8] & (1 << (bit % 8))) == 0) {
+            return false;
+        }
+        h += delta;
+    }
+    return true;
+}
+
+bool SortedFile::get(const ByteArray& key, ByteArray* value) const {
+    if (empty() || !may_contain(key)) {
+        return false;
+    }
+
+    size_t block = find_block(key);
+    size_t end = block_end(block);
+    for (size_t offset = _block_offsets[block]; offset < end; offset = next(offset)) {
+        int cmp = _cmp->compare(this->key(offset), key);
+        if (cmp == 0) {
+            *value = this->value(offset);
+            return true;
+        }
+        if (cmp > 0) {
+            break;
+        }
+    }
+    return false;
+}
+
+size_t SortedFile::seek(const ByteArray& key) const {
+    if (empty()) {
+        return NPOS;
+    }
+
+    size_t block = find_block(key);
+    size_t end = block_end(block);
+    size_t offset = _block_offsets[block];
+    while (offset < end && _cmp->compare(this->key(offset), key) < 0) {
+        offset = next(offset);
+    }
+    // the next block starts with a greater key
+    return offset < _data_size ? offset : NPOS;
+}
+
+size_t SortedFile::seek_for_prev(const ByteArray& key) const {
+    size_t offset = seek(key);
+    if (offset == NPOS) {
+        return last();
+    }
+    if (_cmp->compare(this->key(offset), key) == 0) {
+        return offset;
+    }
+    return prev(offset);
+}
+
+size_t SortedFile::next(size_t offset) const {
+    // "offset" was checked before it was handed out, an entry after it that runs past
+    // the data is where a file without verified checksums is corrupted, and the rest
+    // of its block is skipped
+    offset += entry_size(offset);
+    if (offset < _data_size && entry_size(offset) == 0) {
+        auto block = std::upper_bound(_block_offsets.begin(), _block_offsets.end(), offset);
+        offset = block != _block_offsets.end() ? *block : _data_size;
+    }
+    return offset < _data_size ? offset : NPOS;
+}
+
+size_t SortedFile::prev(size_t offset) const {
+    if (offset == 0) {
+        return NPOS;
+    }
+    // entries only link forward, so walk from the start of the block before "offset"
+    size_t block = std::upper_bound(_block_offsets.begin(), _block_offsets.end(), offset - 1) -
+        _block_offsets.begin() - 1;
+    size_t p = _block_offsets[block];
+    for (size_t n = next(p); n != offset && n != NPOS; n = next(p)) {
+        p = n;
+    }
+    return p;
+}
+
+ByteArray SortedFile::key(size_t offset) const {
+    return ByteArray(_data + offset + sizeof(size_t), read_size(_data + offset));
+}
+
+ByteArray SortedFile::value(size_t offset) const {
+    const char *p = _data + offset + sizeof(size_t) + read_size(_data + offset);
+    return ByteArray(p + sizeof(size_t), read_size(p));
+}
+
+size_t SortedFile::find_block(const ByteArray& key) const {
+    size_t block = std::upper_bound(_block_keys.begin(), _block_keys.end(), key,
+        [this](const ByteArray& lhs, const ByteArray& rhs) {
+            return _cmp->compare(lhs, rhs) < 0;
+        }) - _block_keys.begin();
+    return block == 0 ? 0 : block - 1;
+}
+
+size_t SortedFile::block_end(size_t block) const {
+    return block + 1 < _block_offsets.size() ? _block_offsets[block + 1] : _data_size;
+}
+
+size_t SortedFile::entry_size(size_t offset) const {
+    size_t left = _data_size - offset;
+    if (left < sizeof(size_t) * 2) {
+        return 0;
+    }
+    size_t key_size = read_size(_data + offset);
+    if (left - sizeof(size_t) * 2 < key_size) {
+        return 0;
+    }
+    size_t value_size = read_size(_data + offset + sizeof(size_t) + key_size);
+    if (left - sizeof(size_t) * 2 - key_size < value_size) {
+        return 0;
+    }
+    return sizeof(size_t) * 2 + key_size + value_size;
+}
+
+uint32_t SortedFile::hash(const ByteArray& key) {
+    // murmur-like, as the bloom filters of leveldb
+    const uint32_t seed = 0xbc9f1d34;
+    const uint32_t m = 0xc6a4a793;
+    const char *data = key.data();
+    size_t n = key.size();
+    uint32_t h = seed ^ static_cast<uint32_t>(n * m);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h += w;
+        h *= m;
+        h ^= (h >> 16);
+    }
+    switch (n - i) {
+    case 3:
+        h += static_cast<uint32_t>(static_cast<unsigned char>(data[i + 2])) << 16;
+        // fall through
+    case 2:
+        h += static_cast<uint32_t>(static_cast<unsigned char>(data[i + 1])) << 8;
+        // fall through
+    case 1:
+        h += static_cast<unsigned char>(data[i]);
+        h *= m;
+        h ^= (h >> 24);
+        break;
+    }
+    return h;
+}
+
+size_t SortedFile::read_size(const char* p) {
+    size_t size;
+    memcpy(&size, p, sizeof(size));
+    return size;
+}
+
+SortedFileSet::SortedFileSet(const Comparator* cmp) : _cmp(cmp), _size(0) {  }
+
+bool SortedFileSet::add(std::unique_ptr<SortedFile> file) {
+    if (file->empty()) {
+        return true;
+    }
+    if (!_files.empty() && _cmp->compare(_files.back()->last_key(), file->first_key()) >= 0) {
+        return false;
+    }
+    _size += file->size();
+    _files.push_back(std::move(file));
+    return true;
+}
+
+bool SortedFileSet::get(const ByteArray& key, ByteArray* value) const {
+    size_t file = find_file(key);
+    return file < _files.size() && _files[file]->get(key, value);
+}
+
+size_t SortedFileSet::find_file(const ByteArray& key) const {
+    return std::lower_bound(_files.begin(), _files.end(), key,
+        [this](const std::unique_ptr<SortedFile>& file, const ByteArray& k) {
+            return _cmp->compare(file->last_key(), k) < 0;
+        }) - _files.begin();
+}
+
+SortedFileSet::Iterator::Iterator(const SortedFileSet* set) :
+    _set(set), _file(0), _offset(SortedFile::NPOS) {
+}
+
+void SortedFileSet::Iterator::seek(const ByteArray& key) {
+    _file = _set->find_file(key);
+    _offset = _file < _set->_files.size() ? _set->_files[_file]->seek(key) : SortedFile::NPOS;
+}
+
+void SortedFileSet::Iterator::seek_for_prev(const ByteArray& key) {
+    // the file "key" falls into, or the last one before it
+    _file = _set->find_file(key);
+    if (_file < _set->_files.size()) {
+        _offset = _set->_files[_file]->seek_for_prev(key);
+        if (_offset != SortedFile::NPOS || _file == 0) {
+            return;
+        }
+    } else if (_file == 0) {
+        _offset = SortedFile::NPOS;
+        return;
+    }
+    --_file;
+    _offset = _set->_files[_file]->last();
+}
+
+void SortedFileSet::Iterator::seek_to_first() {
+    _file = 0;
+    _offset = _set->_files.empty() ? SortedFile::NPOS : _set->_files[0]->first();
+}
+
+void SortedFileSet::Iterator::seek_to_last() {
+    _file = _set->_files.empty() ? 0 : _set->_files.size() - 1;
+    _offset = _set->_files.empty() ? SortedFile::NPOS : _set->_files[_file]->last();
+}
+
+void SortedFileSet::Iterator::next() {
+    _offset = _set->_files[_file]->next(_offset);
+    if (_offset == SortedFile::NPOS && _file + 1 < _set->_files.size()) {
+        ++_file;
+        _offset = _set->_files[_file]->first();
+    }
+}
+
+void SortedFileSet::Iterator::prev() {
+    _offset = _set->_files[_file]->prev(_offset);
+    if (_offset == SortedFile::NPOS && _file > 0) {
+        --_file;
+        _offset = _set->_files[_file]->last();
+    }
+}
+
+} // namespace table
@@ -3,12 +3,27 @@
 // that can be found in the LICENSE file.
 
 #include "table.h"
+#include "write_batch.h"
 
+#include "log.h"
+#include "epoch.h"
+#include "rwlock.h"
 #include "skiplist.h"
 #include "memory_pool.h"
+#include "sorted_file.h"
+#include "file_writer.h"
+#include "compression.h"
+
+#include <set>
+#include <map>
 
 namespace table {
 
+// names the files in use, see Table::TableImpl::FileType
+static const char *const CURRENT_FILE = "CURRENT";
+// appended to the name of a file being written
+static const char *const TEMP_SUFFIX = ".tmp";
+
 class Table::TableImpl {
 TABLE_PUBLIC:
     TableImpl(const Options& options, const std::string& filename);
@@ -18,26 +33,246 @@ TABLE_PUBLIC:
     Status close();
 
     Status dump();
+    Status full_dump();
+    Status dump_async(const DumpCallback& callback);
+    Status verify();
+    Status memory_usage(MemoryUsage* usage);
 
     Status get(const ByteArray& key, std::string* value);
+    Status multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                     std::vector<Status>* statuses);
     Status put(const ByteArray& key, const ByteArray& value);
     Status del(const ByteArray& key);
+    Status write(const WriteBatch& batch);
 
     // Non-copying
     TableImpl(const TableImpl&) = delete;
     TableImpl& operator=(const TableImpl&) = delete;
 
 TABLE_PRIVATE:
+    friend class Table::Iterator;
+
+    // grow the hash index, if any, before "n" more keys are inserted
+    void reserve_index(size_t n);
+    // apply the records of "batch" to the skiplist, the caller holds the write lock
+    void apply(const WriteBatch& batch);
+
+    // The dump files searched by options.out_of_core, nullptr otherwise.
+    // Readers hold a reference, as a full dump replaces them.
+    std::shared_ptr<const SortedFileSet> sorted_files() const;
+    Status open_sorted_files(const std::vector<uint32_t>& numbers,
+                             std::shared_ptr<const SortedFileSet>* files);
+    // Returns true and points *value into the files if they hold "key" and it isn't deleted.
+    bool get_from_files(const SortedFileSet* files, const ByteArray& key, ByteArray* value);
+    bool deleted_from_files(const ByteArray& key);
+    // Delete "key" from the files before it is removed from the skiplist,
+    // returns false if the files don't hold it. The caller holds the write lock exclusive.
+    // While a full dump is about to replace the files, keys of its snapshot are deleted too.
+    bool delete_from_files(const ByteArray& key);
+    // "key" was written into the skiplist, which takes the place of the files.
+    void undelete_from_files(const ByteArray& key);
+    // An iterator keeps to the files it started with, so the nodes a full dump wrote into
+    // newer files are only evicted once no iterator of older files is left.
+    // acquire_files() returns the files and sets *generation for release_files().
+    std::shared_ptr<const SortedFileSet> acquire_files(uint64_t* generation);
+    void release_files(uint64_t generation);
+    // with _iterators_mutex held
+    bool iterators_of_old_files() const;
+    // evict the nodes of the last full dump unless an iterator needs them, with _dump_mutex held
+    void evict_dumped_nodes();
+
+    // A full dump is in files named "%08X", incremental dumps in "%08X.delta"
+    // and write-ahead logs in "%08X.log", each numbered in the order they are applied.
+    // Dump files are written under the name followed by ".tmp" and renamed once synced.
+    // The "CURRENT" file names the full dump in use and the first delta applied to it,
+    // a new full dump takes fresh numbers and only replaces the old one once CURRENT names it.
+    enum FileType {
+        DUMP_FILE = 0,
+        DELTA_FILE = 1,
+        LOG_FILE = 2,
+        FILE_TYPE_NUM = 3,
+    };
+
+    struct KeyCompare {
+        bool operator()(const std::string& lhs, const std::string& rhs) const {
+            return cmp->compare(lhs, rhs) < 0;
+        }
+
+        const Comparator *cmp;
+    };
+    typedef std::set<std::string, KeyCompare> KeySet;
+
+    // length of value that marks a deleted key in a delta file
+    static const size_t TOMBSTONE = ~static_cast<size_t>(0);
+
+    // Writes entries into numbered files of one type, each at most max_file_size bytes.
+    class DumpWriter {
+    TABLE_PUBLIC:
+        DumpWriter(TableImpl* table, FileType type, uint32_t number,
+                   const DumpCallback& callback, DumpProgress* progress);
+        ~DumpWriter() = default;
+
+        Status add(const ByteArray& key, const ByteArray& value);
+        Status add_tombstone(const ByteArray& key);
+        // close the last file, synced if there is a write-ahead log to discard
+        Status finish();
+        // remove the files written so far
+        void discard();
+
+        // Returns the number after the last file written.
+        uint32_t number() const { return _number; }
+
+    TABLE_PRIVATE:
+        Status add(const ByteArray& key, const char* value, size_t size);
+
+        TableImpl   *_table;
+        FileType     _type;
+        uint32_t     _first_number;
+        uint32_t     _number;
+        FileWriter   _file;
+        off_t        _bytes;
+        // the entry being added
+        std::string  _buffer;
+        // the index of a dump file, nullptr for a delta file
+        std::unique_ptr<SortedFileBuilder> _builder;
+        const DumpCallback&  _callback;
+        DumpProgress        *_progress;
+    };
+
+    enum {
+        // entries written between two progress reports of a dump
+        PROGRESS_INTERVAL = 65536,
+    };
+
+    // A dump file held in memory by options.lazy_load, mapped or decompressed.
+    struct Mapping {
+        Mapping() : size(0) {  }
+
+        std::shared_ptr<char>  data;
+        size_t                 size;
+    };
+
+    // Called with every entry of a file, "tombstone" marks a deleted key of a delta file.
+    typedef std::function<Status(const ByteArray& key, const ByteArray& value,
+                                 bool tombstone)> EntryFunc;
+    // A dump file is checked against its checksums first if "verify" is true.
+    // If "mapping" is not nullptr, the entries stay in memory as long as *mapping holds them.
+    // The blocks of a compressed dump file are decompressed on up to "thread_num" threads.
+    Status read_file(const std::string& path, bool is_delta, bool verify, const EntryFunc& f,
+                     Mapping* mapping = nullptr, size_t thread_num = 1);
+    // Replace *data, the "size" bytes of the compressed dump file at "path",
+    // by the entries of its blocks, and set *entries_size to their size.
+    Status decompress_file(const std::string& path, size_t size, size_t thread_num,
+                           std::shared_ptr<char>* data, size_t* entries_size);
+    Status load_dump_files(const std::vector<uint32_t>& numbers);
+    Status load_delta_file(uint32_t number);
+    // number of threads of open(), options.open_threads or one per CPU
+    size_t open_thread_num() const;
+    // call f(0), ..., f(n - 1) on up to "thread_num" threads, open_thread_num() if 0
+    void parallel_for(size_t n, const std::function<void(size_t)>& f, size_t thread_num = 0);
+    Status dump(bool full, const DumpCallback& callback);
+    // With options.out_of_core, the entries of "files" that are not in "deleted" are merged in.
+    // The new files are in use once it returns ok.
+    Status write_full_dump(const SortedFileSet* files, const KeySet& deleted,
+                           const DumpCallback& callback, DumpProgress* progress);
+    // write the entries changed since version "since" and tombstones of "deleted_keys"
+    Status write_delta_dump(uint64_t since, std::vector<std::string>* deleted_keys,
+                            const DumpCallback& callback, DumpProgress* progress);
+    // serve dump_async() and options.dump_interval_msec
+    void dump_loop();
+    void stop_dump_thread();
+
+    // *temporary is set if the file is being written, such names are rejected if it is nullptr
+    static bool parse_file_name(const char* name, uint32_t* number, FileType* type,
+                                bool* temporary = nullptr);
+    // set files[type] to the numbers of the files of every type in the table directory, in order
+    Status list_files(std::vector<uint32_t>* files) const;
+    // keep the dump and delta files of "files" that CURRENT names
+    void keep_current_files(std::vector<uint32_t>* files) const;
+    // Read CURRENT, written from the files of a table that has none, and keep the files it names.
+    Status read_current(std::vector<uint32_t>* files);
+    // replace CURRENT, naming "dump_file_num" dump files from "dump_number"
+    // and the delta files from "first_delta"
+    Status write_current(uint32_t dump_number, uint32_t dump_file_num, uint32_t first_delta);
+    std::string file_path(uint32_t number, FileType type) const;
+    // make the files created, renamed and removed in the table directory durable
+    Status sync_directory() const;
+    // start writing log "number", the previous log is closed and kept
+    Status switch_log(uint32_t number);
+    // remove the files of "type" numbered less than "number"
+    Status remove_files(FileType type, uint32_t number);
+    // remove the files for which "unused" returns true
+    Status remove_files(const std::function<bool(uint32_t number, FileType type,
+                                                 bool temporary)>& unused);
+    // remove the files left over by a crash and those CURRENT no longer names
+    Status remove_unused_files();
+
     bool        _is_closed;
     Options     _options;
+    Epoch       _epoch;
     MemoryPool  _pool;
     SkipList    _skiplist;
+    // dump files mapped by options.lazy_load, the loaded entries point into them
+    std::vector<Mapping> _mappings;
+    std::atomic<size_t>  _mapped_bytes;
+    // see sorted_files()
+    std::shared_ptr<const SortedFileSet> _files;
+    // keys of _files deleted since they were written, and their number
+    std::mutex            _files_deleted_mutex;
+    KeySet                _files_deleted;
+    std::atomic<size_t>   _files_deleted_num;
+    // a full dump of out_of_core has the snapshot open, set under the write lock exclusive
+    bool                  _files_snapshot;
+    // _files is replaced under it, see acquire_files()
+    std::mutex                  _iterators_mutex;
+    uint64_t                    _files_generation;
+    // number of iterators per generation of the files they hold
+    std::map<uint64_t, size_t>  _iterators;
+    // nodes older than it are in the files but not evicted yet, 0 if none
+    uint64_t                    _evict_version;
     std::string _name;
+    // upsert() may run concurrently, so put() holds it shared,
+    // while remove() unlinks nodes and holds it exclusive.
+    // Writers hold it across logging and applying, so a dump that switched logs
+    // under it exclusive sees every record of the previous logs.
+    RWLock      _write_lock;
+    std::unique_ptr<LogWriter> _log;
+    // number of the current log, or the next one if we don't write any
+    uint32_t    _log_number;
+
+    // serializes dumps
+    std::mutex  _dump_mutex;
+    bool        _has_full_dump;
+    // the files named by CURRENT
+    uint32_t    _dump_number;
+    uint32_t    _dump_file_num;
+    uint32_t    _first_delta;
+    // number of the next delta file
+    uint32_t    _delta_number;
+    // nodes changed since the last dump have a version >= it
+    uint64_t    _dumped_version;
+    // keys deleted since the last dump, only kept for incremental dumps
+    std::vector<std::string> _deleted_keys;
+
+    // the background dump thread, started by the first request
+    std::thread              _dump_thread;
+    std::mutex               _dump_thread_mutex;
+    std::condition_variable  _dump_cv;
+    bool                     _dump_pending;
+    DumpCallback             _dump_pending_callback;
+    bool                     _dump_stopping;
 };
 
 Table::TableImpl::TableImpl(const Options& options, const std::string& filename) :
-    _is_closed(true), _options(options), _pool(options.read_ttl_msec),
-    _skiplist(options.comparator, &_pool), _name(filename) {
+    _is_closed(true), _options(options),
+    _pool(&_epoch, options.memory_arena, options.max_retained_memory, options.huge_pages),
+    _skiplist(options.comparator, &_pool, options.hash_index), _mapped_bytes(0),
+    _files_deleted(KeyCompare{options.comparator}), _files_deleted_num(0),
+    _files_snapshot(false), _files_generation(0), _evict_version(0),
+    _name(filename), _log_number(0),
+    _has_full_dump(false), _dump_number(0), _dump_file_num(0), _first_delta(0),
+    _delta_number(0), _dumped_version(0),
+    _dump_pending(false), _dump_stopping(false) {
 }
 
 Table::TableImpl::~TableImpl() {
@@ -48,6 +283,10 @@ Status Table::TableImpl::open() {
     if (!_is_closed) {
         return Status::invalid_operation("Table was already open");
     }
+    if (!compression_supported(_options.compression)) {
+        return Status::invalid_operation("compression " + std::to_string(_options.compression) +
+                                         " is not available in this build");
+    }
 
     struct stat info;
     bool table_exist = stat(_name.c_str(), &info) == 0;
@@ -64,102 +303,431 @@ Status Table::TableImpl::open() {
         }
     }
 
-    auto closedir_func = [](DIR* d) {
-        if (d) {
-            closedir(d);
+    // keys of the full dump are unique, the deltas and then the logs replay changes in order
+    std::vector<uint32_t> files[FILE_TYPE_NUM];
+    Status s = list_files(files);
+    if (s.good()) {
+        s = read_current(files);
+    }
+    if (!s.good()) {
+        return s;
+    }
+    if (_options.out_of_core) {
+        std::shared_ptr<const SortedFileSet> sorted;
+        s = open_sorted_files(files[DUMP_FILE], &sorted);
+        std::atomic_store(&_files, sorted);
+    } else {
+        s = load_dump_files(files[DUMP_FILE]);
+    }
+    if (!s.good()) {
+        return s;
+    }
+    for (uint32_t number : files[DELTA_FILE]) {
+        s = load_delta_file(number);
+        if (!s.good()) {
+            return s;
+        }
+    }
+    _has_full_dump = !files[DUMP_FILE].empty();
+
+    // entries replayed from the logs are not in any dump file yet
+    _dumped_version = _skiplist.advance_version();
+    for (uint32_t number : files[LOG_FILE]) {
+        s = read_log(file_path(number, LOG_FILE), [this](const WriteBatch& batch) {
+            _skiplist.reserve_index(batch.count());
+            apply(batch);
+        });
+        if (!s.good()) {
+            return s;
+        }
+    }
+    _log_number = files[LOG_FILE].empty() ? 0 : files[LOG_FILE].back() + 1;
+    // the replayed logs are kept until the next dump covers them
+    if (_options.write_ahead_log) {
+        s = switch_log(_log_number);
+        if (!s.good()) {
+            return s;
+        }
+    }
+
+    _is_closed = false;
+    if (_options.dump_interval_msec > 0) {
+        _dump_thread = std::thread(&TableImpl::dump_loop, this);
+    }
+    return Status::ok();
+}
+
+Status Table::TableImpl::read_file(const std::string& path, bool is_delta, bool verify,
+                                   const EntryFunc& f, Mapping* mapping,
+                                   size_t thread_num) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !(info.st_mode & S_IFREG)) {
+        return Status::ok();
+    }
+
+    auto close_func = [](int* fd) {
+        if (fd) {
+            ::close(*fd);
+            delete fd;
         }
     };
-    std::shared_ptr<DIR> directory(opendir(_name.c_str()), closedir_func);
-    if (directory == nullptr) {
-        return Status::io_error("could not open " + _name + " directory");
+    std::shared_ptr<int> fd(new int(::open(path.c_str(), O_RDONLY)), close_func);
+    if (*fd == -1) {
+        return Status::io_error("open " + path + " error, " + strerror(errno));
     }
 
-    errno = 0;
-    struct dirent *entry;
-    char path[PATH_MAX];
-    for (entry = readdir(directory.get()); entry != nullptr; entry = readdir(directory.get())) {
-        // we scan all files in directory
-        snprintf(path, PATH_MAX, "%s/%s", _name.c_str(), entry->d_name);
+    if (info.st_size == 0) {
+        return Status::ok();
+    }
 
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    off_t file_size = info.st_size;
+    auto munmap_func = [file_size](char *data) {
+        if (data != MAP_FAILED) {
+            munmap(data, file_size);
         }
+    };
+    std::shared_ptr<char> data(
+        reinterpret_cast<char*>(mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, *fd, 0)),
+        munmap_func);
+    if (data.get() == MAP_FAILED) {
+        return Status::io_error("mmap " + path + " error, " + strerror(errno));
+    }
 
-        if (stat(path, &info) != 0 || !(info.st_mode & S_IFREG)) {
-            continue;
+    // bytes held by data
+    size_t data_size = info.st_size;
+    // the entries of a dump file are followed by its index
+    off_t end = is_delta ? info.st_size : SortedFile::data_size(data.get(), info.st_size);
+    if (!is_delta && verify) {
+        Status s = SortedFile::verify(path, data.get(), info.st_size);
+        if (!s.good()) {
+            return s;
         }
+    }
+    if (!is_delta &&
+            SortedFile::compression(data.get(), info.st_size) != Options::NO_COMPRESSION) {
+        size_t entries_size = 0;
+        Status s = decompress_file(path, info.st_size, thread_num, &data, &entries_size);
+        if (!s.good()) {
+            return s;
+        }
+        end = entries_size;
+        data_size = entries_size;
+    }
+    if (end > _options.max_file_size) {
+        return Status::io_error("file " + path + " is too large, "
+                                    "max file size " + std::to_string(_options.max_file_size));
+    }
 
-        auto close_func = [](int* fd) {
-            if (fd) {
-                ::close(*fd);
-                delete fd;
-            }
-        };
-        std::shared_ptr<int> fd(new int(::open(path, O_RDONLY)), close_func);
-        if (*fd == -1) {
-            return Status::io_error("open " + std::string(path) + " error, " + strerror(errno));
+    // +--------------------Entry----------------------+
+    // | length of key | key | length of value | value |
+    // +-----------------------------------------------+
+    // a delta file marks a deleted key with a TOMBSTONE length of value and no value
+    // a torn write leaves lengths that run past the end
+    off_t offset = 0;
+    auto corrupted = [&path, &offset]() {
+        return Status::io_error("corrupted entry at offset " + std::to_string(offset) +
+                                " of " + path);
+    };
+    while (offset < end) {
+        const char *p = data.get() + offset;
+        size_t left = end - offset;
+        if (left < sizeof(size_t) * 2) {
+            return corrupted();
+        }
+        size_t key_size = *reinterpret_cast<const size_t*>(p);
+        if (left - sizeof(size_t) * 2 < key_size) {
+            return corrupted();
+        }
+        size_t value_size = *reinterpret_cast<const size_t*>(p + sizeof(size_t) + key_size);
+        bool tombstone = is_delta && value_size == TOMBSTONE;
+        if (tombstone) {
+            value_size = 0;
+        }
+        if (left - sizeof(size_t) * 2 - key_size < value_size) {
+            return corrupted();
+        }
+        ByteArray key(p + sizeof(size_t), key_size);
+        ByteArray value(p + sizeof(size_t) * 2 + key_size, value_size);
+        offset += sizeof(size_t) * 2 + key_size + value_size;
+
+        Status s = f(key, value, tombstone);
+        if (!s.good()) {
+            return s;
         }
+    }
+    if (mapping) {
+        mapping->data = data;
+        mapping->size = data_size;
+    }
+    return Status::ok();
+}
 
-        if (info.st_size > _options.max_file_size) {
-            return Status::io_error("file " + std::string(path) + " is too large, "
-                                        "max file size " + std::to_string(_options.max_file_size));
+Status Table::TableImpl::decompress_file(const std::string& path, size_t size,
+                                         size_t thread_num, std::shared_ptr<char>* data,
+                                         size_t* entries_size) {
+    std::vector<SortedFile::Block> blocks;
+    Status s = SortedFile::read_blocks(path, data->get(), size, &blocks);
+    if (!s.good()) {
+        return s;
+    }
+
+    // the blocks are decompressed back to back, as the entries of an uncompressed file
+    std::vector<size_t> offsets(blocks.size() + 1, 0);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].raw_size > static_cast<size_t>(_options.max_file_size) - offsets[i]) {
+            return Status::io_error("file " + path + " is too large, "
+                                    "max file size " + std::to_string(_options.max_file_size));
+        }
+        offsets[i + 1] = offsets[i] + blocks[i].raw_size;
+    }
+    std::shared_ptr<char> entries(new char[std::max<size_t>(1, offsets.back())],
+                                  std::default_delete<char[]>());
+    std::atomic<bool> corrupted(false);
+    parallel_for(blocks.size(), [&](size_t i) {
+        if (!decompress(blocks[i].compression, blocks[i].data, blocks[i].size,
+                        entries.get() + offsets[i], blocks[i].raw_size)) {
+            corrupted = true;
         }
+    }, thread_num);
+    if (corrupted) {
+        return Status::io_error("corrupted block of " + path);
+    }
+    *data = entries;
+    *entries_size = offsets.back();
+    return Status::ok();
+}
 
-        if (info.st_size > 0) {
-            auto munmap_func = [&info](char *data) {
-                if (data != MAP_FAILED) {
-                    munmap(data, info.st_size);
+Status Table::TableImpl::load_dump_files(const std::vector<uint32_t>& numbers) {
+    // a dump is written in key order, so every file is appended to a run of its own
+    // on a thread of its own, and the runs are spliced into the list in file order,
+    // entries out of order are set aside and inserted at the end
+    std::vector<std::unique_ptr<SkipList::Run>> runs(numbers.size());
+    std::vector<std::vector<std::pair<std::string, std::string>>> leftovers(numbers.size());
+    std::vector<Status> statuses(numbers.size());
+    std::vector<Mapping> mappings(numbers.size());
+    bool lazy = _options.lazy_load;
+    // the threads left over by the files decompress the blocks of a compressed one
+    size_t block_threads = std::max<size_t>(
+        1, open_thread_num() / std::max<size_t>(1, numbers.size()));
+    parallel_for(numbers.size(), [&](size_t i) {
+        runs[i].reset(new SkipList::Run(&_skiplist));
+        statuses[i] = read_file(file_path(numbers[i], DUMP_FILE), false, _options.verify_on_open,
+            [&runs, &leftovers, i, lazy](const ByteArray& key, const ByteArray& value, bool) {
+                // in the file, the value follows its length
+                bool appended = lazy ? runs[i]->append_in_place(key, value.data() - sizeof(size_t)) :
+                                       runs[i]->append(key, value);
+                if (!appended) {
+                    leftovers[i].emplace_back(std::string(key.data(), key.size()),
+                                              std::string(value.data(), value.size()));
                 }
-            };
-            std::shared_ptr<char> data(
-                reinterpret_cast<char*>(
-                    mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, *fd, 0)),
-                munmap_func);
-            if (data.get() == MAP_FAILED) {
-                return Status::io_error("mmap " + std::string(path) + " error, " + strerror(errno));
+                return Status::ok();
+            }, lazy ? &mappings[i] : nullptr, block_threads);
+    });
+
+    size_t total = 0;
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        if (!statuses[i].good()) {
+            return statuses[i];
+        }
+        total += runs[i]->size() + leftovers[i].size();
+    }
+    _skiplist.reserve_index(total);
+    // the nodes point into the mappings from here on, even if open() fails
+    _mappings.insert(_mappings.end(), mappings.begin(), mappings.end());
+    for (const auto& mapping : mappings) {
+        _mapped_bytes += mapping.size;
+    }
+
+    std::string duplicate;
+    for (auto& run : runs) {
+        if (!_skiplist.splice(run.get(), &duplicate)) {
+            return Status::invalid_operation("duplicate key " + duplicate);
+        }
+        run.reset();
+    }
+    for (auto& entries : leftovers) {
+        for (auto& entry : entries) {
+            if (!_skiplist.insert(entry.first, entry.second).good()) {
+                return Status::invalid_operation("duplicate key " + entry.first);
             }
+        }
+    }
+    return Status::ok();
+}
 
-            // +--------------------Entry----------------------+
-            // | length of key | key | length of value | value |
-            // +-----------------------------------------------+
-            off_t offset = 0;
-            while (true) {
-                ByteArray key;
-                ByteArray value;
-                if (info.st_size - offset >= static_cast<off_t>(sizeof(size_t))) {
-                    size_t size = *reinterpret_cast<size_t*>(data.get() + offset);
-                    key.assign(data.get() + offset + sizeof(size_t), size);
-                    offset += sizeof(size_t) + size;
-                }
-                if (info.st_size - offset >= static_cast<off_t>(sizeof(size_t))) {
-                    size_t size = *reinterpret_cast<size_t*>(data.get() + offset);
-                    value.assign(data.get() + offset + sizeof(size_t), size);
-                    offset += sizeof(size_t) + size;
-                }
-                if (key.empty() || value.empty()) {
-                    break;
-                }
-                auto it = _skiplist.insert(key, value);
-                if (!it.good()) {
-                    return Status::invalid_operation(
-                        "duplicate key " + std::string(key.data(), key.size()));
-                }
-           }
+Status Table::TableImpl::load_delta_file(uint32_t number) {
+    return read_file(file_path(number, DELTA_FILE), true, false,
+        [this](const ByteArray& key, const ByteArray& value, bool tombstone) {
+            if (tombstone) {
+                delete_from_files(key);
+                _skiplist.remove(key);
+            } else {
+                _skiplist.reserve_index(1);
+                _skiplist.upsert(key, value);
+                undelete_from_files(key);
+            }
+            return Status::ok();
+        });
+}
+
+size_t Table::TableImpl::open_thread_num() const {
+    size_t thread_num = _options.open_threads > 0 ?
+        static_cast<size_t>(_options.open_threads) : std::thread::hardware_concurrency();
+    return std::max<size_t>(1, thread_num);
+}
+
+void Table::TableImpl::parallel_for(size_t n, const std::function<void(size_t)>& f,
+                                    size_t thread_num) {
+    if (thread_num == 0) {
+        thread_num = open_thread_num();
+    }
+    thread_num = std::max<size_t>(1, std::min(thread_num, n));
+
+    std::atomic<size_t> next(0);
+    auto worker = [&next, n, &f]() {
+        for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            f(i);
         }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_num; ++t) {
+        threads.emplace_back(worker);
     }
-    if (errno != 0) {
-        return Status::io_error("readdir " + _name + " error, " + strerror(errno));
+    worker();
+    for (auto& t : threads) {
+        t.join();
     }
+}
 
-    _is_closed = false;
+std::shared_ptr<const SortedFileSet> Table::TableImpl::sorted_files() const {
+    return std::atomic_load(&_files);
+}
+
+Status Table::TableImpl::open_sorted_files(const std::vector<uint32_t>& numbers,
+                                           std::shared_ptr<const SortedFileSet>* files) {
+    std::vector<std::unique_ptr<SortedFile>> opened(numbers.size());
+    std::vector<Status> statuses(numbers.size());
+    parallel_for(numbers.size(), [&](size_t i) {
+        statuses[i] = SortedFile::open(file_path(numbers[i], DUMP_FILE), _options.comparator,
+                                       _options.block_size, _options.verify_on_open, &opened[i]);
+    });
+
+    std::shared_ptr<SortedFileSet> set(new SortedFileSet(_options.comparator));
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        if (!statuses[i].good()) {
+            return statuses[i];
+        }
+        if (!set->add(std::move(opened[i]))) {
+            return Status::invalid_operation("keys of " + file_path(numbers[i], DUMP_FILE) +
+                " overlap the files before, open it without out_of_core and dump it again");
+        }
+    }
+    *files = set;
     return Status::ok();
 }
 
+bool Table::TableImpl::get_from_files(const SortedFileSet* files, const ByteArray& key,
+                                      ByteArray* value) {
+    return files && !deleted_from_files(key) && files->get(key, value);
+}
+
+bool Table::TableImpl::deleted_from_files(const ByteArray& key) {
+    if (_files_deleted_num.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_files_deleted_mutex);
+    return _files_deleted.count(std::string(key.data(), key.size())) > 0;
+}
+
+bool Table::TableImpl::delete_from_files(const ByteArray& key) {
+    std::shared_ptr<const SortedFileSet> files = sorted_files();
+    ByteArray value;
+    bool in_files = get_from_files(files.get(), key, &value);
+    if (!in_files) {
+        if (!_files_snapshot) {
+            return false;
+        }
+        // the files written from the snapshot hold the key once they are swapped in
+        EpochGuard epoch_guard(&_epoch);
+        if (!_skiplist.snapshot_contains(key)) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(_files_deleted_mutex);
+    _files_deleted.insert(std::string(key.data(), key.size()));
+    _files_deleted_num.store(_files_deleted.size(), std::memory_order_release);
+    return in_files;
+}
+
+std::shared_ptr<const SortedFileSet> Table::TableImpl::acquire_files(uint64_t* generation) {
+    std::lock_guard<std::mutex> lock(_iterators_mutex);
+    std::shared_ptr<const SortedFileSet> files = sorted_files();
+    *generation = _files_generation;
+    if (files) {
+        ++_iterators[_files_generation];
+    }
+    return files;
+}
+
+void Table::TableImpl::release_files(uint64_t generation) {
+    {
+        std::lock_guard<std::mutex> lock(_iterators_mutex);
+        auto it = _iterators.find(generation);
+        if (it == _iterators.end()) {
+            return;
+        }
+        if (--it->second == 0) {
+            _iterators.erase(it);
+        }
+        if (_evict_version == 0 || iterators_of_old_files()) {
+            return;
+        }
+    }
+    // a running dump evicts them itself once it is done
+    std::unique_lock<std::mutex> dump_lock(_dump_mutex, std::try_to_lock);
+    if (dump_lock.owns_lock()) {
+        evict_dumped_nodes();
+    }
+}
+
+bool Table::TableImpl::iterators_of_old_files() const {
+    return !_iterators.empty() && _iterators.begin()->first < _files_generation;
+}
+
+void Table::TableImpl::evict_dumped_nodes() {
+    // no writer changes the list and no snapshot is open meanwhile
+    ExclusiveLockGuard guard(&_write_lock);
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(_iterators_mutex);
+        if (_evict_version == 0 || iterators_of_old_files()) {
+            return;
+        }
+        version = _evict_version;
+        _evict_version = 0;
+    }
+    _skiplist.evict(version);
+}
+
+void Table::TableImpl::undelete_from_files(const ByteArray& key) {
+    // keys are only deleted under the write lock exclusive, so none is added meanwhile
+    if (_files_deleted_num.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_files_deleted_mutex);
+    if (_files_deleted.erase(std::string(key.data(), key.size())) > 0) {
+        _files_deleted_num.store(_files_deleted.size(), std::memory_order_release);
+    }
+}
+
 Status Table::TableImpl::close() {
     if (_is_closed) {
         return Status::invalid_operation("Table is closed");
     }
 
+    // a background dump that is running finishes first
+    stop_dump_thread();
+
     if (_options.dump_when_close) {
         Status s = dump();
         if (!s.good()) {
@@ -167,79 +735,691 @@ Status Table::TableImpl::close() {
         }
     }
 
+    if (_log) {
+        Status s = _log->close();
+        _log.reset();
+        if (!s.good()) {
+            return s;
+        }
+    }
+
     _is_closed = true;
     return Status::ok();
 }
 
 Status Table::TableImpl::dump() {
+    return dump(!_options.incremental_dump, DumpCallback());
+}
+
+Status Table::TableImpl::full_dump() {
+    return dump(true, DumpCallback());
+}
+
+Status Table::TableImpl::dump_async(const DumpCallback& callback) {
     if (_is_closed) {
         return Status::invalid_operation("Table is closed");
     }
 
-    auto close_func = [](int* fd) {
-        if (fd) {
-            ::close(*fd);
-            delete fd;
+    std::lock_guard<std::mutex> lock(_dump_thread_mutex);
+    if (_dump_pending) {
+        return Status::invalid_operation("a background dump is already pending");
+    }
+    _dump_pending = true;
+    _dump_pending_callback = callback;
+    if (!_dump_thread.joinable()) {
+        _dump_thread = std::thread(&TableImpl::dump_loop, this);
+    }
+    _dump_cv.notify_one();
+    return Status::ok();
+}
+
+Status Table::TableImpl::verify() {
+    if (_is_closed) {
+        return Status::invalid_operation("Table is closed");
+    }
+
+    // dumps rewrite the files
+    std::lock_guard<std::mutex> dump_guard(_dump_mutex);
+    std::vector<uint32_t> files[FILE_TYPE_NUM];
+    Status s = list_files(files);
+    if (!s.good()) {
+        return s;
+    }
+    keep_current_files(files);
+
+    // delta files have no checksums, but every entry is still checked to be within the file
+    std::vector<std::pair<uint32_t, FileType>> targets;
+    for (FileType type : {DUMP_FILE, DELTA_FILE}) {
+        for (uint32_t number : files[type]) {
+            targets.emplace_back(number, type);
         }
-    };
+    }
+    std::vector<Status> statuses(targets.size());
+    parallel_for(targets.size(), [&](size_t i) {
+        statuses[i] = read_file(file_path(targets[i].first, targets[i].second),
+                                targets[i].second == DELTA_FILE, true,
+                                [](const ByteArray&, const ByteArray&, bool) {
+                                    return Status::ok();
+                                });
+    });
+    for (const Status& status : statuses) {
+        if (!status.good()) {
+            return status;
+        }
+    }
+    return Status::ok();
+}
+
+void Table::TableImpl::dump_loop() {
+    auto interval = std::chrono::milliseconds(_options.dump_interval_msec);
+    auto next_dump = std::chrono::steady_clock::now() + interval;
+
+    std::unique_lock<std::mutex> lock(_dump_thread_mutex);
+    while (true) {
+        bool periodic = false;
+        while (!_dump_stopping && !_dump_pending && !periodic) {
+            if (_options.dump_interval_msec > 0) {
+                periodic = _dump_cv.wait_until(lock, next_dump) == std::cv_status::timeout;
+            } else {
+                _dump_cv.wait(lock);
+            }
+        }
+        if (_dump_stopping) {
+            break;
+        }
+
+        DumpCallback callback = periodic ? _options.dump_callback : _dump_pending_callback;
+        _dump_pending = false;
+        _dump_pending_callback = nullptr;
+        lock.unlock();
+        dump(!_options.incremental_dump, callback);
+        lock.lock();
+        next_dump = std::chrono::steady_clock::now() + interval;
+    }
+
+    // a request that arrived while we were stopping still hears back
+    if (_dump_pending) {
+        DumpCallback callback = _dump_pending_callback;
+        _dump_pending = false;
+        _dump_pending_callback = nullptr;
+        lock.unlock();
+        if (callback) {
+            DumpProgress progress;
+            progress.done = true;
+            progress.status = Status::invalid_operation("Table is closed");
+            callback(progress);
+        }
+    }
+}
+
+void Table::TableImpl::stop_dump_thread() {
+    if (!_dump_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_dump_thread_mutex);
+        _dump_stopping = true;
+    }
+    _dump_cv.notify_one();
+    _dump_thread.join();
+    _dump_stopping = false;
+}
+
+Status Table::TableImpl::dump(bool full, const DumpCallback& callback) {
+    if (_is_closed) {
+        return Status::invalid_operation("Table is closed");
+    }
 
-    char path[PATH_MAX];
-    snprintf(path, PATH_MAX, "%s", _name.c_str());
+    std::lock_guard<std::mutex> dump_guard(_dump_mutex);
+    // a delta needs a full dump to apply to
+    full = full || !_has_full_dump;
 
-    off_t bytes = 0;
-    int split_num = 0;
-    std::shared_ptr<int> fd;
-    for (auto it = _skiplist.begin(); it.good(); it.next()) {
-        size_t entry_size = it.key().size() + it.value().size() + sizeof(size_t) * 2;
-        if (bytes + static_cast<off_t>(entry_size) > _options.max_file_size) {
-            bytes = 0;
+    // once no writer is between logging and applying, every record of the logs
+    // before the new one is in the skiplist, and the snapshot keeps the entries
+    // as they are now while writers go on
+    uint64_t since;
+    std::vector<std::string> deleted_keys;
+    std::shared_ptr<const SortedFileSet> files = sorted_files();
+    KeySet files_deleted(KeyCompare{_options.comparator});
+    {
+        ExclusiveLockGuard guard(&_write_lock);
+        if (_log) {
+            Status s = switch_log(_log_number + 1);
+            if (!s.good()) {
+                return s;
+            }
+        }
+        since = _dumped_version;
+        _dumped_version = _skiplist.open_snapshot();
+        deleted_keys.swap(_deleted_keys);
+        if (files && full) {
+            _files_snapshot = true;
+            std::lock_guard<std::mutex> lock(_files_deleted_mutex);
+            files_deleted = _files_deleted;
         }
+    }
+    uint32_t covered_logs = _log_number;
 
-        if (bytes == 0) {
-            snprintf(path + _name.size(), PATH_MAX - _name.size(), "/%08X", split_num);
-            fd.reset(new int(::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)), close_func);
-            if (*fd == -1) {
-                return Status::io_error("open " + std::string(path) + " error, " + strerror(errno));
+    // the scan pins the epoch a batch of entries at a time, not for the whole dump
+    DumpProgress progress;
+    Status s = full ? write_full_dump(files.get(), files_deleted, callback, &progress) :
+                      write_delta_dump(since, &deleted_keys, callback, &progress);
+    if (files && full) {
+        // the new files take the place of the old ones and of the entries of the snapshot,
+        // which stays open until then so keys of it deleted meanwhile stay deleted
+        std::shared_ptr<const SortedFileSet> new_files;
+        if (s.good()) {
+            std::vector<uint32_t> numbers(_dump_file_num);
+            for (uint32_t i = 0; i < _dump_file_num; ++i) {
+                numbers[i] = _dump_number + i;
+            }
+            s = open_sorted_files(numbers, &new_files);
+        }
+        ExclusiveLockGuard guard(&_write_lock);
+        _files_snapshot = false;
+        _skiplist.close_snapshot();
+        if (s.good()) {
+            {
+                std::lock_guard<std::mutex> lock(_iterators_mutex);
+                std::atomic_store(&_files, new_files);
+                ++_files_generation;
+                _evict_version = _dumped_version;
+            }
+            // only the keys deleted before the snapshot are left out of the new files
+            std::lock_guard<std::mutex> lock(_files_deleted_mutex);
+            for (const std::string& key : files_deleted) {
+                _files_deleted.erase(key);
             }
-            ++split_num;
+            _files_deleted_num.store(_files_deleted.size(), std::memory_order_relaxed);
         }
+    } else {
+        _skiplist.close_snapshot();
+    }
+    if (files) {
+        // or the last iterator of the old files does
+        evict_dumped_nodes();
+    }
+    if (!s.good()) {
+        // leave the changes to the next dump
+        ExclusiveLockGuard guard(&_write_lock);
+        _dumped_version = since;
+        _deleted_keys.insert(_deleted_keys.end(), deleted_keys.begin(), deleted_keys.end());
+    } else {
+        s = remove_files(LOG_FILE, covered_logs);
+    }
 
-        // +--------------------Entry----------------------+
-        // | length of key | key | length of value | value |
-        // +-----------------------------------------------+
-        std::shared_ptr<char> buffer(new char[entry_size]);
-        size_t offset = 0;
-        size_t size = it.key().size();
-        memcpy(buffer.get() + offset, &size, sizeof(size));
-        offset += sizeof(size);
-        memcpy(buffer.get() + offset, it.key().data(), size);
-        offset += size;
-        size = it.value().size();
-        memcpy(buffer.get() + offset, &size, sizeof(size));
-        offset += sizeof(size);
-        memcpy(buffer.get() + offset, it.value().data(), size);
+    if (callback) {
+        progress.done = true;
+        progress.status = s;
+        callback(progress);
+    }
+    return s;
+}
 
-        if (write(*fd, buffer.get(), entry_size) == -1) {
-            return Status::io_error("write " + std::string(path) + " error, " + strerror(errno));
+Status Table::TableImpl::write_full_dump(const SortedFileSet* files, const KeySet& deleted,
+                                         const DumpCallback& callback, DumpProgress* progress) {
+    // the files in use stay as they are until CURRENT names the new ones
+    uint32_t first_number = _dump_number + _dump_file_num;
+    DumpWriter writer(this, DUMP_FILE, first_number, callback, progress);
+    Status s;
+    std::unique_ptr<SortedFileSet::Iterator> it;
+    if (files) {
+        it.reset(new SortedFileSet::Iterator(files));
+        it->seek_to_first();
+    }
+    // write the entries of the files before "key", the skiplist holds the newer one of "key"
+    Comparator *cmp = _options.comparator;
+    auto merge_files = [&it, &writer, &s, &deleted, cmp](const ByteArray* key) {
+        for (; it && it->valid(); it->next()) {
+            int c = key ? cmp->compare(it->key(), *key) : -1;
+            if (c >= 0) {
+                if (c == 0) {
+                    it->next();
+                }
+                break;
+            }
+            if (!deleted.empty() && deleted.count(std::string(it->key().data(), it->key().size()))) {
+                continue;
+            }
+            s = writer.add(it->key(), it->value());
+            if (!s.good()) {
+                return false;
+            }
         }
+        return true;
+    };
+    _skiplist.scan_snapshot(0, [&](const ByteArray& key, const ByteArray& value) {
+        if (!merge_files(&key)) {
+            return false;
+        }
+        s = writer.add(key, value);
+        return s.good();
+    });
+    if (s.good()) {
+        merge_files(nullptr);
+    }
+    if (s.good()) {
+        s = writer.finish();
+    }
+    if (!s.good()) {
+        writer.discard();
+        return s;
+    }
 
-        bytes += entry_size;
+    // the deltas written so far are folded into the new full dump
+    s = write_current(first_number, writer.number() - first_number, _delta_number);
+    if (!s.good()) {
+        return s;
     }
+    _has_full_dump = true;
+    return remove_unused_files();
+}
 
-    // just remove the superfluous files
-    struct stat _;
-    while (true) {
-        snprintf(path + _name.size(), PATH_MAX - _name.size(), "/%08X", split_num);
-        if (stat(path, &_) != 0) {
-            break;
+Status Table::TableImpl::write_delta_dump(uint64_t since, std::vector<std::string>* deleted_keys,
+                                          const DumpCallback& callback, DumpProgress* progress) {
+    DumpWriter writer(this, DELTA_FILE, _delta_number, callback, progress);
+    Status s;
+    _skiplist.scan_snapshot(since, [&writer, &s](const ByteArray& key, const ByteArray& value) {
+        s = writer.add(key, value);
+        return s.good();
+    });
+    if (!s.good()) {
+        writer.discard();
+        return s;
+    }
+
+    // a key deleted and inserted again was written above instead
+    Comparator *cmp = _options.comparator;
+    std::sort(deleted_keys->begin(), deleted_keys->end(),
+        [cmp](const std::string& lhs, const std::string& rhs) {
+            return cmp->compare(lhs, rhs) < 0;
+        });
+    auto end = std::unique(deleted_keys->begin(), deleted_keys->end(),
+        [cmp](const std::string& lhs, const std::string& rhs) {
+            return cmp->compare(lhs, rhs) == 0;
+        });
+    for (auto key = deleted_keys->begin(); key != end; ++key) {
+        bool in_snapshot;
+        {
+            EpochGuard epoch_guard(&_epoch);
+            in_snapshot = _skiplist.snapshot_contains(*key);
+        }
+        if (in_snapshot) {
+            continue;
+        }
+        s = writer.add_tombstone(*key);
+        if (!s.good()) {
+            writer.discard();
+            return s;
         }
+    }
 
-        if (remove(path) == -1) {
-            return Status::io_error(strerror(errno));
+    s = writer.finish();
+    if (!s.good()) {
+        writer.discard();
+        return s;
+    }
+    _delta_number = writer.number();
+    return Status::ok();
+}
+
+Table::TableImpl::DumpWriter::DumpWriter(TableImpl* table, FileType type, uint32_t number,
+                                         const DumpCallback& callback, DumpProgress* progress) :
+    _table(table), _type(type), _first_number(number), _number(number),
+    _file(table->_options.dump_buffer_size, table->_options.dump_direct_io,
+          table->_options.dump_drop_cache),
+    _bytes(0), _callback(callback), _progress(progress) {
+    if (type == DUMP_FILE) {
+        // out_of_core searches the files in place
+        Options::Compression compression = table->_options.out_of_core ?
+            Options::NO_COMPRESSION : table->_options.compression;
+        _builder.reset(new SortedFileBuilder(table->_options.block_size,
+                                             table->_options.bloom_bits_per_key, compression));
+    }
+}
+
+Status Table::TableImpl::DumpWriter::add(const ByteArray& key, const ByteArray& value) {
+    return add(key, value.data(), value.size());
+}
+
+Status Table::TableImpl::DumpWriter::add_tombstone(const ByteArray& key) {
+    return add(key, nullptr, TOMBSTONE);
+}
+
+Status Table::TableImpl::DumpWriter::add(const ByteArray& key, const char* value, size_t size) {
+    size_t value_bytes = size == TOMBSTONE ? 0 : size;
+    size_t entry_size = key.size() + value_bytes + sizeof(size_t) * 2;
+    size_t meta_size = _builder ? _builder->meta_size(key.size()) : 0;
+    if (_file.is_open() &&
+            _bytes + static_cast<off_t>(entry_size + meta_size) > _table->_options.max_file_size) {
+        Status s = finish();
+        if (!s.good()) {
+            return s;
+        }
+    }
+
+    if (!_file.is_open()) {
+        Status s = _file.open(_table->file_path(_number, _type) + TEMP_SUFFIX);
+        if (!s.good()) {
+            return s;
+        }
+        ++_number;
+        _bytes = 0;
+    }
+
+    // +--------------------Entry----------------------+
+    // | length of key | key | length of value | value |
+    // +-----------------------------------------------+
+    _buffer.clear();
+    size_t key_size = key.size();
+    _buffer.append(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+    _buffer.append(key.data(), key_size);
+    _buffer.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    _buffer.append(value, value_bytes);
+
+    // the builder holds back the entries of a block to compress
+    if (_builder) {
+        _builder->add(key, &_buffer);
+    }
+    Status s = _file.append(_buffer.data(), _buffer.size());
+    if (!s.good()) {
+        return s;
+    }
+
+    _bytes += entry_size;
+    ++_progress->entries;
+    _progress->bytes += entry_size;
+    if (_callback && _progress->entries % PROGRESS_INTERVAL == 0) {
+        _callback(*_progress);
+    }
+    return Status::ok();
+}
+
+Status Table::TableImpl::DumpWriter::finish() {
+    if (!_file.is_open()) {
+        return Status::ok();
+    }
+
+    if (_builder) {
+        _buffer.clear();
+        _builder->finish(&_buffer);
+        Status s = _file.append(_buffer.data(), _buffer.size());
+        if (!s.good()) {
+            _file.close(false);
+            return s;
+        }
+    }
+
+    // a file only gets its name once it is on disk, so a crash never leaves a torn one
+    Status s = _file.close(true);
+    if (!s.good()) {
+        return s;
+    }
+    std::string path = _table->file_path(_number - 1, _type);
+    if (rename(_file.path().c_str(), path.c_str()) == -1) {
+        return Status::io_error("rename " + _file.path() + " error, " + strerror(errno));
+    }
+    return _table->sync_directory();
+}
+
+void Table::TableImpl::DumpWriter::discard() {
+    _file.close(false);
+    for (uint32_t number = _first_number; number < _number; ++number) {
+        std::string path = _table->file_path(number, _type);
+        remove(path.c_str());
+        remove((path + TEMP_SUFFIX).c_str());
+    }
+}
+
+Status Table::TableImpl::list_files(std::vector<uint32_t>* files) const {
+    auto closedir_func = [](DIR* d) {
+        if (d) {
+            closedir(d);
+        }
+    };
+    std::shared_ptr<DIR> directory(opendir(_name.c_str()), closedir_func);
+    if (directory == nullptr) {
+        return Status::io_error("could not open " + _name + " directory");
+    }
+
+    errno = 0;
+    struct dirent *entry;
+    for (entry = readdir(directory.get()); entry != nullptr; entry = readdir(directory.get())) {
+        // we scan all files in directory
+        uint32_t number;
+        FileType type;
+        if (parse_file_name(entry->d_name, &number, &type)) {
+            files[type].push_back(number);
+        }
+    }
+    if (errno != 0) {
+        return Status::io_error("readdir " + _name + " error, " + strerror(errno));
+    }
+    for (int type = 0; type < FILE_TYPE_NUM; ++type) {
+        std::sort(files[type].begin(), files[type].end());
+    }
+    return Status::ok();
+}
+
+bool Table::TableImpl::parse_file_name(const char* name, uint32_t* number, FileType* type,
+                                       bool* temporary) {
+    for (int i = 0; i < 8; ++i) {
+        if (!isxdigit(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+    }
+    std::string suffix(name + 8);
+    size_t temp_size = strlen(TEMP_SUFFIX);
+    bool temp = suffix.size() >= temp_size &&
+                suffix.compare(suffix.size() - temp_size, temp_size, TEMP_SUFFIX) == 0;
+    if (temp) {
+        if (temporary == nullptr) {
+            return false;
+        }
+        suffix.resize(suffix.size() - temp_size);
+    }
+    if (suffix.empty()) {
+        *type = DUMP_FILE;
+    } else if (suffix == ".delta") {
+        *type = DELTA_FILE;
+    } else if (suffix == ".log" && !temp) {
+        *type = LOG_FILE;
+    } else {
+        return false;
+    }
+    *number = static_cast<uint32_t>(strtoul(std::string(name, 8).c_str(), nullptr, 16));
+    if (temporary) {
+        *temporary = temp;
+    }
+    return true;
+}
+
+void Table::TableImpl::keep_current_files(std::vector<uint32_t>* files) const {
+    std::vector<uint32_t>& dumps = files[DUMP_FILE];
+    dumps.erase(std::remove_if(dumps.begin(), dumps.end(), [this](uint32_t number) {
+        return number < _dump_number || number - _dump_number >= _dump_file_num;
+    }), dumps.end());
+    std::vector<uint32_t>& deltas = files[DELTA_FILE];
+    deltas.erase(std::remove_if(deltas.begin(), deltas.end(), [this](uint32_t number) {
+        return number < _first_delta;
+    }), deltas.end());
+}
+
+Status Table::TableImpl::read_current(std::vector<uint32_t>* files) {
+    std::string path = _name + "/" + CURRENT_FILE;
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        if (errno != ENOENT) {
+            return Status::io_error("open " + path + " error, " + strerror(errno));
+        }
+        // a table written before there was CURRENT uses all of its files
+        const std::vector<uint32_t>& dumps = files[DUMP_FILE];
+        const std::vector<uint32_t>& deltas = files[DELTA_FILE];
+        Status s = write_current(dumps.empty() ? 0 : dumps.front(),
+                                 dumps.empty() ? 0 : dumps.back() - dumps.front() + 1,
+                                 deltas.empty() ? 0 : deltas.front());
+        if (!s.good()) {
+            return s;
+        }
+    } else {
+        unsigned int dump_number, dump_file_num, first_delta;
+        char end;
+        int n = fscanf(file, "%8X %8X %8X%c", &dump_number, &dump_file_num, &first_delta, &end);
+        fclose(file);
+        if (n != 4 || end != '\n') {
+            return Status::io_error("corrupted " + path);
+        }
+        _dump_number = dump_number;
+        _dump_file_num = dump_file_num;
+        _first_delta = first_delta;
+    }
+
+    // the files named by CURRENT must all be there
+    keep_current_files(files);
+    if (files[DUMP_FILE].size() != _dump_file_num) {
+        return Status::io_error("dump files named by " + path + " are missing");
+    }
+    _delta_number = files[DELTA_FILE].empty() ? _first_delta : files[DELTA_FILE].back() + 1;
+    return remove_unused_files();
+}
+
+Status Table::TableImpl::write_current(uint32_t dump_number, uint32_t dump_file_num,
+                                       uint32_t first_delta) {
+    char content[32];
+    int size = snprintf(content, sizeof(content), "%08X %08X %08X\n",
+                        dump_number, dump_file_num, first_delta);
+    std::string path = _name + "/" + CURRENT_FILE;
+    std::string temp = path + TEMP_SUFFIX;
+    FileWriter file(0, false, false);
+    Status s = file.open(temp);
+    if (s.good()) {
+        s = file.append(content, size);
+    }
+    Status close_status = file.close(true);
+    if (s.good()) {
+        s = close_status;
+    }
+    if (!s.good()) {
+        remove(temp.c_str());
+        return s;
+    }
+
+    // the new files are in use from here on, even if the directory can't be synced
+    if (rename(temp.c_str(), path.c_str()) == -1) {
+        return Status::io_error("rename " + temp + " error, " + strerror(errno));
+    }
+    _dump_number = dump_number;
+    _dump_file_num = dump_file_num;
+    _first_delta = first_delta;
+    return sync_directory();
+}
+
+std::string Table::TableImpl::file_path(uint32_t number, FileType type) const {
+    static const char *const suffixes[FILE_TYPE_NUM] = {"", ".delta", ".log"};
+    char name[32];
+    snprintf(name, sizeof(name), "/%08X%s", number, suffixes[type]);
+    return _name + name;
+}
+
+Status Table::TableImpl::sync_directory() const {
+    int fd = ::open(_name.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return Status::io_error("open " + _name + " error, " + strerror(errno));
+    }
+    Status s;
+    if (fsync(fd) == -1) {
+        s = Status::io_error("fsync " + _name + " error, " + strerror(errno));
+    }
+    ::close(fd);
+    return s;
+}
+
+Status Table::TableImpl::switch_log(uint32_t number) {
+    std::unique_ptr<LogWriter> log(new LogWriter(file_path(number, LOG_FILE), _options));
+    Status s = log->open();
+    if (!s.good()) {
+        return s;
+    }
+    if (_log) {
+        s = _log->close();
+        if (!s.good()) {
+            return s;
+        }
+    }
+    _log = std::move(log);
+    _log_number = number;
+    return Status::ok();
+}
+
+Status Table::TableImpl::remove_files(FileType type, uint32_t number) {
+    return remove_files([type, number](uint32_t n, FileType t, bool temporary) {
+        return !temporary && t == type && n < number;
+    });
+}
+
+Status Table::TableImpl::remove_files(const std::function<bool(uint32_t number, FileType type,
+                                                               bool temporary)>& unused) {
+    auto closedir_func = [](DIR* d) {
+        if (d) {
+            closedir(d);
+        }
+    };
+    std::shared_ptr<DIR> directory(opendir(_name.c_str()), closedir_func);
+    if (directory == nullptr) {
+        return Status::io_error("could not open " + _name + " directory");
+    }
+
+    struct dirent *entry;
+    for (entry = readdir(directory.get()); entry != nullptr; entry = readdir(directory.get())) {
+        uint32_t n;
+        FileType t;
+        bool temporary;
+        if (parse_file_name(entry->d_name, &n, &t, &temporary) && unused(n, t, temporary)) {
+            std::string path = _name + "/" + entry->d_name;
+            if (remove(path.c_str()) == -1) {
+                return Status::io_error("remove " + path + " error, " + strerror(errno));
+            }
+        }
+    }
+    return Status::ok();
+}
+
+Status Table::TableImpl::remove_unused_files() {
+    return remove_files([this](uint32_t number, FileType type, bool temporary) {
+        switch (type) {
+        case DUMP_FILE:
+            return temporary || number < _dump_number || number - _dump_number >= _dump_file_num;
+        case DELTA_FILE:
+            return temporary || number < _first_delta;
+        default:
+            return false;
         }
-        ++split_num;
+    });
+}
+
+Status Table::TableImpl::memory_usage(MemoryUsage* usage) {
+    if (_is_closed) {
+        return Status::invalid_operation("Table is closed");
     }
 
+    SkipList::Usage list_usage;
+    _skiplist.usage(&list_usage);
+    usage->entries = list_usage.entries;
+    usage->key_bytes = list_usage.key_bytes;
+    usage->value_bytes = list_usage.value_bytes;
+    usage->overhead_bytes = list_usage.overhead_bytes;
+
+    MemoryPool::Usage pool_usage;
+    _pool.usage(&pool_usage);
+    usage->pool_bytes = pool_usage.system_bytes;
+    usage->free_bytes.assign(pool_usage.free_bytes, pool_usage.free_bytes + MemoryPool::NCLASS);
+    usage->reclaim_pending_bytes = pool_usage.reclaim_pending_bytes;
+
+    usage->mapped_bytes = _mapped_bytes.load(std::memory_order_relaxed);
+    auto files = sorted_files();
+    if (files) {
+        usage->mapped_bytes += files->size();
+    }
     return Status::ok();
 }
 
@@ -248,13 +1428,60 @@ Status Table::TableImpl::get(const ByteArray& key, std::string* value) {
         return Status::invalid_operation("Table is closed");
     }
 
+    EpochGuard epoch_guard(&_epoch);
     auto it = _skiplist.lookup(key);
-    if (!it.good()) {
-        return Status::not_found();
+    ByteArray v;
+    if (it.good()) {
+        v = it.value();
+    } else {
+        std::shared_ptr<const SortedFileSet> files = sorted_files();
+        if (!get_from_files(files.get(), key, &v)) {
+            return Status::not_found();
+        }
     }
 
     if (value != nullptr) {
-        value->assign(it.value().data(), it.value().size());
+        value->assign(v.data(), v.size());
+    }
+    return Status::ok();
+}
+
+Status Table::TableImpl::multi_get(const std::vector<ByteArray>& keys,
+                                  std::vector<std::string>* values,
+                                  std::vector<Status>* statuses) {
+    if (_is_closed) {
+        return Status::invalid_operation("Table is closed");
+    }
+
+    EpochGuard epoch_guard(&_epoch);
+    std::vector<SkipList::Iterator> its(keys.size());
+    _skiplist.lookup(keys.data(), keys.size(), its.data());
+
+    if (values != nullptr) {
+        values->resize(keys.size());
+    }
+    if (statuses != nullptr) {
+        statuses->resize(keys.size());
+    }
+    std::shared_ptr<const SortedFileSet> files = sorted_files();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ByteArray v;
+        bool found = its[i].good();
+        if (found) {
+            v = its[i].value();
+        } else {
+            found = get_from_files(files.get(), keys[i], &v);
+        }
+        if (statuses != nullptr) {
+            (*statuses)[i] = found ? Status::ok() : Status::not_found();
+        }
+        if (values != nullptr) {
+            if (found) {
+                (*values)[i].assign(v.data(), v.size());
+            } else {
+                (*values)[i].clear();
+            }
+        }
     }
     return Status::ok();
 }
@@ -269,23 +1496,291 @@ Status Table::TableImpl::put(const ByteArray& key, const ByteArray& value) {
         return Status::invalid_operation("size of entry is too large");
     }
 
-    auto it = _skiplist.insert(key, value);
-    if (!it.good()) {
-        _skiplist.update(key, value);
+    reserve_index(1);
+    SharedLockGuard guard(&_write_lock);
+    auto change = [this, &key, &value]() {
+        _skiplist.upsert(key, value);
+        undelete_from_files(key);
+    };
+    if (_log) {
+        // concurrent puts of a key are applied in the order they are logged
+        std::string body;
+        LogWriter::encode_put(&body, key, value);
+        return _log->add_record(body, change);
     }
+    change();
 
     return Status::ok();
 }
 
+void Table::TableImpl::reserve_index(size_t n) {
+    if (!_skiplist.index_has_room(n)) {
+        ExclusiveLockGuard guard(&_write_lock);
+        _skiplist.reserve_index(n);
+    }
+}
+
 Status Table::TableImpl::del(const ByteArray& key) {
     if (_is_closed) {
         return Status::invalid_operation("Table is closed");
     }
 
-    if (_skiplist.remove(key)) {
-        return Status::ok();
+    ExclusiveLockGuard guard(&_write_lock);
+    bool found = false;
+    auto change = [this, &key, &found]() {
+        // readers that miss the skiplist find the key deleted from the files first
+        bool in_files = delete_from_files(key);
+        found = _skiplist.remove(key) || in_files;
+        if (found && _options.incremental_dump) {
+            _deleted_keys.push_back(std::string(key.data(), key.size()));
+        }
+    };
+    if (_log) {
+        std::string body;
+        LogWriter::encode_del(&body, key);
+        Status s = _log->add_record(body, change);
+        if (!s.good()) {
+            return s;
+        }
+    } else {
+        change();
+    }
+    return found ? Status::ok() : Status::not_found();
+}
+
+// With options.out_of_core, the entries of the skiplist are merged with those of the files,
+// the skiplist wins on equal keys and deleted keys of the files are skipped.
+// Moving forward, the side that is not current is at the first entry after the current one,
+// moving backward at the last entry before it.
+class Table::Iterator::IteratorImpl {
+TABLE_PUBLIC:
+    explicit IteratorImpl(TableImpl* table) :
+        _table(table), _epoch_guard(&table->_epoch), _files(table->acquire_files(&_generation)),
+        _file_it(_files.get()), _forward(true), _on_skiplist(true) {  }
+    ~IteratorImpl() {
+        if (_files) {
+            _table->release_files(_generation);
+        }
+    }
+
+    bool valid() const {
+        return !_table->_is_closed && (_on_skiplist ? _it.good() : _file_it.valid());
+    }
+
+    void seek(const ByteArray& key) {
+        _it = _table->_skiplist.seek(key);
+        if (_files) {
+            _file_it.seek(key);
+            settle(true);
+        }
+    }
+
+    void seek_to_first() {
+        _it = _table->_skiplist.begin();
+        if (_files) {
+            _file_it.seek_to_first();
+            settle(true);
+        }
+    }
+
+    void seek_to_last() {
+        _it = _table->_skiplist.last();
+        if (_files) {
+            _file_it.seek_to_last();
+            settle(false);
+        }
+    }
+
+    void seek_for_prev(const ByteArray& key) {
+        _it = _table->_skiplist.seek_for_prev(key);
+        if (_files) {
+            _file_it.seek_for_prev(key);
+            settle(false);
+        }
+    }
+
+    void next() {
+        if (!_files) {
+            _it.next();
+            return;
+        }
+        if (!_forward) {
+            // move the other side past the current key
+            ByteArray current = key();
+            if (_on_skiplist) {
+                _file_it.seek(current);
+                if (_file_it.valid() && compare(_file_it.key(), current) == 0) {
+                    _file_it.next();
+                }
+            } else {
+                _it = _table->_skiplist.seek(current);
+                if (_it.good() && compare(_it.key(), current) == 0) {
+                    _it.next();
+                }
+            }
+        }
+        if (_on_skiplist) {
+            _it.next();
+        } else {
+            _file_it.next();
+        }
+        settle(true);
+    }
+
+    void prev() {
+        if (!_files) {
+            _it.prev();
+            return;
+        }
+        if (_forward) {
+            ByteArray current = key();
+            if (_on_skiplist) {
+                _file_it.seek_for_prev(current);
+                if (_file_it.valid() && compare(_file_it.key(), current) == 0) {
+                    _file_it.prev();
+                }
+            } else {
+                _it = _table->_skiplist.seek_for_prev(current);
+                if (_it.good() && compare(_it.key(), current) == 0) {
+                    _it.prev();
+                }
+            }
+        }
+        if (_on_skiplist) {
+            _it.prev();
+        } else {
+            _file_it.prev();
+        }
+        settle(false);
+    }
+
+    ByteArray key() const {
+        return _on_skiplist ? _it.key() : _file_it.key();
+    }
+
+    ByteArray value() const {
+        return _on_skiplist ? _it.value() : _file_it.value();
+    }
+
+    // Non-copying
+    IteratorImpl(const IteratorImpl&) = delete;
+    IteratorImpl& operator=(const IteratorImpl&) = delete;
+
+TABLE_PRIVATE:
+    int compare(const ByteArray& lhs, const ByteArray& rhs) const {
+        return _table->_options.comparator->compare(lhs, rhs);
+    }
+
+    // skip the entries of the files that are deleted or in the skiplist,
+    // and pick the side of the next entry in the direction
+    void settle(bool forward) {
+        _forward = forward;
+        while (_file_it.valid()) {
+            if (_it.good() && compare(_it.key(), _file_it.key()) == 0) {
+                // the skiplist holds the newer entry
+            } else if (!_table->deleted_from_files(_file_it.key())) {
+                break;
+            }
+            if (forward) {
+                _file_it.next();
+            } else {
+                _file_it.prev();
+            }
+        }
+        if (!_file_it.valid()) {
+            _on_skiplist = true;
+        } else if (!_it.good()) {
+            _on_skiplist = false;
+        } else {
+            int c = compare(_it.key(), _file_it.key());
+            _on_skiplist = forward ? c < 0 : c > 0;
+        }
+    }
+
+    TableImpl          *_table;
+    // nodes we point at are not reclaimed while the epoch is pinned
+    EpochGuard          _epoch_guard;
+    SkipList::Iterator  _it;
+    // the files we point into stay mapped while we hold them,
+    // and the nodes written into newer files stay in the skiplist
+    uint64_t                             _generation;
+    std::shared_ptr<const SortedFileSet> _files;
+    SortedFileSet::Iterator              _file_it;
+    bool                _forward;
+    bool                _on_skiplist;
+};
+
+Table::Iterator::Iterator(Table* table) : _impl(new IteratorImpl(table->_impl)) {  }
+Table::Iterator::~Iterator() { delete _impl; }
+bool Table::Iterator::valid() const { return _impl->valid(); }
+void Table::Iterator::seek(const ByteArray& key) { _impl->seek(key); }
+void Table::Iterator::seek_to_first() { _impl->seek_to_first(); }
+void Table::Iterator::seek_to_last() { _impl->seek_to_last(); }
+void Table::Iterator::seek_for_prev(const ByteArray& key) { _impl->seek_for_prev(key); }
+void Table::Iterator::next() { _impl->next(); }
+void Table::Iterator::prev() { _impl->prev(); }
+ByteArray Table::Iterator::key() const { return _impl->key(); }
+ByteArray Table::Iterator::value() const { return _impl->value(); }
+
+Status Table::TableImpl::write(const WriteBatch& batch) {
+    if (_is_closed) {
+        return Status::invalid_operation("Table is closed");
+    }
+
+    bool has_del = false;
+    for (size_t i = 0; i < batch.count(); ++i) {
+        if (batch.type(i) == WriteBatch::DEL) {
+            has_del = true;
+            continue;
+        }
+        size_t entry_size = batch.key(i).size() + batch.value(i).size() + sizeof(size_t) * 2;
+        if (static_cast<off_t>(entry_size) > _options.max_file_size) {
+            return Status::invalid_operation("size of entry is too large");
+        }
+    }
+
+    reserve_index(batch.count());
+    std::unique_ptr<SharedLockGuard> shared_guard;
+    std::unique_ptr<ExclusiveLockGuard> exclusive_guard;
+    if (has_del) {
+        exclusive_guard.reset(new ExclusiveLockGuard(&_write_lock));
     } else {
-        return Status::not_found();
+        shared_guard.reset(new SharedLockGuard(&_write_lock));
+    }
+
+    if (_log) {
+        std::string body;
+        LogWriter::encode(&body, batch);
+        return _log->add_record(body, [this, &batch]() { apply(batch); });
+    }
+    apply(batch);
+
+    return Status::ok();
+}
+
+void Table::TableImpl::apply(const WriteBatch& batch) {
+    // sort the records by key so every search resumes from the previous one,
+    // the sort is stable and the last record of a key wins
+    std::vector<size_t> order(batch.count());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    Comparator *cmp = _options.comparator;
+    std::stable_sort(order.begin(), order.end(), [&batch, cmp](size_t lhs, size_t rhs) {
+        return cmp->compare(batch.key(lhs), batch.key(rhs)) < 0;
+    });
+
+    SkipList::Finger finger(&_skiplist);
+    for (size_t i : order) {
+        if (batch.type(i) == WriteBatch::PUT) {
+            _skiplist.upsert(batch.key(i), batch.value(i), &finger);
+            undelete_from_files(batch.key(i));
+            continue;
+        }
+        bool in_files = delete_from_files(batch.key(i));
+        if ((_skiplist.remove(batch.key(i), &finger) || in_files) && _options.incremental_dump) {
+            _deleted_keys.push_back(std::string(batch.key(i).data(), batch.key(i).size()));
+        }
     }
 }
 
@@ -295,8 +1790,17 @@ Table::~Table() { delete _impl; }
 Status Table::open() { return _impl->open(); }
 Status Table::close() { return _impl->close(); }
 Status Table::dump() { return _impl->dump(); }
+Status Table::full_dump() { return _impl->full_dump(); }
+Status Table::dump_async(const DumpCallback& callback) { return _impl->dump_async(callback); }
+Status Table::verify() { return _impl->verify(); }
+Status Table::memory_usage(MemoryUsage* usage) { return _impl->memory_usage(usage); }
 Status Table::get(const ByteArray& key, std::string* value) { return _impl->get(key, value); }
+Status Table::multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                        std::vector<Status>* statuses) {
+    return _impl->multi_get(keys, values, statuses);
+}
 Status Table::put(const ByteArray& key, const ByteArray& value) { return _impl->put(key, value); }
 Status Table::del(const ByteArray& key) { return _impl->del(key); }
+Status Table::write(const WriteBatch& batch) { return _impl->write(batch); }
 
 } // namespace table
\ No newline at end of file
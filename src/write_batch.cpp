@@ -0,0 +1,44 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "write_batch.h"
+
+namespace table {
+
+WriteBatch::WriteBatch() {  }
+WriteBatch::~WriteBatch() {  }
+
+void WriteBatch::put(const ByteArray& key, const ByteArray& value) {
+    _records.push_back(Record{PUT, _rep.size(), key.size(), value.size()});
+    _rep.append(key.data(), key.size());
+    _rep.append(value.data(), value.size());
+}
+
+void WriteBatch::del(const ByteArray& key) {
+    _records.push_back(Record{DEL, _rep.size(), key.size(), 0});
+    _rep.append(key.data(), key.size());
+}
+
+void WriteBatch::clear() {
+    _rep.clear();
+    _records.clear();
+}
+
+size_t WriteBatch::count() const {
+    return _records.size();
+}
+
+WriteBatch::Type WriteBatch::type(size_t i) const {
+    return _records[i].type;
+}
+
+ByteArray WriteBatch::key(size_t i) const {
+    return ByteArray(_rep.data() + _records[i].offset, _records[i].key_size);
+}
+
+ByteArray WriteBatch::value(size_t i) const {
+    return ByteArray(_rep.data() + _records[i].offset + _records[i].key_size, _records[i].value_size);
+}
+
+} // namespace table
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -32,13 +33,18 @@
 #endif
 
 #include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <deque>
 #include <atomic>
 #include <chrono>
 #include <vector>
 #include <memory>
 #include <sstream>
+#include <functional>
 #include <algorithm>
 #include <unordered_set>
+#include <unordered_map>
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// Codecs of the blocks of dump files.
+//
+// Options::LZ_COMPRESSION is built in, a byte-oriented LZ77 in the spirit of lz4.
+// The compressed data is a sequence of
+// +----------------------------------Sequence-----------------------------------+
+// | token | length of literals | literals | offset | length of match            |
+// +-----------------------------------------------------------------------------+
+// where the high 4 bits of token are the length of literals and the low 4 bits the length
+// of match minus MIN_MATCH, a 15 is continued by bytes that are added up to a byte below 255.
+// offset is 2 bytes little-endian, the match copies the bytes that many bytes back.
+// The last sequence has literals only.
+//
+// zstd and lz4 are used if they were found at build time, see CMakeLists.txt.
+
+#ifndef TABLE_COMPRESSION_H
+#define TABLE_COMPRESSION_H
+
+#include "common.h"
+#include "options.h"
+
+namespace table {
+
+// Returns false if "type" is not available in this build.
+bool compression_supported(Options::Compression type);
+
+// Append "in" compressed with "type" to *out.
+// Returns false on failure.
+bool compress(Options::Compression type, const char* in, size_t size, std::string* out);
+
+// Decompress "in" into the "raw_size" bytes at "out".
+// Returns false if "in" is not the compressed form of exactly "raw_size" bytes.
+bool decompress(Options::Compression type, const char* in, size_t size,
+                char* out, size_t raw_size);
+
+} // namespace table
+
+#endif
@@ -0,0 +1,35 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// CRC32C (Castagnoli) checksums of dump files, computed with the crc32 instruction
+// of SSE4.2 if the CPU has it, by tables otherwise.
+
+#ifndef TABLE_CRC32C_H
+#define TABLE_CRC32C_H
+
+#include "common.h"
+
+namespace table {
+namespace crc32c {
+
+// Returns the crc32c of the concatenation of A and data[0, n-1], where "crc" is the crc32c of A.
+uint32_t extend(uint32_t crc, const char* data, size_t n);
+
+// Returns the crc32c of data[0, n-1].
+inline uint32_t value(const char* data, size_t n) {
+    return extend(0, data, n);
+}
+
+// Returns true if extend() runs on the crc32 instruction.
+bool accelerated();
+
+// The implementations extend() chooses from, by tables and by the crc32 instruction.
+// REQUIRES: accelerated() for extend_hardware()
+uint32_t extend_software(uint32_t crc, const char* data, size_t n);
+uint32_t extend_hardware(uint32_t crc, const char* data, size_t n);
+
+} // namespace crc32c
+} // namespace table
+
+#endif
@@ -0,0 +1,86 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// Epoch based memory reclamation.
+//
+// Readers pin the current global epoch while they may hold pointers into shared memory,
+// and writers tag every retired block with the global epoch at the time it was retired.
+// The global epoch only advances when no reader is pinned at an older epoch,
+// so a block retired at epoch e can be reused once the global epoch reaches e + 2.
+//
+// Pinned readers are counted per epoch (modulo 3) in striped counters,
+// entering and leaving costs an atomic increment and decrement on a mostly private cache line.
+
+#ifndef TABLE_EPOCH_H
+#define TABLE_EPOCH_H
+
+#include "common.h"
+
+namespace table {
+
+class Epoch {
+TABLE_PUBLIC:
+    enum {
+        NSTRIPE       = 16,
+    };
+
+    Epoch();
+    ~Epoch() = default;
+
+    // Pin the current epoch, returns a token for leave().
+    uint64_t enter();
+
+    // Unpin the epoch returned by enter().
+    void leave(uint64_t token);
+
+    // Returns the global epoch.
+    uint64_t current() const;
+
+    // Returns true if a block retired at "epoch" can be reused.
+    bool reclaimable(uint64_t epoch) const;
+
+    // Advance the global epoch if no reader is pinned at an older epoch.
+    // Returns true on success.
+    bool try_advance();
+
+    // Returns the stripe in [0, NSTRIPE) of the calling thread, threads take them in turn.
+    static int stripe();
+
+    // Non-copying
+    Epoch(const Epoch&) = delete;
+    Epoch& operator=(const Epoch&) = delete;
+
+TABLE_PRIVATE:
+    enum {
+        NSLOT         = 3,
+        CACHE_LINE    = 64,
+    };
+
+    // padded to a cache line, so stripes don't share lines
+    struct Counter {
+        std::atomic<int64_t> n;
+        char pad[CACHE_LINE - sizeof(std::atomic<int64_t>)];
+    };
+
+    std::atomic<uint64_t> _epoch;
+    Counter _readers[NSLOT][NSTRIPE];
+};
+
+class EpochGuard {
+TABLE_PUBLIC:
+    explicit EpochGuard(Epoch* epoch) : _epoch(epoch), _token(epoch->enter()) {  }
+    ~EpochGuard() { _epoch->leave(_token); }
+
+    // Non-copying
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+TABLE_PRIVATE:
+    Epoch    *_epoch;
+    uint64_t  _token;
+};
+
+} // namespace table
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// Sequential writer of dump files.
+// Appends are gathered in a buffer and written out a buffer at a time,
+// appends larger than the buffer go out with it in one writev() without being copied.
+
+#ifndef TABLE_FILE_WRITER_H
+#define TABLE_FILE_WRITER_H
+
+#include "common.h"
+#include "status.h"
+
+namespace table {
+
+class FileWriter {
+TABLE_PUBLIC:
+    enum {
+        // O_DIRECT writes whole blocks of it from memory aligned to it
+        DIRECT_IO_ALIGNMENT = 4096,
+        // with drop_cache, writeback is started every that many bytes
+        DROP_CACHE_INTERVAL = 8 * 1024 * 1024,
+    };
+
+    // Appends are written "buffer_size" bytes at a time, 0 writes every append() on its own.
+    // With "direct_io" the file is written with O_DIRECT if the file system supports it,
+    // which needs a buffer. With "drop_cache" the pages written are dropped from the page cache
+    // as the file grows, on Linux.
+    FileWriter(size_t buffer_size, bool direct_io, bool drop_cache);
+    ~FileWriter();
+
+    // Create or truncate the file at "path".
+    Status open(const std::string& path);
+
+    Status append(const char* data, size_t size);
+
+    // Write out the buffer and close the file, synced to disk if "sync" is true.
+    Status close(bool sync);
+
+    bool is_open() const { return _fd != -1; }
+    const std::string& path() const { return _path; }
+
+    // Non-copying
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+TABLE_PRIVATE:
+    Status write(struct iovec* iov, int iovcnt);
+    Status flush();
+    // start writeback of the bytes written since the last call,
+    // and drop those of the call before once they are on disk
+    void drop_cache();
+
+    size_t       _buffer_size;
+    bool         _direct_io;
+    bool         _drop_cache;
+    int          _fd;
+    // the file was opened with O_DIRECT
+    bool         _direct;
+    std::string  _path;
+    std::unique_ptr<char, void(*)(void*)> _buffer;
+    size_t       _buffered;
+    // bytes written to the file, handed to writeback and dropped from the page cache
+    off_t        _written;
+    off_t        _writeback;
+    off_t        _dropped;
+};
+
+} // namespace table
+
+#endif
@@ -0,0 +1,99 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// Write-ahead log of the writes applied since the last dump.
+// Writers that arrive while a record is being written are committed together,
+// so they share one write() and one fdatasync(), and their records are applied
+// in the order they are logged.
+//
+// A log starts with the 8 bytes of LOG_MAGIC and is followed by records
+// +------------------------Record-------------------------+
+// | crc32c of the length and the body | length of body | body |
+// +-------------------------------------------------------+
+// Logs written before there were checksums have no magic and records without the crc32c.
+//
+// The body is a sequence of entries
+// +------------------------------Entry-------------------------------+
+// | type | length of key | key | length of value | value            |
+// +------------------------------------------------------------------+
+// where type is a single byte of WriteBatch::Type.
+
+#ifndef TABLE_LOG_H
+#define TABLE_LOG_H
+
+#include "common.h"
+#include "status.h"
+#include "options.h"
+#include "byte_array.h"
+#include "write_batch.h"
+
+namespace table {
+
+extern const char LOG_MAGIC[8];
+
+class LogWriter {
+TABLE_PUBLIC:
+    LogWriter(const std::string& path, const Options& options);
+    ~LogWriter();
+
+    Status open();
+    Status close();
+
+    // Append the entries to "body".
+    static void encode_put(std::string* body, const ByteArray& key, const ByteArray& value);
+    static void encode_del(std::string* body, const ByteArray& key);
+    static void encode(std::string* body, const WriteBatch& batch);
+
+    // Append a record and wait until it was written,
+    // and synced if the sync mode is Options::WAL_SYNC_PER_WRITE.
+    // Then "apply" is called, on the thread that wrote the group of the record,
+    // after those of the records before it, so the table changes in the order of the log.
+    // Once a write failed, the log refuses all later records and applies none.
+    Status add_record(const std::string& body, const std::function<void()>& apply);
+
+    // Non-copying
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator=(const LogWriter&) = delete;
+
+TABLE_PRIVATE:
+    struct Writer {
+        Writer(const std::string* body, uint32_t crc, const std::function<void()>* apply) :
+            body(body), crc(crc), apply(apply), done(false) {  }
+
+        const std::string       *body;
+        uint32_t                 crc;
+        const std::function<void()> *apply;
+        bool                     done;
+        Status                   status;
+        std::condition_variable  cv;
+    };
+
+    Status write_buffer();
+    void sync_loop();
+
+    std::string              _path;
+    Options::WalSync         _sync;
+    int                      _sync_interval_msec;
+    int                      _fd;
+    // sticky error of the first failed write, the tail of the file is undefined after it
+    Status                   _status;
+
+    std::mutex               _mutex;
+    std::deque<Writer*>      _writers;
+    // records of a group, only the writer at the front touches it
+    std::string              _buffer;
+
+    // background fdatasync() of Options::WAL_SYNC_INTERVAL
+    std::thread              _sync_thread;
+    std::condition_variable  _sync_cv;
+    bool                     _closing;
+};
+
+// Call "apply" with the entries of every complete record in the log at "path", in order.
+// Replay stops at the first torn or corrupted record, left by a crash in the middle of a write.
+Status read_log(const std::string& path, const std::function<void(const WriteBatch&)>& apply);
+
+} // namespace table
+
+#endif
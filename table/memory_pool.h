@@ -6,45 +6,174 @@
 #define TABLE_POOL_H
 
 #include "common.h"
+#include "epoch.h"
 
 namespace table {
 
+// All public methods are thread-safe.
+//
+// dealloc() retires a block at the current epoch,
+// the block is reused once no reader pinned at that epoch can still see it.
+//
+// Small blocks are carved from SLAB_SIZE slabs, each holding blocks of one size class.
+// A slab counts its blocks handed out, those retired or held by a cache included,
+// and once the last of them is reclaimed the slab is either kept for its size class,
+// as long as the empty slabs kept stay within "max_retained" bytes, or unmapped.
+//
+// Threads allocate and retire small blocks in one of NCACHE caches without taking
+// the pool mutex, a cache takes TRANSFER_BATCH blocks at a time from the slabs
+// and hands them back as many at a time when it holds more than CACHE_LIMIT of a size class.
+//
+// With "huge_pages", slabs and arena chunks are mapped on HUGE_PAGE_SIZE pages,
+// a slab then takes a whole huge page.
+//
+// In arena mode, blocks are carved from ARENA_CHUNK_SIZE chunks by bumping a pointer,
+// nothing is tracked per block and dealloc() of a block is a no-op, the chunks are freed
+// together by the destructor. Blocks larger than ARENA_MAX_BLOCK_SIZE are still
+// allocated and retired one by one.
 class MemoryPool {
 TABLE_PUBLIC:
-    explicit MemoryPool(int ttl_msec);
+    enum {
+        DEFAULT_MAX_RETAINED = 16 * 1024 * 1024,
+        ALIGN          = 8,
+        MAX_BLOCK_SIZE = 256,
+        // small blocks are of size classes ALIGN, 2 * ALIGN, ... MAX_BLOCK_SIZE
+        NCLASS         = MAX_BLOCK_SIZE / ALIGN,
+    };
+
+    // Memory held by the pool.
+    struct Usage {
+        // slabs, arena chunks and large blocks taken from the system
+        size_t system_bytes;
+        // blocks ready to be handed out per size class, in the slabs and the caches
+        size_t free_bytes[NCLASS];
+        // blocks retired while readers may still see them
+        size_t reclaim_pending_bytes;
+    };
+
+    explicit MemoryPool(Epoch* epoch, bool arena = false,
+                        size_t max_retained = DEFAULT_MAX_RETAINED, bool huge_pages = false);
     ~MemoryPool();
 
     char* alloc(size_t size);
     void  dealloc(char* p, size_t size);
     char* dup(const char* p, size_t size);
 
+    // Takes the pool mutex and the mutex of each cache in turn, briefly.
+    void usage(Usage* usage);
+
+    // Blocks freed are reused once the readers pinned in this epoch are gone.
+    Epoch* epoch() const { return _epoch; }
+
     // Non-copying
     MemoryPool(const MemoryPool&) = delete;
     MemoryPool& operator=(const MemoryPool&) = delete;
 
 TABLE_PRIVATE:
     struct Block {
-        char   *addr;
-        std::chrono::time_point<std::chrono::steady_clock>  expire_at;
+        char     *addr;
+        uint64_t  epoch;
     };
 
     enum {
-        ALIGN          = 8,
-        MAX_BLOCK_SIZE = 256,
+        // try to advance the epoch every ADVANCE_INTERVAL deallocations,
+        // or allocations that find a cache waiting on it
+        ADVANCE_INTERVAL = 64,
+        // a multiple of HUGE_PAGE_SIZE
+        ARENA_CHUNK_SIZE     = 4 * 1024 * 1024,
+        ARENA_MAX_BLOCK_SIZE = ARENA_CHUNK_SIZE / 4,
+        // slabs are aligned to their size, so a block finds its slab by masking its address
+        SLAB_SIZE        = 64 * 1024,
+        HUGE_PAGE_SIZE   = 2 * 1024 * 1024,
+        SLAB_HEADER_SIZE = 64,
+        NCACHE           = 16,
+        CACHE_LINE       = 64,
+        // blocks moved between a cache and the slabs at a time
+        TRANSFER_BATCH   = 20,
+        // blocks of a size class a cache holds before handing some back
+        CACHE_LIMIT      = 4 * TRANSFER_BATCH,
+    };
+
+    static constexpr uint64_t NO_EPOCH = UINT64_MAX;
+
+    struct Cache {
+        std::mutex        mutex;
+        size_t            ndealloc;
+        // allocations that found the oldest block still pending
+        size_t            npending;
+        // blocks ready for use first, then blocks retired at increasing epochs
+        std::deque<Block> blocks[NCLASS];
+        // keep the caches off each other's cache lines
+        char              pad[CACHE_LINE];
+    };
+
+    // at the start of every slab
+    struct Slab {
+        // in the list of slabs of its size class with free blocks
+        Slab     *prev;
+        Slab     *next;
+        // reclaimed blocks, linked through their first bytes and reused in the order freed
+        char     *free_head;
+        char     *free_tail;
+        // blocks from here on were never handed out
+        char     *unused;
+        uint32_t  size;
+        // blocks handed out and not yet reclaimed
+        uint32_t  used;
+        bool      listed;
+    };
+
+    struct ArenaChunk {
+        char                *addr;
+        std::atomic<size_t>  used;
     };
 
-    int _ttl_msec;
-    // we align all size to ALIGN
-    std::deque<Block> _block_queue[MAX_BLOCK_SIZE / ALIGN];
+    Epoch *_epoch;
+    size_t _ndealloc;
+    std::mutex _mutex;
+    bool _arena;
+    bool _huge_pages;
+    size_t _slab_size;
+    // the chunk blocks are carved from, replaced under _mutex once full
+    std::atomic<ArenaChunk*> _arena_chunk;
+    std::vector<std::unique_ptr<ArenaChunk>> _arena_chunks;
+    size_t _max_retained;
+    // bytes of empty slabs kept
+    size_t _retained;
+    // slabs with free blocks per size class, we align all size to ALIGN
+    Slab *_slab_head[NCLASS];
+    Slab *_slab_tail[NCLASS];
+    std::unordered_set<Slab*> _slabs;
+    // small blocks handed back by the caches, then retired large blocks, in the order retired
+    std::queue<Block> _block_retired;
     std::queue<Block> _block_persist;
-    std::unordered_set<char*> _blocks;
+    // epoch of the oldest block in _block_retired and _block_persist, or NO_EPOCH
+    std::atomic<uint64_t> _reclaim_epoch;
+    // large blocks and their size
+    std::unordered_map<char*, size_t> _blocks;
+    // blocks in the slabs not handed out per size class, and bytes in the queues above
+    size_t _free_blocks[NCLASS];
+    size_t _retired_bytes;
+    size_t _persist_bytes;
+    size_t _large_bytes;
+    Cache _caches[NCACHE];
 
+    char* alloc_arena(size_t size);
     char* alloc_small(size_t size);
+    // a block of "size" from the slabs, with _mutex held
+    char* take_block(size_t size);
     char* alloc_large(size_t size);
     void dealloc_small(char* p, size_t size);
     void dealloc_large(char* p, size_t size);
-    void refill(std::deque<Block>* que, size_t size);
-    void free_expired_block();
+    // number of blocks of "size" a slab holds
+    size_t slab_capacity(size_t size) const;
+    Slab* new_slab(size_t size);
+    void release_slab(Slab* slab);
+    void link_slab(Slab* slab);
+    void unlink_slab(Slab* slab);
+    void free_reclaimable_block();
+    // with _mutex held, after _block_retired or _block_persist changed
+    void update_reclaim_epoch();
 };
 
 } // namespace table
@@ -0,0 +1,69 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// A thin wrapper of pthread_rwlock_t, since C++11 has no shared mutex.
+// Writers are preferred where the platform supports it, so an exclusive
+// writer is not starved by a steady stream of shared writers.
+
+#ifndef TABLE_RWLOCK_H
+#define TABLE_RWLOCK_H
+
+#include "common.h"
+
+namespace table {
+
+class RWLock {
+TABLE_PUBLIC:
+    RWLock() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#if defined(__linux__) && defined(__GLIBC__)
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&_lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+    ~RWLock() { pthread_rwlock_destroy(&_lock); }
+
+    void lock_shared() { pthread_rwlock_rdlock(&_lock); }
+    void lock() { pthread_rwlock_wrlock(&_lock); }
+    void unlock() { pthread_rwlock_unlock(&_lock); }
+
+    // Non-copying
+    RWLock(const RWLock&) = delete;
+    RWLock& operator=(const RWLock&) = delete;
+
+TABLE_PRIVATE:
+    pthread_rwlock_t _lock;
+};
+
+class SharedLockGuard {
+TABLE_PUBLIC:
+    explicit SharedLockGuard(RWLock* lock) : _lock(lock) { _lock->lock_shared(); }
+    ~SharedLockGuard() { _lock->unlock(); }
+
+    // Non-copying
+    SharedLockGuard(const SharedLockGuard&) = delete;
+    SharedLockGuard& operator=(const SharedLockGuard&) = delete;
+
+TABLE_PRIVATE:
+    RWLock *_lock;
+};
+
+class ExclusiveLockGuard {
+TABLE_PUBLIC:
+    explicit ExclusiveLockGuard(RWLock* lock) : _lock(lock) { _lock->lock(); }
+    ~ExclusiveLockGuard() { _lock->unlock(); }
+
+    // Non-copying
+    ExclusiveLockGuard(const ExclusiveLockGuard&) = delete;
+    ExclusiveLockGuard& operator=(const ExclusiveLockGuard&) = delete;
+
+TABLE_PRIVATE:
+    RWLock *_lock;
+};
+
+} // namespace table
+
+#endif
@@ -5,6 +5,9 @@
 #ifndef TABLE_SKIPLIST_H
 #define TABLE_SKIPLIST_H
 
+#include <map>
+#include <unordered_map>
+
 #include "common.h"
 #include "random.h"
 #include "byte_array.h"
@@ -18,51 +21,160 @@ TABLE_PRIVATE:
     struct Node;
 
 TABLE_PUBLIC:
+    class Finger;
+    class Run;
+
     class Iterator {
     TABLE_PUBLIC:
         Iterator();
-        Iterator(Node* node);
+        Iterator(SkipList* list, Node* node);
         ~Iterator();
 
         // Returns true if the iterator point to a valid node.
-        bool good();
+        bool good() const;
 
         // Advances to the next position.
         // REQUIRES: good()
         void next();
 
+        // Moves to the previous position.
+        // REQUIRES: good()
+        void prev();
+
         // Returns the key at the current position.
         // REQUIRES: good()
-        const ByteArray& key();
+        ByteArray key() const;
 
         // Returns the value at the current position.
         // REQUIRES: good()
-        const ByteArray& value();
+        ByteArray value() const;
+
+        // Returns the version of the last insert or update of the current node.
+        // REQUIRES: good()
+        uint64_t version() const;
     TABLE_PRIVATE:
-        Node  *_node;
+        SkipList  *_list;
+        Node      *_node;
     };
 
-    SkipList(Comparator* cmp, MemoryPool *pool);
+    // With hash_index, a hash index from key to node is kept for lookup(),
+    // it requires that cmp considers keys equal only if their bytes are equal.
+    SkipList(Comparator* cmp, MemoryPool *pool, bool hash_index = false);
     ~SkipList() = default;
 
     // Returns a iterator point to the first node.
     Iterator begin();
 
+    // Returns a iterator point to the last node.
+    Iterator last();
+
+    // Returns a iterator point to the first node with node.key >= key.
+    // Returns a bad iterator if there is no such node.
+    Iterator seek(const ByteArray& key);
+
+    // Returns a iterator point to the last node with node.key <= key.
+    // Returns a bad iterator if there is no such node.
+    Iterator seek_for_prev(const ByteArray& key);
+
     // Returns a iterator point to the new node.
     // Returns a bad iterator if there is a duplicate key.
+    // Thread-safe with respect to readers and other concurrent insert() calls,
+    // each level is published by compare-and-swap and retried on contention.
     Iterator insert(const ByteArray& key, const ByteArray& value);
 
+    // Link the nodes of "run" into the list and leave "run" empty.
+    // A run that starts after the last node is appended in O(run size),
+    // otherwise its nodes are inserted one by one along a finger.
+    // Returns false and stores the key in "duplicate" if the list already holds one of the keys,
+    // the nodes after it are left in "run".
+    // REQUIRES: no concurrent insert(), update() or remove()
+    bool splice(Run* run, std::string* duplicate);
+
+    // Replace the value of the node with node.key == key in place,
+    // the old value is reclaimed once no reader can see it.
     // Returns a iterator point to the node with node.key == key.
     // Returns a bad iterator if there is no such node.
+    // Thread-safe with respect to readers, insert() and update().
     Iterator update(const ByteArray& key, const ByteArray& new_value);
 
+    // Insert the node, or update() it in place if the key exists.
+    // Returns a iterator point to the node with node.key == key.
+    // Thread-safe with respect to readers, insert() and update().
+    Iterator upsert(const ByteArray& key, const ByteArray& value);
+
+    // Same as above, but searches from the path of the previous operation with "finger".
+    // REQUIRES: keys passed with the same finger are non-decreasing
+    Iterator upsert(const ByteArray& key, const ByteArray& value, Finger* finger);
+
     // Returns a iterator point to the node with node.key == key.
     // Returns a bad iterator if there is no such node.
     Iterator lookup(const ByteArray& key);
 
+    // Memory held by the nodes of the list.
+    struct Usage {
+        size_t entries;
+        // keys and values stored in the nodes, those of mapped nodes are not counted
+        size_t key_bytes;
+        size_t value_bytes;
+        // the rest of the memory of the nodes, of values replaced in place and of the hash index
+        size_t overhead_bytes;
+    };
+
+    // Sum the counters that writers keep per thread, cheap enough to poll.
+    void usage(Usage* usage) const;
+
+    // Returns false if the hash index must grow before "n" more keys are inserted.
+    bool index_has_room(size_t n) const;
+
+    // Grow the hash index to hold "n" more keys.
+    // REQUIRES: no concurrent insert(), update() or remove()
+    void reserve_index(size_t n);
+
+    // Look up keys[0, n) and store the iterators in result[0, n).
+    // Several lookups are advanced in lock-step with software prefetch,
+    // so their cache misses overlap instead of stalling one after another.
+    void lookup(const ByteArray* keys, size_t n, Iterator* result);
+
     // Returns false if there is no such node.
+    // REQUIRES: no concurrent insert(), update() or remove()
     bool remove(const ByteArray& key);
 
+    // Same as above, but searches from the path of the previous operation with "finger".
+    // REQUIRES: keys passed with the same finger are non-decreasing
+    bool remove(const ByteArray& key, Finger* finger);
+
+    // Remove the nodes whose version is < "version", returns their number.
+    // REQUIRES: no concurrent insert(), update() or remove(), and no open snapshot
+    size_t evict(uint64_t version);
+
+    // Nodes are stamped with the current version when they are inserted or updated.
+    uint64_t version() const;
+
+    // Start the next version and return it,
+    // nodes changed from now on have a version >= the returned one.
+    // REQUIRES: no concurrent insert(), update() or remove()
+    uint64_t advance_version();
+
+    // Open a point-in-time view of the list at a new version, see advance_version().
+    // Until close_snapshot(), the first change of a node older than the snapshot
+    // saves its key and value, so scan_snapshot() sees the list as it was at this moment
+    // while writers keep going.
+    // REQUIRES: no concurrent insert(), update() or remove(), and no open snapshot
+    uint64_t open_snapshot();
+    void close_snapshot();
+
+    // Call "f" with every entry of the snapshot whose version is >= "since", in key order.
+    // Stops and returns false as soon as "f" returns false.
+    // The epoch of the pool is pinned for SCAN_BATCH nodes at a time, so memory freed by
+    // writers is reclaimed during a long scan, and the caller doesn't pin it throughout.
+    // REQUIRES: an open snapshot, scanned once
+    bool scan_snapshot(uint64_t since,
+                       const std::function<bool(const ByteArray&, const ByteArray&)>& f);
+
+    // Returns true if the snapshot holds an entry for "key".
+    // REQUIRES: an open snapshot, with the epoch pinned
+    bool snapshot_contains(const ByteArray& key);
+
     // Non-copying
     SkipList(const SkipList&) = delete;
     SkipList& operator=(const SkipList&) = delete;
@@ -72,37 +184,302 @@ TABLE_PUBLIC:
 #endif
 
 TABLE_PRIVATE:
+    // A node and its key and first value live in one allocation
+    //
+    // +-------------------------------Node--------------------------------+
+    // | fields | next[1, height) | key | padding | length of value | value |
+    // +-------------------------------------------------------------------+
+    //
+    // unless they live in a mapped file, then the node points to them
+    //
+    // +------------------------Node-------------------------+
+    // | fields | next[1, height) | key pointer | value pointer |
+    // +-----------------------------------------------------+
     struct Node {
-        Node(int h, const ByteArray& k, const ByteArray& v) : height(h), key(k), value(v) {
-            std::fill_n(next, h, nullptr);
+        Node(int h, const ByteArray& k, const ByteArray& v, uint64_t p, uint64_t ver) :
+                version(ver), prefix(p), key_size(k.size()), height(h), mapped(false), prev(nullptr) {
+            for (int i = 0; i < h; ++i) {
+                next[i].store(nullptr, std::memory_order_relaxed);
+            }
+            memcpy(const_cast<char*>(key_data()), k.data(), k.size());
+
+            char *v_data = const_cast<char*>(first_value());
+            size_t v_size = v.size();
+            memcpy(v_data, &v_size, sizeof(v_size));
+            memcpy(v_data + sizeof(v_size), v.data(), v_size);
+            value.store(v_data, std::memory_order_relaxed);
+        }
+
+        // "v" is a value in place, see Value below
+        Node(int h, const ByteArray& k, const char* v, uint64_t p, uint64_t ver, bool) :
+                version(ver), prefix(p), key_size(k.size()), height(h), mapped(true), prev(nullptr) {
+            for (int i = 0; i < h; ++i) {
+                next[i].store(nullptr, std::memory_order_relaxed);
+            }
+            const char **pointers = reinterpret_cast<const char**>(next + height);
+            pointers[0] = k.data();
+            pointers[1] = v;
+            value.store(v, std::memory_order_relaxed);
+        }
+
+        ByteArray key() const {
+            return ByteArray(key_data(), key_size);
         }
 
-        int   height;
-        ByteArray key;
-        ByteArray value;
-        Node* next[1];
+        const char* key_data() const {
+            const char *data = reinterpret_cast<const char*>(next + height);
+            return mapped ? *reinterpret_cast<const char* const*>(data) : data;
+        }
+
+        // the value the node was created with, it is not freed on its own
+        const char* first_value() const {
+            if (mapped) {
+                return reinterpret_cast<const char* const*>(next + height)[1];
+            }
+            return key_data() + align(key_size);
+        }
+
+        static size_t align(size_t size) {
+            return (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+        }
+
+        static size_t size(int height, size_t key_size, size_t value_size) {
+            return sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1) +
+                align(key_size) + sizeof(size_t) + value_size;
+        }
+
+        static size_t mapped_size(int height) {
+            return sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1) + sizeof(const char*) * 2;
+        }
+
+        // +---------------Value---------------+
+        // | length of value (size_t) | value |
+        // +-----------------------------------+
+        // published as a single word, so update() swaps size and data at once,
+        // it points to first_value() until the first update
+        std::atomic<const char*> value;
+        // version of the last insert or update
+        std::atomic<uint64_t> version;
+        // the first 8 bytes of key in big-endian, zero padded,
+        // with a byte-wise comparator it orders most keys without touching the key bytes
+        uint64_t  prefix;
+        size_t    key_size;
+        int       height;
+        // key and first value point into a mapped file
+        bool      mapped;
+        // level-0 back pointer, a hint that always points to some node before this one
+        std::atomic<Node*> prev;
+        std::atomic<Node*> next[1];
     };
 
     enum {
         MAX_HEIGHT         = 16,
         RANDOM_SEED        = 0xBADC0FFE,
         GROWTH_PROBABILITY = 4,
+        // number of lookups interleaved by the batched lookup()
+        GROUP_SIZE         = 8,
+        MIN_INDEX_CAPACITY = 1024,
+        // undo entries of nodes in the list are spread over shards by node
+        UNDO_SHARDS        = 16,
+        // nodes scan_snapshot() visits with the epoch pinned once
+        SCAN_BATCH         = 256,
+    };
+
+TABLE_PUBLIC:
+    // The search path of the last operation, a finger search for a greater key
+    // starts from the lowest level that still brackets it instead of from the head.
+    // Nodes on the path must not be removed by others while the finger is in use.
+    class Finger {
+    TABLE_PUBLIC:
+        explicit Finger(SkipList* list);
+        ~Finger() = default;
+
+    TABLE_PRIVATE:
+        friend class SkipList;
+        Node *_prev[MAX_HEIGHT];
+    };
+
+    // A sorted chain of nodes built off the list, so bulk loads skip the search per key.
+    // Each appended node is linked after the tail of every level it reaches,
+    // runs of different threads are built concurrently and spliced one at a time.
+    class Run {
+    TABLE_PUBLIC:
+        explicit Run(SkipList* list);
+        // deletes the nodes that were not spliced
+        ~Run();
+
+        // Returns false if key is not greater than the last appended key.
+        bool append(const ByteArray& key, const ByteArray& value);
+
+        // Same as above, but the node points to key and value instead of copying them.
+        // "value" is the length of the value as a size_t followed by its bytes, as in a dump file.
+        // REQUIRES: key and value outlive the list
+        bool append_in_place(const ByteArray& key, const char* value);
+        size_t size() const { return _size; }
+
+        // Non-copying
+        Run(const Run&) = delete;
+        Run& operator=(const Run&) = delete;
+
+    TABLE_PRIVATE:
+        friend class SkipList;
+        void link(Node* node);
+
+        SkipList *_list;
+        // the first and the last node of every level, nullptr above _height
+        Node     *_first[MAX_HEIGHT];
+        Node     *_last[MAX_HEIGHT];
+        int       _height;
+        size_t    _size;
+    };
+
+TABLE_PRIVATE:
+    // An open addressing hash table with linear probing, slots are published by CAS.
+    // Concurrent inserts only fill empty slots, remove() leaves a tombstone behind,
+    // and the table is rebuilt without tombstones when it grows.
+    struct Index {
+        size_t              mask;
+        std::atomic<Node*>  slots[1];
     };
 
-    int          _height;
-    Node        *_head;
-    Random       _rand;
-    Comparator  *_cmp;
+    // marks a slot of the hash index whose node has been removed
+    static Node* const INDEX_TOMBSTONE;
+
+    std::atomic<int>  _height;
+    Node             *_head;
+    Comparator       *_cmp;
     MemoryPool  *_pool;
+    // true if _cmp is the builtin byte-wise comparator, so key prefixes are comparable
+    bool              _bytewise;
+    // nullptr if there is no hash index
+    std::atomic<Index*>   _index;
+    // number of filled and tombstone slots
+    std::atomic<size_t>   _index_used;
+    std::atomic<uint64_t> _version;
+
+    // A node as it was at the snapshot, saved by its first change after it.
+    struct Undo {
+        std::string  value;
+        uint64_t     version;
+    };
+
+    // The undo entries of the nodes of a shard that are still in the list,
+    // writers of nodes in other shards don't wait for its mutex.
+    struct UndoShard {
+        std::mutex                      mutex;
+        std::unordered_map<Node*, Undo> undo;
+        // keep the shards off each other's cache lines
+        char                            pad[64];
+    };
+
+    struct UndoCompare {
+        bool operator()(const std::string& lhs, const std::string& rhs) const {
+            return cmp->compare(lhs, rhs) < 0;
+        }
+
+        const Comparator *cmp;
+    };
+
+    // the counters of Usage, kept per thread stripe of the writer,
+    // a stripe goes negative when another thread frees what it allocated
+    struct Stats {
+        std::atomic<int64_t> entries;
+        std::atomic<int64_t> key_bytes;
+        std::atomic<int64_t> value_bytes;
+        std::atomic<int64_t> overhead_bytes;
+        // keep the stripes on cache lines of their own
+        char pad[64 - 4 * sizeof(std::atomic<int64_t>)];
+    };
+
+    Stats _stats[Epoch::NSTRIPE];
+
+    // version of the open snapshot, 0 if there is none
+    std::atomic<uint64_t> _snapshot;
+    UndoShard             _undo[UNDO_SHARDS];
+    // undo entries of removed nodes, in key order for the scan to merge them in
+    std::mutex            _removed_mutex;
+    std::map<std::string, Undo, UndoCompare> _removed;
+    // entries added to _removed, the scan searches it again when they change
+    std::atomic<uint64_t> _removed_changes;
 
     int random_height();
+    void raise_height(int height);
     Node* first_greater_or_equal(const ByteArray& key, Node **prev);
 
+    // The search loops are instantiated with one of these comparisons,
+    // so the builtin byte-wise order is inlined instead of a virtual call at every step.
+    struct BytewiseCompare {
+        int operator()(const Node* node, const ByteArray& key, uint64_t prefix) const {
+            // zero padding keeps the order of prefixes consistent with the byte-wise order of keys,
+            // only equal prefixes need the full comparison, and their first bytes are equal
+            if (node->prefix != prefix) {
+                return node->prefix < prefix ? -1 : 1;
+            }
+            size_t size = std::min(node->key_size, key.size());
+            size_t skip = std::min(size, sizeof(prefix));
+            int cmp = memcmp(node->key_data() + skip, key.data() + skip, size - skip);
+            if (cmp != 0) {
+                return cmp;
+            }
+            return node->key_size < key.size() ? -1 : node->key_size > key.size();
+        }
+    };
+
+    struct VirtualCompare {
+        explicit VirtualCompare(const Comparator* cmp) : cmp(cmp) {  }
+
+        int operator()(const Node* node, const ByteArray& key, uint64_t) const {
+            return cmp->compare(node->key(), key);
+        }
+
+        const Comparator *cmp;
+    };
+
+    template <class Cmp>
+    Node* first_greater_or_equal(const Cmp& compare, const ByteArray& key, Node** prev);
+    template <class Cmp>
+    Node* finger_search(const Cmp& compare, const ByteArray& key, Node** prev);
+    template <class Cmp>
+    void lookup(const Cmp& compare, const ByteArray* keys, size_t n, Iterator* result);
+
+    static uint64_t key_prefix(const ByteArray& key);
+    int compare(const Node* node, const ByteArray& key, uint64_t prefix) const;
+    int compare(const Node* lhs, const Node* rhs) const;
+    Node* find_prev(Node* node);
+    Node* finger_search(const ByteArray& key, Node** prev);
+
+    Iterator upsert(const ByteArray& key, const ByteArray& value, Node* node, Node** prev);
+    bool remove(const ByteArray& key, Node* node, Node** prev);
+
     Node* new_node(const ByteArray& key, const ByteArray& value, int height);
+    Node* new_mapped_node(const ByteArray& key, const char* value, int height);
     void  delete_node(Node* node);
 
-    void publish_node(Node* node, Node** prev);
+    void  account(int64_t entries, int64_t key_bytes, int64_t value_bytes, int64_t overhead_bytes);
+
+    const char* new_value(const ByteArray& value);
+    void  delete_value(const char* value);
+    void  replace_value(Node* node, const ByteArray& value);
+    // called before a node is changed while a snapshot may be open
+    void  save_undo(Node* node);
+    // called before a node is removed while a snapshot may be open
+    void  save_removed(Node* node);
+    UndoShard& undo_shard(const Node* node);
+    // Returns true and copies the snapshot entry of "node" changed after the snapshot
+    // to *undo, if not nullptr. Returns false if the node was inserted after the snapshot.
+    bool  find_undo(Node* node, Undo* undo);
+    static ByteArray value_of(const char* value);
+
+    static uint64_t hash(const ByteArray& key);
+    Index* new_index(size_t capacity);
+    void index_insert(Index* index, Node* node);
+    void index_remove(Node* node);
+    Node* index_lookup(const ByteArray& key, uint64_t hash) const;
+
+    // Returns false if a concurrent writer published the same key first.
+    bool publish_node(Node* node, Node** prev);
     void remove_node(Node* node, Node** prev);
+    void raise_prev(Node* node, Node* prev);
 };
 
 } // namespace table
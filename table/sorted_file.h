@@ -0,0 +1,268 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+//
+// Format of a dump file, sorted by key
+//
+// +------------+-----+------------+--------------+-------------+-----------+--------+
+// | data block | ... | data block | bloom filter | block index | checksums | footer |
+// +------------+-----+------------+--------------+-------------+-----------+--------+
+//
+// A data block is a sequence of entries, it ends with the entry that fills it up to block_size
+// +--------------------Entry----------------------+
+// | length of key | key | length of value | value |
+// +-----------------------------------------------+
+//
+// The block index holds the offset and the first key of every data block
+// +-------------------------Index entry--------------------------+
+// | offset of block (uint64) | length of key | first key of block |
+// +--------------------------------------------------------------+
+//
+// The bloom filter is | bits | number of probes (1 byte) |, it is empty without bits per key.
+//
+// The checksums are the crc32c (uint32) of every data block as it is on disk, followed by the one
+// of the bloom filter, the block index and the checksums before it.
+//
+// +------------------------------------------Footer-------------------------------------------+
+// | filter offset | index offset | number of entries | compression | checksums offset | magic |
+// +-------------------------------------------------------------------------------------------+
+// all of them uint64, compression is an Options::Compression.
+//
+// The data blocks of a file with compression start with a header
+// +---------------Compressed block----------------+
+// | type (1 byte) | size of entries | compressed |
+// +-----------------------------------------------+
+// where type is the compression of the block, NO_COMPRESSION if it didn't shrink.
+// The block index of such a file holds the offsets of the headers.
+//
+// Files written before checksums end with a footer without offset of checksums, those written
+// before compression without compression either, each with a magic number of its own.
+// Files written before there were blocks are a bare sequence of entries without footer.
+
+#ifndef TABLE_SORTED_FILE_H
+#define TABLE_SORTED_FILE_H
+
+#include "common.h"
+#include "status.h"
+#include "byte_array.h"
+#include "comparator.h"
+#include "options.h"
+
+namespace table {
+
+// Builds the data blocks, the bloom filter, the block index and the footer of a file.
+class SortedFileBuilder {
+TABLE_PUBLIC:
+    SortedFileBuilder(size_t block_size, int bloom_bits_per_key,
+                      Options::Compression compression);
+    ~SortedFileBuilder() = default;
+
+    // Add the entry of "key" whose bytes are in *entry,
+    // *entry is replaced by the bytes to write next, which may be none.
+    // REQUIRES: keys are added in increasing order
+    void add(const ByteArray& key, std::string* entry);
+
+    // Bytes that finish() would append if an entry of a "key_size" bytes key was added first,
+    // besides the entries.
+    size_t meta_size(size_t key_size) const;
+
+    // Append the rest of the file to *out, and start over for the next file.
+    void finish(std::string* out);
+
+TABLE_PRIVATE:
+    // append the block being filled to *out, compressed
+    void flush_block(std::string* out);
+    // the block being filled is done
+    void end_block();
+
+    size_t                 _block_size;
+    int                    _bits_per_key;
+    Options::Compression   _compression;
+    // bytes of the file written so far
+    size_t                 _offset;
+    // offset of the block the next entry belongs to, the last one is still being filled
+    size_t                 _block_offset;
+    size_t                 _blocks;
+    size_t                 _entries;
+    std::string            _index;
+    std::vector<uint32_t>  _hashes;
+    // crc32c of the bytes of the block being filled, and of the blocks before
+    uint32_t               _block_crc;
+    std::string            _checksums;
+    // with compression, the entries of the block being filled and its first key
+    std::string            _block;
+    std::string            _block_key;
+    std::string            _compressed;
+};
+
+// A mapped dump file, searched in place.
+class SortedFile {
+TABLE_PUBLIC:
+    enum : size_t {
+        FOOTER_SIZE = sizeof(uint64_t) * 6,
+        BLOCK_HEADER_SIZE = 1 + sizeof(uint64_t),
+    };
+
+    // past the last entry
+    static constexpr size_t NPOS = ~size_t(0);
+
+    // Map the file at "path", whose entries are in the order of "cmp",
+    // and check it against its checksums if "verify_checksums" is true.
+    // The index of a file without blocks is built by a scan every "block_size" bytes.
+    static Status open(const std::string& path, const Comparator* cmp, size_t block_size,
+                       bool verify_checksums, std::unique_ptr<SortedFile>* file);
+
+    // Returns the size of the data blocks at the front of the "size" bytes of a dump file.
+    static size_t data_size(const char* data, size_t size);
+
+    // Returns the compression of the "size" bytes of a dump file.
+    static Options::Compression compression(const char* data, size_t size);
+
+    // A data block of a compressed file.
+    struct Block {
+        Options::Compression  compression;
+        const char           *data;
+        size_t                size;
+        // size of the entries it holds
+        size_t                raw_size;
+    };
+
+    // Set *blocks to the data blocks of the "size" bytes of the compressed dump file at "path".
+    static Status read_blocks(const std::string& path, const char* data, size_t size,
+                              std::vector<Block>* blocks);
+
+    // Check the "size" bytes of the dump file at "path" against their checksums,
+    // files written before there were checksums pass.
+    static Status verify(const std::string& path, const char* data, size_t size);
+
+    ~SortedFile();
+
+    bool empty() const { return _data_size == 0; }
+    size_t entries() const { return _entries; }
+    // bytes of the file mapped
+    size_t size() const { return _size; }
+    ByteArray first_key() const { return key(0); }
+    ByteArray last_key() const { return key(_last); }
+
+    // Returns false if the file surely doesn't hold "key".
+    bool may_contain(const ByteArray& key) const;
+
+    // Returns true and points *value into the file if it holds "key".
+    bool get(const ByteArray& key, ByteArray* value) const;
+
+    // Entries are addressed by their offsets.
+    // Returns the first entry with a key >= "key", or NPOS.
+    size_t seek(const ByteArray& key) const;
+    // Returns the last entry with a key <= "key", or NPOS.
+    size_t seek_for_prev(const ByteArray& key) const;
+    size_t first() const { return empty() ? NPOS : 0; }
+    size_t last() const { return empty() ? NPOS : _last; }
+    // Return the entry after or before "offset", or NPOS.
+    size_t next(size_t offset) const;
+    size_t prev(size_t offset) const;
+
+    ByteArray key(size_t offset) const;
+    ByteArray value(size_t offset) const;
+
+    // Non-copying
+    SortedFile(const SortedFile&) = delete;
+    SortedFile& operator=(const SortedFile&) = delete;
+
+TABLE_PRIVATE:
+    SortedFile(const Comparator* cmp, char* data, size_t size);
+
+    struct Footer {
+        uint64_t filter_offset;
+        uint64_t index_offset;
+        uint64_t entries;
+        uint64_t compression;
+        // the block index ends there, even without checksums
+        uint64_t checksums_offset;
+        bool     has_checksums;
+        // bytes of the footer
+        size_t   size;
+    };
+
+    // Returns false if the "size" bytes of a dump file have no footer.
+    static bool read_footer(const char* data, size_t size, Footer* footer);
+    // Calls f(offset, first key) for the blocks in the index of a file with "footer".
+    static Status read_index(const std::string& path, const char* data, const Footer& footer,
+                             const std::function<void(size_t, const ByteArray&)>& f);
+
+    Status load_index(const std::string& path, size_t block_size);
+    // the block "key" falls into, the first one if "key" is before all of them
+    size_t find_block(const ByteArray& key) const;
+    size_t block_end(size_t block) const;
+    // Returns the bytes of the entry at "offset", or 0 if its lengths run past the data.
+    size_t entry_size(size_t offset) const;
+
+    static uint32_t hash(const ByteArray& key);
+    static size_t read_size(const char* p);
+
+    const Comparator       *_cmp;
+    char                   *_data;
+    size_t                  _size;
+    size_t                  _data_size;
+    size_t                  _entries;
+    size_t                  _last;
+    // offsets and first keys of the blocks, the keys point into the file
+    std::vector<size_t>     _block_offsets;
+    std::vector<ByteArray>  _block_keys;
+    // empty if the file has no bloom filter
+    ByteArray               _filter;
+
+    friend class SortedFileBuilder;
+};
+
+// Dump files that hold disjoint key ranges in order, searched as one.
+class SortedFileSet {
+TABLE_PUBLIC:
+    explicit SortedFileSet(const Comparator* cmp);
+    ~SortedFileSet() = default;
+
+    // Returns false if "file" doesn't start after the files added before, empty files are dropped.
+    bool add(std::unique_ptr<SortedFile> file);
+
+    // Returns true and points *value into the files if they hold "key".
+    bool get(const ByteArray& key, ByteArray* value) const;
+
+    // Returns the bytes of the files mapped.
+    size_t size() const { return _size; }
+
+    class Iterator {
+    TABLE_PUBLIC:
+        explicit Iterator(const SortedFileSet* set);
+        ~Iterator() = default;
+
+        bool valid() const { return _offset != SortedFile::NPOS; }
+        void seek(const ByteArray& key);
+        void seek_for_prev(const ByteArray& key);
+        void seek_to_first();
+        void seek_to_last();
+        void next();
+        void prev();
+        ByteArray key() const { return _set->_files[_file]->key(_offset); }
+        ByteArray value() const { return _set->_files[_file]->value(_offset); }
+
+    TABLE_PRIVATE:
+        const SortedFileSet *_set;
+        size_t               _file;
+        size_t               _offset;
+    };
+
+    // Non-copying
+    SortedFileSet(const SortedFileSet&) = delete;
+    SortedFileSet& operator=(const SortedFileSet&) = delete;
+
+TABLE_PRIVATE:
+    // the first file whose last key is >= "key"
+    size_t find_file(const ByteArray& key) const;
+
+    const Comparator                          *_cmp;
+    std::vector<std::unique_ptr<SortedFile>>   _files;
+    size_t                                     _size;
+};
+
+} // namespace table
+
+#endif
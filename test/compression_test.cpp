@@ -0,0 +1,187 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "compression.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace table;
+
+static const Options::Compression TYPES[] = {
+    Options::NO_COMPRESSION, Options::LZ_COMPRESSION,
+    Options::ZSTD_COMPRESSION, Options::LZ4_COMPRESSION,
+};
+
+static string random_bytes(size_t size) {
+    string s;
+    for (size_t i = 0; i < size; ++i) {
+        s.push_back(static_cast<char>(rand()));
+    }
+    return s;
+}
+
+static vector<string> inputs() {
+    srand(9127);
+    vector<string> result = {"", "a", "abcd", "abcdefgh", "abcdefghi", "aaaaaaaaaaaaaaaaaaaa"};
+    for (size_t size : {15, 16, 17, 100, 4096, 65536, 200000}) {
+        result.push_back(random_bytes(size));
+    }
+    // long runs, whose matches overlap the bytes they produce
+    result.push_back(string(100000, 'x'));
+    // a period longer than a match offset can reach
+    string block = random_bytes(70000);
+    result.push_back(block + block + block);
+    // short periods, and text-like data with literals between matches
+    string periodic;
+    for (int i = 0; i < 50000; ++i) {
+        periodic += static_cast<char>('a' + i % 7);
+    }
+    result.push_back(periodic);
+    string text;
+    for (int i = 0; i < 5000; ++i) {
+        text += "{\"id\":" + to_string(i) + ",\"name\":\"" + random_bytes(rand() % 8) + "\"}";
+    }
+    result.push_back(text);
+    return result;
+}
+
+// Decompress "compressed", copied to a buffer of its exact size, into a buffer of "raw_size"
+// followed by guard bytes, and check the guard bytes are untouched.
+static bool checked_decompress(Options::Compression type, const string& compressed,
+                               size_t raw_size, string* out) {
+    unique_ptr<char[]> in(new char[max<size_t>(1, compressed.size())]);
+    memcpy(in.get(), compressed.data(), compressed.size());
+    const size_t GUARD = 64;
+    string buffer(raw_size + GUARD, '\x5a');
+    bool good = decompress(type, in.get(), compressed.size(), &buffer[0], raw_size);
+    EXPECT_EQ(buffer.substr(raw_size), string(GUARD, '\x5a')) << "written past the output";
+    out->assign(buffer, 0, raw_size);
+    return good;
+}
+
+TEST(CompressionTest, ROUND_TRIP) {
+    for (Options::Compression type : TYPES) {
+        if (!compression_supported(type)) {
+            continue;
+        }
+        for (const string& in : inputs()) {
+            string compressed = "prefix";
+            ASSERT_TRUE(compress(type, in.data(), in.size(), &compressed)) << type;
+            // compress() appends
+            ASSERT_EQ(compressed.substr(0, 6), "prefix");
+            compressed.erase(0, 6);
+
+            string out;
+            ASSERT_TRUE(checked_decompress(type, compressed, in.size(), &out)) <<
+                type << " " << in.size();
+            ASSERT_EQ(out, in) << type << " " << in.size();
+        }
+    }
+}
+
+TEST(CompressionTest, RATIO) {
+    string in(100000, 'x');
+    string compressed;
+    ASSERT_TRUE(compress(Options::LZ_COMPRESSION, in.data(), in.size(), &compressed));
+    ASSERT_LT(compressed.size(), in.size() / 100);
+
+    // data that doesn't compress grows by little
+    in = random_bytes(100000);
+    compressed.clear();
+    ASSERT_TRUE(compress(Options::LZ_COMPRESSION, in.data(), in.size(), &compressed));
+    ASSERT_LT(compressed.size(), in.size() + in.size() / 100);
+}
+
+TEST(CompressionTest, WRONG_SIZE) {
+    for (Options::Compression type : TYPES) {
+        if (!compression_supported(type)) {
+            continue;
+        }
+        for (const string& in : inputs()) {
+            string compressed;
+            ASSERT_TRUE(compress(type, in.data(), in.size(), &compressed));
+            string out;
+            ASSERT_FALSE(checked_decompress(type, compressed, in.size() + 1, &out)) << type;
+            if (!in.empty()) {
+                ASSERT_FALSE(checked_decompress(type, compressed, in.size() - 1, &out)) << type;
+            }
+        }
+    }
+}
+
+TEST(CompressionTest, TRUNCATED) {
+    for (Options::Compression type : TYPES) {
+        if (!compression_supported(type)) {
+            continue;
+        }
+        for (const string& in : inputs()) {
+            if (in.empty() || in.size() > 10000) {
+                continue;
+            }
+            string compressed;
+            ASSERT_TRUE(compress(type, in.data(), in.size(), &compressed));
+            for (size_t n = 0; n < compressed.size(); ++n) {
+                string out;
+                ASSERT_FALSE(checked_decompress(type, compressed.substr(0, n), in.size(), &out)) <<
+                    type << " " << in.size() << " " << n;
+            }
+        }
+    }
+}
+
+TEST(CompressionTest, CORRUPTED) {
+    srand(5531);
+    for (Options::Compression type : TYPES) {
+        if (!compression_supported(type)) {
+            continue;
+        }
+        for (const string& in : inputs()) {
+            if (in.empty()) {
+                continue;
+            }
+            string compressed;
+            ASSERT_TRUE(compress(type, in.data(), in.size(), &compressed));
+            // a flipped byte may still decode, but only into the output buffer
+            for (int i = 0; i < 200; ++i) {
+                string corrupted = compressed;
+                corrupted[rand() % corrupted.size()] ^= static_cast<char>(1 + rand() % 255);
+                string out;
+                checked_decompress(type, corrupted, in.size(), &out);
+            }
+        }
+    }
+
+    // sequences that point before the start of the output, or run past the end of the input
+    const string bad[] = {
+        string("\x04" "\x01\x00", 3),          // a match with nothing before it
+        string("\x14" "a" "\x02\x00", 4),      // offset 2 with 1 byte out
+        string("\x10" "a" "\x00\x00", 4),      // offset 0
+        string("\xf0", 1),                     // literal length continued past the end
+        string("\xf0\xff\xff", 3),             // likewise, after 255s
+        string("\x50" "abc", 4),               // fewer literals than the token says
+        string("\x1f" "a" "\x01", 3),          // offset cut short
+        string("\x1f" "a" "\x01\x00\xff", 5),  // match length continued past the end
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        string out;
+        ASSERT_FALSE(checked_decompress(Options::LZ_COMPRESSION, bad[i], 64, &out)) << i;
+    }
+}
+
+TEST(CompressionTest, UNSUPPORTED) {
+    ASSERT_TRUE(compression_supported(Options::NO_COMPRESSION));
+    ASSERT_TRUE(compression_supported(Options::LZ_COMPRESSION));
+    Options::Compression unknown = static_cast<Options::Compression>(100);
+    ASSERT_FALSE(compression_supported(unknown));
+    string out;
+    ASSERT_FALSE(compress(unknown, "abc", 3, &out));
+    char buf[3];
+    ASSERT_FALSE(decompress(unknown, "abc", 3, buf, 3));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
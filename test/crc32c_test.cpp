@@ -0,0 +1,84 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "crc32c.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace table;
+
+TEST(Crc32cTest, STANDARD_RESULTS) {
+    ASSERT_EQ(crc32c::value("123456789", 9), 0xE3069283u);
+    ASSERT_EQ(crc32c::value("", 0), 0u);
+
+    // from RFC 3720, section B.4
+    char buf[32];
+    memset(buf, 0, sizeof(buf));
+    ASSERT_EQ(crc32c::value(buf, sizeof(buf)), 0x8A9136AAu);
+
+    memset(buf, 0xff, sizeof(buf));
+    ASSERT_EQ(crc32c::value(buf, sizeof(buf)), 0x62A8AB43u);
+
+    for (int i = 0; i < 32; ++i) {
+        buf[i] = static_cast<char>(i);
+    }
+    ASSERT_EQ(crc32c::value(buf, sizeof(buf)), 0x46DD794Eu);
+
+    for (int i = 0; i < 32; ++i) {
+        buf[i] = static_cast<char>(31 - i);
+    }
+    ASSERT_EQ(crc32c::value(buf, sizeof(buf)), 0x113FDB5Cu);
+}
+
+TEST(Crc32cTest, EXTEND) {
+    string data;
+    for (int i = 0; i < 1000; ++i) {
+        data.push_back(static_cast<char>(i * 131 + 7));
+    }
+    uint32_t whole = crc32c::value(data.data(), data.size());
+
+    // every split point, so both halves start and end off the 8 byte steps
+    for (size_t split = 0; split <= data.size(); ++split) {
+        uint32_t crc = crc32c::value(data.data(), split);
+        crc = crc32c::extend(crc, data.data() + split, data.size() - split);
+        ASSERT_EQ(crc, whole) << split;
+    }
+
+    uint32_t crc = 0;
+    for (size_t i = 0; i < data.size(); i += 7) {
+        crc = crc32c::extend(crc, data.data() + i, min<size_t>(7, data.size() - i));
+    }
+    ASSERT_EQ(crc, whole);
+}
+
+TEST(Crc32cTest, SOFTWARE_AND_HARDWARE) {
+    ASSERT_EQ(crc32c::extend_software(0, "123456789", 9), 0xE3069283u);
+    if (!crc32c::accelerated()) {
+        cout << "no crc32 instruction, only the tables are checked" << endl;
+        return;
+    }
+    ASSERT_EQ(crc32c::extend_hardware(0, "123456789", 9), 0xE3069283u);
+
+    srand(4231);
+    string data;
+    for (int i = 0; i < 4096; ++i) {
+        data.push_back(static_cast<char>(rand()));
+    }
+    // all lengths up to a few words at every alignment, and some long ones
+    for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t n = 0; n < 80; ++n) {
+            uint32_t seed = static_cast<uint32_t>(rand());
+            ASSERT_EQ(crc32c::extend_software(seed, data.data() + offset, n),
+                      crc32c::extend_hardware(seed, data.data() + offset, n)) << offset << " " << n;
+        }
+        ASSERT_EQ(crc32c::extend_software(0, data.data() + offset, data.size() - offset),
+                  crc32c::extend_hardware(0, data.data() + offset, data.size() - offset));
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
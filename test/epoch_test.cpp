@@ -0,0 +1,76 @@
+// Copyright (c) 2018, Wonter. All rights reserved.
+// Use of this source code is governed by the BSD 3-Clause License,
+// that can be found in the LICENSE file.
+
+#include "epoch.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+using namespace table;
+
+TEST(EpochTest, ADVANCE) {
+    Epoch epoch;
+    uint64_t e = epoch.current();
+    ASSERT_TRUE(epoch.reclaimable(0));
+    ASSERT_FALSE(epoch.reclaimable(e));
+
+    ASSERT_TRUE(epoch.try_advance());
+    ASSERT_FALSE(epoch.reclaimable(e));
+    ASSERT_TRUE(epoch.try_advance());
+    ASSERT_TRUE(epoch.reclaimable(e));
+}
+
+TEST(EpochTest, PINNED) {
+    Epoch epoch;
+    uint64_t e = epoch.current();
+    {
+        EpochGuard guard(&epoch);
+        // readers at the current epoch don't block one advance
+        ASSERT_TRUE(epoch.try_advance());
+        ASSERT_FALSE(epoch.try_advance());
+        ASSERT_FALSE(epoch.reclaimable(e));
+
+        {
+            // nor do readers pinned at the new epoch
+            EpochGuard inner(&epoch);
+        }
+        ASSERT_FALSE(epoch.try_advance());
+    }
+    ASSERT_TRUE(epoch.try_advance());
+    ASSERT_TRUE(epoch.reclaimable(e));
+}
+
+TEST(EpochTest, CONCURRENT) {
+    static constexpr int NTHREAD = 4;
+    static constexpr int NUM = 100000;
+
+    Epoch epoch;
+    atomic<bool> stop(false);
+    vector<thread> readers;
+    for (int t = 0; t < NTHREAD; ++t) {
+        readers.emplace_back([&epoch, &stop]() {
+            while (!stop.load()) {
+                EpochGuard guard(&epoch);
+                uint64_t e = epoch.current();
+                // no epoch advances twice while we are pinned
+                ASSERT_LE(epoch.current(), e + 1);
+            }
+        });
+    }
+
+    int advanced = 0;
+    for (int i = 0; i < NUM; ++i) {
+        advanced += epoch.try_advance();
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    ASSERT_GT(advanced, 0);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
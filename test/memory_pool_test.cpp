@@ -6,17 +6,23 @@
 
 #include "gtest/gtest.h"
 
+#include <tuple>
+#include <chrono>
+#include <thread>
+
 using namespace std;
 using namespace table;
 
 static const size_t BLOCK_SIZE  = 4096;
+static const size_t ALIGN       = 8;
 
 class MemoryPoolTest : public ::testing::Test {
 public:
-    MemoryPoolTest() : _pool(500) {  }
+    MemoryPoolTest() : _pool(&_epoch) {  }
     ~MemoryPoolTest() override = default;
 
 protected:
+    Epoch      _epoch;
     MemoryPool _pool;
 };
 
@@ -45,15 +51,16 @@ TEST_F(MemoryPoolTest, ALLOC) {
         _pool.dealloc(block.second, block.first);
     }
 
-    sleep(1);
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_TRUE(_epoch.try_advance());
 
-    // free the expired block
+    // free the reclaimable block
     _pool.alloc(1);
     ASSERT_TRUE(_pool._block_persist.empty());
 }
 
 TEST_F(MemoryPoolTest, REUSE) {
-    // NBLOCK at here should equal to NBLOCK in Pool::refill
+    // fewer blocks than a slab holds
     static constexpr int NBLOCK = 20;
 
     vector<pair<size_t, char*>> blocks;
@@ -66,7 +73,8 @@ TEST_F(MemoryPoolTest, REUSE) {
         _pool.dealloc(block.second, block.first);
     }
 
-    sleep(1);
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_TRUE(_epoch.try_advance());
 
     vector<pair<size_t, char*>> new_blocks;
     for (int i = 8; i <= 256; i += 8) {
@@ -79,6 +87,25 @@ TEST_F(MemoryPoolTest, REUSE) {
     }
 }
 
+TEST_F(MemoryPoolTest, PINNED) {
+    char *p = _pool.alloc(ALIGN);
+    {
+        // a reader pinned before the block is retired keeps it alive
+        EpochGuard guard(&_epoch);
+        _pool.dealloc(p, ALIGN);
+        ASSERT_TRUE(_epoch.try_advance());
+        ASSERT_FALSE(_epoch.try_advance());
+        ASSERT_NE(_pool.alloc(ALIGN), p);
+    }
+
+    ASSERT_TRUE(_epoch.try_advance());
+    bool reused = false;
+    for (int i = 0; i < 100 && !reused; ++i) {
+        reused = _pool.alloc(ALIGN) == p;
+    }
+    ASSERT_TRUE(reused);
+}
+
 TEST_F(MemoryPoolTest, DUP) {
     char p[BLOCK_SIZE];
     for (size_t i = 0; i < BLOCK_SIZE; ++i) {
@@ -93,6 +120,271 @@ TEST_F(MemoryPoolTest, DUP) {
     }
 }
 
+TEST_F(MemoryPoolTest, RELEASE) {
+    const size_t max_retained = 4 * MemoryPool::SLAB_SIZE;
+    MemoryPool pool(&_epoch, false, max_retained);
+
+    vector<char*> blocks;
+    for (int i = 0; i < 100000; ++i) {
+        blocks.push_back(pool.alloc(64));
+    }
+    size_t slabs = pool._slabs.size();
+    ASSERT_GT(slabs, 4u);
+
+    // every slab but the first one empties, a reader keeps them mapped until it leaves,
+    // the blocks are freed from the last so those left in the cache are in the first slab
+    char *kept = blocks[0];
+    {
+        EpochGuard guard(&_epoch);
+        for (size_t i = blocks.size() - 1; i > 0; --i) {
+            pool.dealloc(blocks[i], 64);
+        }
+        ASSERT_EQ(pool._slabs.size(), slabs);
+    }
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_TRUE(_epoch.try_advance());
+
+    // the empty slabs past the limit are unmapped
+    char *p = pool.alloc(64);
+    ASSERT_EQ(pool._slabs.size(), 1 + max_retained / MemoryPool::SLAB_SIZE);
+    ASSERT_LE(pool._retained, max_retained);
+    ASSERT_EQ(pool._block_retired.size(), 0u);
+
+    // the slab of the live block is reused first
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) / MemoryPool::SLAB_SIZE,
+              reinterpret_cast<uintptr_t>(kept) / MemoryPool::SLAB_SIZE);
+    memset(kept, 1, 64);
+    memset(p, 2, 64);
+
+    // retained slabs are reused before new ones are mapped
+    for (int i = 0; i < 5000; ++i) {
+        memset(pool.alloc(64), 3, 64);
+    }
+    ASSERT_EQ(pool._slabs.size(), 1 + max_retained / MemoryPool::SLAB_SIZE);
+    ASSERT_EQ(pool._retained, 0u);
+}
+
+TEST_F(MemoryPoolTest, USAGE) {
+    MemoryPool::Usage usage;
+    vector<char*> blocks;
+    for (int i = 0; i < 10000; ++i) {
+        blocks.push_back(_pool.alloc(64));
+    }
+    char *large = _pool.alloc(BLOCK_SIZE);
+    _pool.usage(&usage);
+    size_t slabs = _pool._slabs.size();
+    size_t capacity = (MemoryPool::SLAB_SIZE - MemoryPool::SLAB_HEADER_SIZE) / 64;
+    ASSERT_EQ(usage.system_bytes, slabs * MemoryPool::SLAB_SIZE + BLOCK_SIZE);
+    ASSERT_EQ(usage.free_bytes[64 / ALIGN - 1], (slabs * capacity - blocks.size()) * 64);
+    ASSERT_EQ(usage.reclaim_pending_bytes, 0u);
+
+    {
+        // the blocks are pending as long as a reader may see them
+        EpochGuard guard(&_epoch);
+        for (char *p : blocks) {
+            _pool.dealloc(p, 64);
+        }
+        _pool.dealloc(large, BLOCK_SIZE);
+        _pool.usage(&usage);
+        ASSERT_EQ(usage.reclaim_pending_bytes, blocks.size() * 64 + BLOCK_SIZE);
+    }
+
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_TRUE(_epoch.try_advance());
+    _pool.alloc(64);
+    _pool.usage(&usage);
+    ASSERT_EQ(usage.reclaim_pending_bytes, 0u);
+    ASSERT_EQ(usage.system_bytes, _pool._slabs.size() * MemoryPool::SLAB_SIZE);
+    ASSERT_EQ(usage.free_bytes[64 / ALIGN - 1], (_pool._slabs.size() * capacity - 1) * 64);
+}
+
+TEST_F(MemoryPoolTest, HUGE_PAGES) {
+    for (bool arena : {false, true}) {
+        MemoryPool pool(&_epoch, arena, 0, true);
+
+        vector<pair<size_t, char*>> blocks;
+        for (int i = 0; i < 100000; ++i) {
+            size_t size = rand() % 512 + 1;
+            char *p = pool.alloc(size);
+            memset(p, i % 256, size);
+            blocks.emplace_back(size, p);
+        }
+        if (!arena) {
+            for (auto slab : pool._slabs) {
+                ASSERT_EQ(reinterpret_cast<uintptr_t>(slab) % MemoryPool::HUGE_PAGE_SIZE, 0u);
+            }
+        }
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            for (size_t j = 0; j < blocks[i].first; ++j) {
+                ASSERT_EQ(static_cast<int>(blocks[i].second[j]) & 0xff, static_cast<int>(i) % 256);
+            }
+            pool.dealloc(blocks[i].second, blocks[i].first);
+        }
+
+        ASSERT_TRUE(_epoch.try_advance());
+        ASSERT_TRUE(_epoch.try_advance());
+        pool.alloc(ALIGN);
+        // no empty slab is kept
+        ASSERT_EQ(pool._retained, 0u);
+    }
+}
+
+TEST_F(MemoryPoolTest, ARENA) {
+    MemoryPool arena(&_epoch, true);
+    srand(27836745);
+
+    vector<pair<size_t, char*>> blocks;
+    for (int i = 0; i < 100000; ++i) {
+        // a few blocks are larger than the arena takes
+        size_t size = i % 10000 == 0 ? 2 * 1024 * 1024 : rand() % 512 + 1;
+        char *p = arena.alloc(size);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % ALIGN, 0u);
+        memset(p, i % 256, size);
+        blocks.emplace_back(size, p);
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        for (size_t j = 0; j < blocks[i].first; ++j) {
+            ASSERT_EQ(static_cast<int>(blocks[i].second[j]) & 0xff, static_cast<int>(i) % 256);
+        }
+    }
+
+    // blocks of the arena are not reused
+    char *p = arena.alloc(ALIGN);
+    arena.dealloc(p, ALIGN);
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_TRUE(_epoch.try_advance());
+    ASSERT_NE(arena.alloc(ALIGN), p);
+    for (auto& block : blocks) {
+        arena.dealloc(block.second, block.first);
+    }
+}
+
+TEST_F(MemoryPoolTest, CONCURRENT_ARENA) {
+    MemoryPool arena(&_epoch, true);
+    const int thread_num = 4;
+    const int alloc_num = 100000;
+
+    vector<vector<char*>> blocks(thread_num);
+    vector<thread> threads;
+    for (int t = 0; t < thread_num; ++t) {
+        threads.emplace_back([&arena, &blocks, t]() {
+            for (int i = 0; i < alloc_num; ++i) {
+                char *p = arena.alloc(64);
+                memset(p, t, 64);
+                blocks[t].push_back(p);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // no block was handed out twice
+    for (int t = 0; t < thread_num; ++t) {
+        for (char *p : blocks[t]) {
+            for (int i = 0; i < 64; ++i) {
+                ASSERT_EQ(p[i], t);
+            }
+        }
+    }
+}
+
+TEST_F(MemoryPoolTest, CONCURRENT) {
+    const int thread_num = 8;
+    const int alloc_num = 200000;
+
+    vector<thread> threads;
+    atomic<int> errors(0);
+    for (int t = 0; t < thread_num; ++t) {
+        threads.emplace_back([this, &errors, t]() {
+            // every block is filled with its own byte, a block handed out twice gets overwritten
+            deque<tuple<char*, size_t, char>> blocks;
+            for (int i = 0; i < alloc_num; ++i) {
+                size_t size = (i * 7919 + t) % 512 + 1;
+                char c = static_cast<char>(i);
+                char *p = _pool.alloc(size);
+                memset(p, c, size);
+                blocks.emplace_back(p, size, c);
+                if (blocks.size() > 1000 || i == alloc_num - 1) {
+                    while (!blocks.empty()) {
+                        char *q = get<0>(blocks.front());
+                        size_t n = get<1>(blocks.front());
+                        if (count(q, q + n, get<2>(blocks.front())) != static_cast<ptrdiff_t>(n)) {
+                            ++errors;
+                        }
+                        _pool.dealloc(q, n);
+                        blocks.pop_front();
+                        if (blocks.size() < 500 && i != alloc_num - 1) {
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    ASSERT_EQ(errors.load(), 0);
+}
+
+TEST_F(MemoryPoolTest, CONCURRENT_BENCHMARK) {
+    const int op_num = 1000000;
+
+    for (int thread_num : {1, 2, 4, 8}) {
+        Epoch epoch;
+        MemoryPool pool(&epoch);
+        vector<thread> threads;
+        auto start = chrono::high_resolution_clock::now();
+        for (int t = 0; t < thread_num; ++t) {
+            threads.emplace_back([&pool, t]() {
+                // allocate 100 nodes and free them, over and over
+                char *blocks[100];
+                for (int i = 0; i < op_num; i += 100) {
+                    for (int j = 0; j < 100; ++j) {
+                        blocks[j] = pool.alloc(16 + (i + j + t) % 241);
+                    }
+                    for (int j = 0; j < 100; ++j) {
+                        pool.dealloc(blocks[j], 16 + (i + j + t) % 241);
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        auto msec = chrono::duration_cast<chrono::milliseconds>(
+            chrono::high_resolution_clock::now() - start).count();
+        cout << thread_num << " threads: " << op_num << " allocations and frees per thread, " <<
+            msec << "ms, " << static_cast<long>(op_num * 1000.0 / max<long>(msec, 1)) <<
+            " per second per thread" << endl;
+    }
+}
+
+TEST_F(MemoryPoolTest, ARENA_BENCHMARK) {
+    const int alloc_num = 1000000;
+    vector<size_t> sizes(alloc_num);
+    for (size_t& size : sizes) {
+        // nodes of 16 bytes keys and 100 bytes values, and larger values
+        size = rand() % 4 == 0 ? 300 + rand() % 200 : 140 + rand() % 64;
+    }
+
+    for (bool arena : {false, true}) {
+        Epoch epoch;
+        auto start = chrono::high_resolution_clock::now();
+        {
+            MemoryPool pool(&epoch, arena);
+            for (size_t size : sizes) {
+                pool.alloc(size);
+            }
+        }
+        auto msec = chrono::duration_cast<chrono::milliseconds>(
+            chrono::high_resolution_clock::now() - start).count();
+        cout << (arena ? "arena: " : "pool:  ") << alloc_num << " allocations and free, " <<
+            msec << "ms" << endl;
+    }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
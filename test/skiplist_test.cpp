@@ -8,6 +8,9 @@
 
 #include "gtest/gtest.h"
 
+#include <set>
+#include <map>
+
 using namespace std;
 using namespace table;
 
@@ -23,7 +26,8 @@ public:
     }
 };
 
-static  MemoryPool          pool(1000);
+static  Epoch               epoch;
+static  MemoryPool          pool(&epoch);
 static  ByteWiseComparator  cmp;
 
 class SkipListTest : public ::testing::Test {
@@ -80,6 +84,28 @@ TEST_F(SkipListTest, UPDATE) {
     ASSERT_TRUE(it.good());
     ASSERT_EQ(it.key(), "a");
     ASSERT_EQ(it.value(), "b");
+
+    // the node is updated in place
+    auto old_it = _list.lookup("a");
+    it = _list.update("a", "longer value");
+    ASSERT_EQ(old_it.value(), "longer value");
+}
+
+TEST_F(SkipListTest, UPSERT) {
+    SkipList::Iterator it;
+
+    it = _list.upsert("a", "a");
+    ASSERT_TRUE(it.good());
+    ASSERT_EQ(it.value(), "a");
+
+    it = _list.upsert("a", "b");
+    ASSERT_TRUE(it.good());
+    ASSERT_EQ(it.value(), "b");
+    ASSERT_EQ(_list.lookup("a").value(), "b");
+
+    it = _list.begin();
+    it.next();
+    ASSERT_FALSE(it.good());
 }
 
 TEST_F(SkipListTest, LOOKUP) {
@@ -96,6 +122,32 @@ TEST_F(SkipListTest, LOOKUP) {
     ASSERT_EQ(it.value(), "a");
 }
 
+TEST_F(SkipListTest, BATCH_LOOKUP) {
+    static constexpr int NUM = 1000;
+
+    for (int i = 0; i < NUM; i += 2) {
+        ASSERT_TRUE(_list.insert(to_string(i), to_string(i)).good());
+    }
+
+    // more keys than a group, found and missing ones mixed
+    vector<string> strs;
+    for (int i = NUM + 1; i >= 0; --i) {
+        strs.push_back(to_string(i));
+    }
+    vector<ByteArray> keys(strs.begin(), strs.end());
+    vector<SkipList::Iterator> result(keys.size());
+    _list.lookup(keys.data(), keys.size(), result.data());
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int k = stoi(strs[i]);
+        ASSERT_EQ(result[i].good(), k < NUM && k % 2 == 0) << k;
+        if (result[i].good()) {
+            ASSERT_EQ(result[i].key(), strs[i]);
+            ASSERT_EQ(result[i].value(), strs[i]);
+        }
+    }
+}
+
 TEST_F(SkipListTest, REMOVE) {
     ASSERT_FALSE(_list.remove("a"));
 
@@ -127,6 +179,160 @@ TEST_F(SkipListTest, ITERATION) {
     ASSERT_FALSE(i < keys.size());
 }
 
+TEST_F(SkipListTest, SEEK) {
+    ASSERT_FALSE(_list.seek("a").good());
+    ASSERT_FALSE(_list.last().good());
+
+    std::vector<std::string> keys = {"b", "d", "f"};
+    for (const std::string &k : keys) {
+        ASSERT_TRUE(_list.insert(k, k).good());
+    }
+
+    ASSERT_EQ(_list.seek("a").key(), "b");
+    ASSERT_EQ(_list.seek("b").key(), "b");
+    ASSERT_EQ(_list.seek("c").key(), "d");
+    ASSERT_FALSE(_list.seek("g").good());
+    ASSERT_EQ(_list.last().key(), "f");
+}
+
+TEST_F(SkipListTest, REVERSE_ITERATION) {
+    static constexpr int NUM = 1000;
+
+    for (int i = 0; i < NUM; ++i) {
+        ASSERT_TRUE(_list.insert(to_string(i), to_string(i)).good());
+    }
+    // back pointers must survive updates and removes
+    for (int i = 0; i < NUM; i += 3) {
+        ASSERT_TRUE(_list.update(to_string(i), "new").good());
+    }
+    for (int i = 1; i < NUM; i += 3) {
+        ASSERT_TRUE(_list.remove(to_string(i)));
+    }
+
+    vector<string> keys;
+    for (auto it = _list.begin(); it.good(); it.next()) {
+        keys.emplace_back(it.key().data(), it.key().size());
+    }
+    for (auto it = _list.last(); it.good(); it.prev()) {
+        ASSERT_FALSE(keys.empty());
+        ASSERT_EQ(it.key(), keys.back());
+        keys.pop_back();
+    }
+    ASSERT_TRUE(keys.empty());
+
+    ASSERT_FALSE(_list.seek_for_prev("").good());
+    ASSERT_EQ(_list.seek_for_prev("0").key(), "0");
+    ASSERT_EQ(_list.seek_for_prev("1").key(), "0");
+    ASSERT_EQ(_list.seek_for_prev("99").key(), "99");
+    ASSERT_EQ(_list.seek_for_prev("z").key(), "999");
+}
+
+TEST_F(SkipListTest, KEY_PREFIX) {
+    // the builtin comparator orders nodes by their cached key prefix first
+    SkipList list(bytewise_comparator(), &pool);
+
+    vector<string> keys = {"", "a", string("a\0", 2), string("a\0\0", 3), "ab", "abcdefgh",
+        "abcdefgh1", "abcdefgh2", "abcdefgi", "\xff", "\xff\xff\xff\xff\xff\xff\xff\xff\x01"};
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back(to_string(i * 7919 % 1000) + "-suffix");
+    }
+    for (size_t i = keys.size(); i > 0; --i) {
+        ASSERT_TRUE(list.insert(keys[i - 1], keys[i - 1]).good());
+    }
+    sort(keys.begin(), keys.end());
+
+    size_t i = 0;
+    for (auto it = list.begin(); it.good(); it.next(), ++i) {
+        ASSERT_EQ(it.key(), keys[i]);
+        ASSERT_EQ(it.value(), keys[i]);
+    }
+    ASSERT_EQ(i, keys.size());
+
+    for (const string& key : keys) {
+        ASSERT_EQ(list.lookup(key).key(), key);
+    }
+    ASSERT_FALSE(list.lookup("abcdefgh0").good());
+}
+
+TEST_F(SkipListTest, FINGER) {
+    static constexpr int NUM = 10000;
+
+    // every other key already exists
+    set<string> expect;
+    for (int i = 0; i < NUM; i += 2) {
+        string key = to_string(i);
+        ASSERT_TRUE(_list.insert(key, key).good());
+        expect.insert(key);
+    }
+
+    vector<string> keys;
+    for (int i = 0; i < NUM; ++i) {
+        keys.push_back(to_string(i));
+    }
+    sort(keys.begin(), keys.end());
+
+    SkipList::Finger finger(&_list);
+    for (const string& key : keys) {
+        if (stoi(key) % 3 == 0) {
+            ASSERT_EQ(_list.remove(key, &finger), expect.erase(key) == 1);
+        } else {
+            // twice, the second one updates in place
+            ASSERT_TRUE(_list.upsert(key, "", &finger).good());
+            ASSERT_EQ(_list.upsert(key, key, &finger).key(), key);
+            expect.insert(key);
+        }
+    }
+
+    auto it = _list.begin();
+    for (const string& key : expect) {
+        ASSERT_TRUE(it.good());
+        ASSERT_EQ(it.key(), key);
+        ASSERT_EQ(it.value(), key);
+        it.next();
+    }
+    ASSERT_FALSE(it.good());
+}
+
+TEST_F(SkipListTest, HASH_INDEX) {
+    static constexpr int NUM = 10000;
+
+    SkipList list(bytewise_comparator(), &pool, true);
+    for (int i = 0; i < NUM; ++i) {
+        string key = to_string(i);
+        list.reserve_index(1);
+        ASSERT_TRUE(list.insert(key, key).good());
+    }
+    ASSERT_FALSE(list.index_has_room(NUM * 10));
+
+    for (int i = 0; i < NUM; i += 2) {
+        ASSERT_TRUE(list.remove(to_string(i)));
+    }
+    for (int i = 1; i < NUM; i += 4) {
+        ASSERT_TRUE(list.update(to_string(i), "new").good());
+    }
+    // tombstones are dropped when the index grows
+    list.reserve_index(NUM * 10);
+    ASSERT_TRUE(list.index_has_room(NUM * 10));
+
+    vector<string> strs;
+    for (int i = 0; i <= NUM; ++i) {
+        strs.push_back(to_string(i));
+    }
+    vector<ByteArray> keys(strs.begin(), strs.end());
+    vector<SkipList::Iterator> result(keys.size());
+    list.lookup(keys.data(), keys.size(), result.data());
+
+    for (int i = 0; i <= NUM; ++i) {
+        auto it = list.lookup(strs[i]);
+        ASSERT_EQ(it.good(), i < NUM && i % 2 == 1) << i;
+        ASSERT_EQ(result[i].good(), it.good()) << i;
+        if (it.good()) {
+            ASSERT_EQ(it.value(), i % 4 == 1 ? "new" : strs[i]);
+            ASSERT_EQ(result[i].key(), strs[i]);
+        }
+    }
+}
+
 TEST_F(SkipListTest, CRUD_LOOP) {
     static constexpr int NUM = 10000;
 
@@ -167,6 +373,243 @@ TEST_F(SkipListTest, CRUD_LOOP) {
     ASSERT_FALSE(_list.begin().good());
 }
 
+TEST_F(SkipListTest, CONCURRENT_INSERT) {
+    static constexpr int NUM = 10000;
+    static constexpr int NTHREAD = 4;
+
+    // every key is inserted by two threads, exactly one of them must win
+    atomic<int> inserted(0);
+    vector<thread> threads;
+    for (int t = 0; t < NTHREAD; ++t) {
+        threads.emplace_back([this, t, &inserted]() {
+            for (int i = 0; i < NUM; ++i) {
+                if (i % NTHREAD != t && (i + 1) % NTHREAD != t) {
+                    continue;
+                }
+                string key = to_string(i);
+                if (_list.insert(key, key).good()) {
+                    ++inserted;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    int count = 0;
+    string last;
+    for (auto it = _list.begin(); it.good(); it.next()) {
+        string key(it.key().data(), it.key().size());
+        ASSERT_LT(last, key);
+        last = key;
+        ++count;
+    }
+    ASSERT_EQ(count, NUM);
+    ASSERT_EQ(inserted.load(), NUM);
+
+    for (int i = 0; i < NUM; ++i) {
+        ASSERT_TRUE(_list.lookup(to_string(i)).good());
+    }
+
+    for (auto it = _list.last(); it.good(); it.prev()) {
+        --count;
+    }
+    ASSERT_EQ(count, 0);
+}
+
+TEST_F(SkipListTest, SNAPSHOT) {
+    map<string, string> expected;
+    for (int i = 0; i < 100; ++i) {
+        string key = to_string(1000 + i);
+        _list.insert(key, key);
+        expected[key] = key;
+    }
+
+    uint64_t since = _list.open_snapshot();
+    _list.upsert("1099", "changed since");
+    _list.close_snapshot();
+    expected["1099"] = "changed since";
+
+    EpochGuard guard(&epoch);
+    _list.open_snapshot();
+    // change keys the scan has passed and keys it has yet to reach while it runs
+    map<string, string> seen;
+    bool changed = false;
+    bool complete = _list.scan_snapshot(0, [&](const ByteArray& key, const ByteArray& value) {
+        string k(key.data(), key.size());
+        EXPECT_EQ(seen.count(k), 0u) << k;
+        // keys come in order, the removed ones included
+        EXPECT_TRUE(seen.empty() || seen.rbegin()->first < k) << k;
+        seen[k] = string(value.data(), value.size());
+        if (!changed && k == "1050") {
+            changed = true;
+            _list.upsert("1010", "new");
+            _list.upsert("1090", "new");
+            _list.remove("1020");
+            _list.remove("1080");
+            _list.remove("1085");
+            _list.insert("1085", "inserted again");
+            _list.insert("1070a", "inserted");
+            _list.insert("1000a", "inserted");
+            _list.upsert("1095", "new");
+            _list.remove("1095");
+        }
+        return true;
+    });
+    ASSERT_TRUE(complete);
+    ASSERT_EQ(seen, expected);
+
+    ASSERT_TRUE(_list.snapshot_contains("1020"));
+    ASSERT_TRUE(_list.snapshot_contains("1085"));
+    ASSERT_TRUE(_list.snapshot_contains("1001"));
+    ASSERT_FALSE(_list.snapshot_contains("1070a"));
+    ASSERT_FALSE(_list.snapshot_contains("2000"));
+    _list.close_snapshot();
+
+    // only the entries changed since the earlier version
+    _list.open_snapshot();
+    seen.clear();
+    _list.scan_snapshot(since, [&](const ByteArray& key, const ByteArray& value) {
+        seen[string(key.data(), key.size())] = string(value.data(), value.size());
+        return true;
+    });
+    _list.close_snapshot();
+    ASSERT_EQ(seen.size(), 6u);
+    ASSERT_EQ(seen["1099"], "changed since");
+    ASSERT_EQ(seen["1010"], "new");
+    ASSERT_EQ(seen["1085"], "inserted again");
+}
+
+TEST_F(SkipListTest, CONCURRENT_SNAPSHOT) {
+    static constexpr int NUM = 20000;
+    for (int i = 0; i < NUM; ++i) {
+        string key = to_string(i);
+        _list.insert(key, key);
+    }
+
+    _list.open_snapshot();
+    atomic<bool> stop(false);
+    thread writer([this, &stop]() {
+        for (int round = 0; !stop.load(); ++round) {
+            for (int i = round % 7; i < NUM && !stop.load(); i += 7) {
+                // removed nodes are reused while the scan goes on
+                EpochGuard guard(&epoch);
+                string key = to_string(i);
+                if (i % 3 == 0) {
+                    _list.remove(key);
+                    _list.insert(key, "inserted again");
+                } else {
+                    _list.upsert(key, "new");
+                }
+                _list.upsert(key + "x", "inserted");
+            }
+        }
+    });
+
+    // the scan pins the epoch itself, a batch at a time
+    map<string, string> seen;
+    string last;
+    uint64_t first_epoch = epoch.current();
+    _list.scan_snapshot(0, [&seen, &last](const ByteArray& key, const ByteArray& value) {
+        string k(key.data(), key.size());
+        EXPECT_LT(last, k);
+        last = k;
+        seen[k] = string(value.data(), value.size());
+        epoch.try_advance();
+        return true;
+    });
+    ASSERT_GE(epoch.current(), first_epoch + 2);
+    stop = true;
+    writer.join();
+    _list.close_snapshot();
+
+    ASSERT_EQ(seen.size(), static_cast<size_t>(NUM));
+    for (int i = 0; i < NUM; ++i) {
+        ASSERT_EQ(seen[to_string(i)], to_string(i));
+    }
+}
+
+TEST_F(SkipListTest, SPLICE) {
+    static constexpr int NUM = 10000;
+
+    SkipList list(bytewise_comparator(), &pool, true);
+    list.insert("00000", "old");
+
+    // appended after the last node
+    SkipList::Run run(&list);
+    for (int i = 1; i < NUM; ++i) {
+        char key[8];
+        snprintf(key, sizeof(key), "%05d", i);
+        ASSERT_TRUE(run.append(key, key));
+    }
+    ASSERT_FALSE(run.append("00001", "out of order"));
+    ASSERT_FALSE(run.append("09999", "duplicate"));
+    ASSERT_EQ(run.size(), static_cast<size_t>(NUM - 1));
+
+    string duplicate;
+    list.reserve_index(run.size() + 10);
+    ASSERT_TRUE(list.splice(&run, &duplicate));
+    ASSERT_EQ(run.size(), 0u);
+
+    // interleaved with the nodes of the list
+    SkipList::Run overlap(&list);
+    ASSERT_TRUE(overlap.append("00000a", "a"));
+    ASSERT_TRUE(overlap.append("05000a", "a"));
+    ASSERT_TRUE(overlap.append("99999", "a"));
+    ASSERT_TRUE(list.splice(&overlap, &duplicate));
+
+    int num = 0;
+    string last;
+    for (auto it = list.begin(); it.good(); it.next(), ++num) {
+        string key(it.key().data(), it.key().size());
+        ASSERT_LT(last, key);
+        last = key;
+        ASSERT_TRUE(list.lookup(key).good()) << key;
+    }
+    ASSERT_EQ(num, NUM + 3);
+    ASSERT_EQ(list.lookup("00000").value(), "old");
+    ASSERT_EQ(list.last().key(), "99999");
+    auto it = list.seek("05000a");
+    it.prev();
+    ASSERT_EQ(it.key(), "05000");
+
+    // the nodes after a duplicate stay in the run
+    SkipList::Run dup(&list);
+    ASSERT_TRUE(dup.append("00001x", "x"));
+    ASSERT_TRUE(dup.append("00002", "duplicate"));
+    ASSERT_TRUE(dup.append("00002x", "x"));
+    ASSERT_FALSE(list.splice(&dup, &duplicate));
+    ASSERT_EQ(duplicate, "00002");
+    ASSERT_TRUE(list.lookup("00001x").good());
+    ASSERT_FALSE(list.lookup("00002x").good());
+    ASSERT_EQ(list.lookup("00002").value(), "00002");
+}
+
+TEST_F(SkipListTest, EVICT) {
+    SkipList list(bytewise_comparator(), &pool, true);
+    for (int i = 0; i < 1000; ++i) {
+        list.insert(to_string(1000 + i), "old");
+    }
+    uint64_t version = list.advance_version();
+    for (int i = 0; i < 1000; i += 3) {
+        list.update(to_string(1000 + i), "new");
+    }
+    list.insert("0", "new");
+
+    ASSERT_EQ(list.evict(version), 666u);
+    int num = 0;
+    for (auto it = list.begin(); it.good(); it.next(), ++num) {
+        ASSERT_EQ(it.value(), "new");
+    }
+    ASSERT_EQ(num, 335);
+    ASSERT_FALSE(list.lookup("1001").good());
+    ASSERT_TRUE(list.lookup("1003").good());
+    auto it = list.seek("1003");
+    it.prev();
+    ASSERT_EQ(it.key(), "1000");
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -6,6 +6,14 @@
 
 #include "gtest/gtest.h"
 
+#include <map>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <future>
+
+#include <unistd.h>
+
 using namespace std;
 using namespace table;
 
@@ -107,6 +115,613 @@ TEST(TableTest, LOAD_AND_DUMP) {
     }
 }
 
+TEST(TableTest, PARALLEL_LOAD) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = true;
+    options.max_file_size = 4096;
+    options.hash_index = true;
+    options.open_threads = 4;
+
+    vector<string> keys(5000);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    string table_name = "table_" + random_string(16);
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (const string& key : keys) {
+            s = table.put(key, key + "-value");
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+    }
+
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    for (const string& key : keys) {
+        string value;
+        s = table.get(key, &value);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(value, key + "-value");
+    }
+
+    size_t count = 0;
+    Table::Iterator it(&table);
+    string last;
+    for (it.seek_to_first(); it.valid(); it.next(), ++count) {
+        string key(it.key().data(), it.key().size());
+        ASSERT_LT(last, key);
+        last = key;
+    }
+    ASSERT_EQ(count, keys.size());
+}
+
+TEST(TableTest, LAZY_LOAD) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = true;
+    options.max_file_size = 4096;
+    options.lazy_load = true;
+
+    map<string, string> expected;
+    for (int i = 0; i < 2000; ++i) {
+        string key = random_string(16);
+        expected[key] = key + "-value";
+    }
+    string table_name = "table_" + random_string(16);
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (auto& entry : expected) {
+            s = table.put(entry.first, entry.second);
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+    }
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+
+        // the mapped entries are updated, deleted and dumped over their own files
+        int i = 0;
+        for (auto it = expected.begin(); it != expected.end(); ++i) {
+            if (i % 3 == 0) {
+                ASSERT_TRUE(table.del(it->first).good());
+                it = expected.erase(it);
+                continue;
+            }
+            if (i % 3 == 1) {
+                it->second = "new";
+                ASSERT_TRUE(table.put(it->first, it->second).good());
+            }
+            ++it;
+        }
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+
+        for (auto& entry : expected) {
+            string value;
+            s = table.get(entry.first, &value);
+            ASSERT_TRUE(s.good()) << s.string();
+            ASSERT_EQ(value, entry.second);
+        }
+    }
+
+    options.lazy_load = false;
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    map<string, string> seen;
+    Table::Iterator it(&table);
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        seen[string(it.key().data(), it.key().size())] = string(it.value().data(), it.value().size());
+    }
+    ASSERT_EQ(seen, expected);
+}
+
+// all entries of "table" in key order, walked forward and backward
+static map<string, string> scan(Table* table) {
+    map<string, string> entries;
+    Table::Iterator it(table);
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        entries[string(it.key().data(), it.key().size())] =
+            string(it.value().data(), it.value().size());
+    }
+    auto expected = entries.rbegin();
+    for (it.seek_to_last(); it.valid(); it.prev(), ++expected) {
+        EXPECT_TRUE(expected != entries.rend());
+        EXPECT_EQ(string(it.key().data(), it.key().size()), expected->first);
+    }
+    EXPECT_TRUE(expected == entries.rend());
+    return entries;
+}
+
+TEST(TableTest, OUT_OF_CORE) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.max_file_size = 16 * 1024;
+    options.block_size = 512;
+
+    map<string, string> expected;
+    for (int i = 0; i < 3000; ++i) {
+        expected["key" + to_string(i * 2)] = random_string(16);
+    }
+    string table_name = "table_" + random_string(16);
+    {
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        for (auto& entry : expected) {
+            ASSERT_TRUE(table.put(entry.first, entry.second).good());
+        }
+        ASSERT_TRUE(table.full_dump().good());
+    }
+
+    options.out_of_core = true;
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(scan(&table), expected);
+
+    // keys of the files are overwritten and deleted, new keys fall between them
+    int i = 0;
+    for (auto it = expected.begin(); it != expected.end(); ++i) {
+        if (i % 5 == 0) {
+            ASSERT_TRUE(table.del(it->first).good());
+            it = expected.erase(it);
+            continue;
+        }
+        if (i % 5 == 1) {
+            it->second = "new";
+            ASSERT_TRUE(table.put(it->first, it->second).good());
+        }
+        ++it;
+    }
+    for (i = 0; i < 500; ++i) {
+        string key = "key" + to_string(i * 12 + 1);
+        expected[key] = "inserted";
+        ASSERT_TRUE(table.put(key, "inserted").good());
+    }
+    WriteBatch batch;
+    batch.del("key2");
+    batch.put("key4", "batch");
+    batch.del("key4");
+    batch.put("key6", "batch");
+    ASSERT_TRUE(table.write(batch).good());
+    expected.erase("key2");
+    expected.erase("key4");
+    expected["key6"] = "batch";
+    ASSERT_TRUE(table.del("key0").code() == Status::NOT_FOUND);
+
+    auto check = [&table, &expected]() {
+        ASSERT_EQ(scan(&table), expected);
+        for (int i = 0; i < 6100; ++i) {
+            string key = "key" + to_string(i);
+            string value;
+            Status s = table.get(key, &value);
+            auto it = expected.find(key);
+            ASSERT_EQ(s.good(), it != expected.end()) << key;
+            if (s.good()) {
+                ASSERT_EQ(value, it->second);
+            }
+        }
+
+        // change direction in the middle of both sides
+        Table::Iterator it(&table);
+        it.seek("key3001");
+        auto e = expected.lower_bound("key3001");
+        for (int step = 0; step < 200; ++step) {
+            ASSERT_TRUE(it.valid());
+            ASSERT_EQ(string(it.key().data(), it.key().size()), e->first);
+            if (step % 3 == 2) {
+                it.prev();
+                --e;
+            } else {
+                it.next();
+                ++e;
+            }
+        }
+        it.seek_for_prev("key3001");
+        ASSERT_EQ(string(it.key().data(), it.key().size()), (--expected.upper_bound("key3001"))->first);
+    };
+    check();
+
+    // the dump merges the skiplist into the files
+    s = table.full_dump();
+    ASSERT_TRUE(s.good()) << s.string();
+    check();
+    ASSERT_TRUE(table.put("key0", "again").good());
+    expected["key0"] = "again";
+    check();
+    ASSERT_TRUE(table.dump().good());
+    ASSERT_TRUE(table.close().good());
+
+    Table reopened(options, table_name);
+    s = reopened.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(scan(&reopened), expected);
+    string value;
+    ASSERT_TRUE(reopened.get("key0", &value).good());
+    ASSERT_EQ(value, "again");
+}
+
+TEST(TableTest, ITERATE_ACROSS_DUMP) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.out_of_core = true;
+    string table_name = "table_" + random_string(16);
+
+    Table table(options, table_name);
+    ASSERT_TRUE(table.open().good());
+    ASSERT_TRUE(table.put("a", "1").good());
+    ASSERT_TRUE(table.put("c", "3").good());
+    ASSERT_TRUE(table.full_dump().good());
+    ASSERT_TRUE(table.put("b", "2").good());
+
+    auto keys = [](Table::Iterator* it) {
+        string result;
+        for (it->seek_to_first(); it->valid(); it->next()) {
+            result.append(it->key().data(), it->key().size());
+        }
+        return result;
+    };
+    MemoryUsage usage;
+    {
+        // the iterator keeps to the old files, which don't hold "b"
+        Table::Iterator it(&table);
+        ASSERT_TRUE(table.full_dump().good());
+        ASSERT_EQ(keys(&it), "abc");
+        it.seek("b");
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(it.value(), "2");
+
+        Table::Iterator newer(&table);
+        ASSERT_EQ(keys(&newer), "abc");
+        ASSERT_TRUE(table.memory_usage(&usage).good());
+        ASSERT_EQ(usage.entries, 1u);
+    }
+    // the last iterator of the old files lets the dumped node go
+    ASSERT_TRUE(table.memory_usage(&usage).good());
+    ASSERT_EQ(usage.entries, 0u);
+    Table::Iterator it(&table);
+    ASSERT_EQ(keys(&it), "abc");
+    string value;
+    ASSERT_TRUE(table.get("b", &value).good());
+    ASSERT_EQ(value, "2");
+}
+
+TEST(TableTest, FLAT_DUMP_FILE) {
+    // dump files written before there were blocks
+    string table_name = "table_" + random_string(16);
+    ASSERT_EQ(system(("mkdir -p " + table_name).c_str()), 0);
+    {
+        ofstream file(table_name + "/00000000", ios::binary);
+        for (int i = 0; i < 100; ++i) {
+            string key = "key" + to_string(1000 + i);
+            size_t size = key.size();
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            file.write(key.data(), size);
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            file.write(key.data(), size);
+        }
+    }
+
+    for (bool out_of_core : {false, true}) {
+        Options options;
+        options.dump_when_close = false;
+        options.out_of_core = out_of_core;
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        auto entries = scan(&table);
+        ASSERT_EQ(entries.size(), 100u);
+        string value;
+        ASSERT_TRUE(table.get("key1050", &value).good());
+        ASSERT_EQ(value, "key1050");
+        ASSERT_FALSE(table.get("key2000", &value).good());
+    }
+}
+
+TEST(TableTest, COMPRESSION) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = true;
+    options.max_file_size = 65536;
+    options.compression = Options::LZ_COMPRESSION;
+    options.open_threads = 4;
+
+    map<string, string> entries;
+    for (int i = 0; i < 5000; ++i) {
+        string key = random_string(16);
+        // half of the values compress well
+        entries[key] = i % 2 ? random_string(40) : string(40, 'a' + i % 26) + key;
+    }
+    string table_name = "table_" + random_string(16);
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (auto& entry : entries) {
+            s = table.put(entry.first, entry.second);
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+    }
+
+    // the files are read regardless of options.compression
+    for (bool lazy_load : {false, true}) {
+        options.lazy_load = lazy_load;
+        options.compression = lazy_load ? Options::NO_COMPRESSION : Options::LZ_COMPRESSION;
+        options.dump_when_close = false;
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), entries);
+        for (auto& entry : entries) {
+            string value;
+            s = table.get(entry.first, &value);
+            ASSERT_TRUE(s.good()) << s.string();
+            ASSERT_EQ(value, entry.second);
+        }
+    }
+
+    options.out_of_core = true;
+    Table table(options, table_name);
+    ASSERT_EQ(table.open().code(), Status::INVALID_OPERATION);
+}
+
+TEST(TableTest, VERIFY) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.max_file_size = 16 * 1024;
+
+    // entries of 8 bytes keys and 32 bytes values take 56 bytes
+    string table_name = "table_" + random_string(16);
+    {
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        for (int i = 0; i < 1000; ++i) {
+            char key[16];
+            snprintf(key, sizeof(key), "key%05d", i);
+            ASSERT_TRUE(table.put(key, string(32, 'v')).good());
+        }
+        Status s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.verify();
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    // a flipped byte of a value goes unnoticed unless verified
+    string path = table_name + "/00000000";
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekp(30);
+        file.put('x');
+    }
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(table.verify().code(), Status::IO_ERROR);
+    }
+    options.verify_on_open = true;
+    {
+        Table table(options, table_name);
+        ASSERT_EQ(table.open().code(), Status::IO_ERROR);
+    }
+
+    // a torn write cuts an entry
+    options.verify_on_open = false;
+    ASSERT_EQ(truncate(path.c_str(), 56 * 3 + 10), 0);
+    Table table(options, table_name);
+    ASSERT_EQ(table.open().code(), Status::IO_ERROR);
+}
+
+TEST(TableTest, MAPPED_CORRUPTION) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.max_file_size = 16 * 1024;
+    options.block_size = 512;
+    options.out_of_core = true;
+
+    // entries of 8 bytes keys and 32 bytes values take 56 bytes, 10 to a block
+    string table_name = "table_" + random_string(16);
+    {
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        for (int i = 0; i < 1000; ++i) {
+            char key[16];
+            snprintf(key, sizeof(key), "key%05d", i);
+            ASSERT_TRUE(table.put(key, string(32, 'v')).good());
+        }
+        ASSERT_TRUE(table.dump().good());
+    }
+    string path = table_name + "/00000000";
+    string original;
+    {
+        ifstream file(path, ios::binary);
+        original.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    auto rewrite = [&path](const string& data) {
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write(data.data(), data.size());
+    };
+    auto set_length = [](string* data, size_t offset) {
+        size_t huge = ~size_t(0) - 8;
+        memcpy(&(*data)[offset], &huge, sizeof(huge));
+    };
+
+    // the footer starts with the offset the data blocks end at
+    uint64_t data_size;
+    memcpy(&data_size, original.data() + original.size() - sizeof(uint64_t) * 6, sizeof(data_size));
+    ASSERT_EQ(data_size % 56, 0u);
+
+    // a length that runs past the data at the start of a block, or in the last entry
+    for (size_t offset : {size_t(0), size_t(560), size_t(data_size - 56),
+                          size_t(data_size - 56 + 8 + 8)}) {
+        string data = original;
+        set_length(&data, offset);
+        rewrite(data);
+        Table table(options, table_name);
+        ASSERT_EQ(table.open().code(), Status::IO_ERROR) << offset;
+    }
+
+    // inside a block it hides the rest of the block
+    {
+        string data = original;
+        set_length(&data, 56 * 15);
+        rewrite(data);
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        string value;
+        ASSERT_TRUE(table.get("key00014", &value).good());
+        ASSERT_EQ(table.get("key00015", &value).code(), Status::NOT_FOUND);
+        ASSERT_EQ(table.get("key00016", &value).code(), Status::NOT_FOUND);
+        ASSERT_EQ(table.verify().code(), Status::IO_ERROR);
+        Table::Iterator it(&table);
+        size_t count = 0;
+        for (it.seek_to_first(); it.valid(); it.next()) {
+            ++count;
+        }
+        ASSERT_EQ(count, 995u);
+        for (it.seek_to_last(); it.valid(); it.prev()) {
+            --count;
+        }
+        ASSERT_EQ(count, 0u);
+        it.seek("key00016");
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(string(it.key().data(), it.key().size()), "key00020");
+        it.seek_for_prev("key00016");
+        ASSERT_TRUE(it.valid());
+        ASSERT_EQ(string(it.key().data(), it.key().size()), "key00014");
+    }
+
+    // cut anywhere, a file loses its footer and is read entry by entry
+    for (size_t size : {size_t(56 * 3 + 10), size_t(data_size + 3), original.size() - 1}) {
+        rewrite(original.substr(0, size));
+        Table table(options, table_name);
+        ASSERT_EQ(table.open().code(), Status::IO_ERROR) << size;
+    }
+}
+
+TEST(TableTest, DUMP_WRITER) {
+    map<string, string> expected;
+    for (int i = 0; i < 2000; ++i) {
+        // some values are larger than the buffer
+        expected[random_string(16)] = random_string(i % 100 == 0 ? 10000 : 100);
+    }
+
+    struct Config {
+        size_t buffer_size;
+        bool   direct_io;
+        bool   drop_cache;
+    };
+    for (const Config& config : {Config{0, false, false}, Config{4096, false, false},
+                                 Config{4096, true, false}, Config{65536, true, true}}) {
+        Options options;
+        options.create_if_missing = true;
+        options.dump_when_close = false;
+        options.dump_buffer_size = config.buffer_size;
+        options.dump_direct_io = config.direct_io;
+        options.dump_drop_cache = config.drop_cache;
+        options.max_file_size = 256 * 1024;
+
+        string table_name = "table_" + random_string(16);
+        {
+            Table table(options, table_name);
+            ASSERT_TRUE(table.open().good());
+            for (auto& entry : expected) {
+                ASSERT_TRUE(table.put(entry.first, entry.second).good());
+            }
+            Status s = table.dump();
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+
+        options.verify_on_open = true;
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), expected);
+    }
+}
+
+TEST(TableTest, MEMORY_USAGE) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = true;
+    string table_name = "table_" + random_string(16);
+
+    {
+        Table table(options, table_name);
+        MemoryUsage usage;
+        ASSERT_FALSE(table.memory_usage(&usage).good());
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.memory_usage(&usage);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(usage.entries, 0u);
+        ASSERT_EQ(usage.key_bytes, 0u);
+        ASSERT_EQ(usage.value_bytes, 0u);
+        ASSERT_EQ(usage.free_bytes.size(), 32u);
+
+        vector<string> keys;
+        for (int i = 0; i < 1000; ++i) {
+            keys.push_back(random_string(16));
+            ASSERT_TRUE(table.put(keys.back(), string(100, 'v')).good());
+        }
+        ASSERT_TRUE(table.memory_usage(&usage).good());
+        ASSERT_EQ(usage.entries, 1000u);
+        ASSERT_EQ(usage.key_bytes, 16000u);
+        ASSERT_EQ(usage.value_bytes, 100000u);
+        ASSERT_GT(usage.overhead_bytes, 0u);
+        ASSERT_EQ(usage.mapped_bytes, 0u);
+
+        // overwrite half of the entries and delete every other one
+        for (int i = 0; i < 500; ++i) {
+            ASSERT_TRUE(table.put(keys[i], string(200, 'v')).good());
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            ASSERT_TRUE(table.del(keys[i]).good());
+        }
+        ASSERT_TRUE(table.memory_usage(&usage).good());
+        ASSERT_EQ(usage.entries, 500u);
+        ASSERT_EQ(usage.key_bytes, 8000u);
+        ASSERT_EQ(usage.value_bytes, 250u * 200 + 250u * 100);
+        ASSERT_GT(usage.reclaim_pending_bytes, 0u);
+
+        size_t free_bytes = 0;
+        for (size_t bytes : usage.free_bytes) {
+            free_bytes += bytes;
+        }
+        ASSERT_GE(usage.pool_bytes, usage.key_bytes + usage.value_bytes + usage.overhead_bytes +
+                  free_bytes + usage.reclaim_pending_bytes);
+    }
+
+    for (bool out_of_core : {false, true}) {
+        // the dump files are mapped
+        options.lazy_load = !out_of_core;
+        options.out_of_core = out_of_core;
+        options.dump_when_close = false;
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        MemoryUsage usage;
+        ASSERT_TRUE(table.memory_usage(&usage).good());
+        ASSERT_EQ(usage.entries, out_of_core ? 0u : 500u);
+        ASSERT_EQ(usage.key_bytes, 0u);
+        ASSERT_EQ(usage.value_bytes, 0u);
+        ASSERT_GT(usage.mapped_bytes, 500u * (16 + 100));
+    }
+}
+
 TEST(TableTest, CRUD) {
     Options options;
     options.create_if_missing = true;
@@ -140,6 +755,798 @@ TEST(TableTest, CRUD) {
     ASSERT_FALSE(s.good());
 }
 
+TEST(TableTest, MULTI_GET) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_" + random_string(16));
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+
+    vector<string> keys(100);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        s = table.put(keys[i], keys[i] + "-value");
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    vector<ByteArray> lookup_keys(keys.begin(), keys.end());
+    vector<string> values;
+    vector<Status> statuses;
+    s = table.multi_get(lookup_keys, &values, &statuses);
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(values.size(), keys.size());
+    ASSERT_EQ(statuses.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 2 == 0) {
+            ASSERT_TRUE(statuses[i].good()) << statuses[i].string();
+            ASSERT_EQ(values[i], keys[i] + "-value");
+        } else {
+            ASSERT_EQ(statuses[i].code(), Status::NOT_FOUND);
+        }
+    }
+
+    s = table.multi_get(lookup_keys, nullptr, &statuses);
+    ASSERT_TRUE(s.good()) << s.string();
+}
+
+TEST(TableTest, HASH_INDEX) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.hash_index = true;
+    Table table(options, "table_" + random_string(16));
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+
+    vector<string> keys(5000);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    for (const string& key : keys) {
+        s = table.put(key, key);
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+    WriteBatch batch;
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        batch.del(keys[i]);
+    }
+    s = table.write(batch);
+    ASSERT_TRUE(s.good()) << s.string();
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        string value;
+        s = table.get(keys[i], &value);
+        ASSERT_EQ(s.good(), i % 2 == 1);
+        if (s.good()) {
+            ASSERT_EQ(value, keys[i]);
+        }
+    }
+}
+
+TEST(TableTest, WRITE_BATCH) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_" + random_string(16));
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+
+    s = table.put("b", "old");
+    ASSERT_TRUE(s.good()) << s.string();
+    s = table.put("d", "old");
+    ASSERT_TRUE(s.good()) << s.string();
+
+    WriteBatch batch;
+    batch.put("c", "1");
+    batch.put("a", "1");
+    batch.del("b");
+    batch.put("c", "2");
+    batch.del("no_such_key");
+    batch.put("d", "new");
+    batch.del("a");
+    batch.put("a", "2");
+    ASSERT_EQ(batch.count(), 8u);
+    ASSERT_EQ(batch.type(2), WriteBatch::DEL);
+    ASSERT_EQ(batch.key(3), "c");
+    ASSERT_EQ(batch.value(3), "2");
+
+    s = table.write(batch);
+    ASSERT_TRUE(s.good()) << s.string();
+
+    string value;
+    s = table.get("a", &value);
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(value, "2");
+    s = table.get("b", &value);
+    ASSERT_FALSE(s.good());
+    s = table.get("c", &value);
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(value, "2");
+    s = table.get("d", &value);
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(value, "new");
+
+    batch.clear();
+    ASSERT_EQ(batch.count(), 0u);
+    s = table.write(batch);
+    ASSERT_TRUE(s.good()) << s.string();
+}
+
+TEST(TableTest, ITERATOR) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    Table table(options, "table_" + random_string(16));
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+
+    {
+        Table::Iterator it(&table);
+        it.seek_to_first();
+        ASSERT_FALSE(it.valid());
+        it.seek_to_last();
+        ASSERT_FALSE(it.valid());
+    }
+
+    vector<string> keys = {"b", "d", "f", "h"};
+    for (const string& key : keys) {
+        s = table.put(key, key + "-value");
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    Table::Iterator it(&table);
+    size_t i = 0;
+    for (it.seek_to_first(); it.valid(); it.next(), ++i) {
+        ASSERT_EQ(it.key(), keys[i]);
+        ASSERT_EQ(it.value(), keys[i] + "-value");
+    }
+    ASSERT_EQ(i, keys.size());
+
+    it.seek("a");
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key(), "b");
+    it.seek("d");
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key(), "d");
+    it.seek("e");
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key(), "f");
+    it.next();
+    ASSERT_EQ(it.key(), "h");
+    it.seek("i");
+    ASSERT_FALSE(it.valid());
+
+    it.seek_to_last();
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key(), "h");
+    it.next();
+    ASSERT_FALSE(it.valid());
+
+    i = keys.size();
+    for (it.seek_to_last(); it.valid(); it.prev()) {
+        --i;
+        ASSERT_EQ(it.key(), keys[i]);
+    }
+    ASSERT_EQ(i, 0u);
+
+    it.seek_for_prev("a");
+    ASSERT_FALSE(it.valid());
+    it.seek_for_prev("d");
+    ASSERT_EQ(it.key(), "d");
+    it.seek_for_prev("e");
+    ASSERT_EQ(it.key(), "d");
+    it.prev();
+    ASSERT_EQ(it.key(), "b");
+    it.seek_for_prev("z");
+    ASSERT_EQ(it.key(), "h");
+}
+
+TEST(TableTest, WRITE_AHEAD_LOG) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.write_ahead_log = true;
+    string table_name = "table_" + random_string(16);
+
+    vector<string> keys(1000);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (size_t i = 0; i < keys.size(); ++i) {
+            s = table.put(keys[i], keys[i]);
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+        WriteBatch batch;
+        for (size_t i = 0; i < keys.size(); i += 2) {
+            batch.del(keys[i]);
+        }
+        batch.put(keys[0], "again");
+        s = table.write(batch);
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.del(keys[1]);
+        ASSERT_TRUE(s.good()) << s.string();
+        // closed without a dump, everything is in the log only
+        s = table.close();
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    // a torn record at the end of the log is ignored
+    {
+        ofstream log(table_name + "/00000000.log", ios::app | ios::binary);
+        size_t size = 1 << 20;
+        log.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        log.write("torn", 4);
+    }
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        string value;
+        s = table.get(keys[0], &value);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(value, "again");
+        for (size_t i = 1; i < keys.size(); ++i) {
+            s = table.get(keys[i], &value);
+            if (i % 2 == 0 || i == 1) {
+                ASSERT_EQ(s.code(), Status::NOT_FOUND);
+            } else {
+                ASSERT_TRUE(s.good()) << s.string();
+                ASSERT_EQ(value, keys[i]);
+            }
+        }
+
+        // the dump covers the logs, which are removed
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_FALSE(ifstream(table_name + "/00000000.log").good());
+        ASSERT_FALSE(ifstream(table_name + "/00000001.log").good());
+        s = table.put(keys[1], "after dump");
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.close();
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        string value;
+        s = table.get(keys[1], &value);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(value, "after dump");
+        s = table.get(keys[3], &value);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(value, keys[3]);
+    }
+}
+
+TEST(TableTest, LOG_CORRUPTION) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.write_ahead_log = true;
+    string table_name = "table_" + random_string(16);
+
+    map<string, string> expected;
+    {
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        for (int i = 0; i < 10; ++i) {
+            string key = "key" + to_string(i);
+            expected[key] = "value" + to_string(i);
+            ASSERT_TRUE(table.put(key, expected[key]).good());
+        }
+        ASSERT_TRUE(table.close().good());
+    }
+    string path = table_name + "/00000000.log";
+    string log;
+    {
+        ifstream file(path, ios::binary);
+        log.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    // the last record holds a put of "key9", "value9"
+    const size_t record_size = sizeof(uint32_t) + sizeof(size_t) * 3 + 1 + 4 + 6;
+    ASSERT_GT(log.size(), record_size);
+
+    auto replay = [&](const string& content) {
+        // a reopened table logs to a new file, which is dropped
+        ASSERT_EQ(system(("rm -f " + table_name + "/*.log").c_str()), 0);
+        {
+            ofstream file(path, ios::binary);
+            file << content;
+        }
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), expected);
+    };
+    replay(log);
+    // a zero-filled tail, as left by a crash before the file size was synced
+    replay(log + string(4096, '\0'));
+    // a record with a plausible length but the wrong checksum
+    string forged = log.substr(log.size() - record_size);
+    forged.replace(forged.find("key9"), 4, "keyX");
+    replay(log + forged);
+
+    expected.erase("key9");
+    for (size_t n = 1; n <= record_size; ++n) {
+        replay(log.substr(0, log.size() - n));
+    }
+    for (size_t i = log.size() - record_size; i < log.size(); ++i) {
+        string corrupted = log;
+        corrupted[i] ^= 0x20;
+        replay(corrupted);
+    }
+
+    // a log written before there were checksums
+    string body(1, static_cast<char>(WriteBatch::PUT));
+    for (const string& field : {string("old"), string("value")}) {
+        size_t size = field.size();
+        body.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        body += field;
+    }
+    size_t size = body.size();
+    string legacy(reinterpret_cast<const char*>(&size), sizeof(size));
+    expected = {{"old", "value"}};
+    replay(legacy + body);
+}
+
+TEST(TableTest, GROUP_COMMIT) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.write_ahead_log = true;
+    options.wal_sync = Options::WAL_SYNC_PER_WRITE;
+    string table_name = "table_" + random_string(16);
+
+    const int thread_num = 4;
+    const int put_num = 200;
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        vector<thread> threads;
+        for (int t = 0; t < thread_num; ++t) {
+            threads.emplace_back([&table, t]() {
+                for (int i = 0; i < put_num; ++i) {
+                    string key = to_string(t) + "-" + to_string(i);
+                    table.put(key, key);
+                }
+            });
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+    }
+
+    options.wal_sync = Options::WAL_SYNC_INTERVAL;
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    for (int t = 0; t < thread_num; ++t) {
+        for (int i = 0; i < put_num; ++i) {
+            string key = to_string(t) + "-" + to_string(i);
+            string value;
+            s = table.get(key, &value);
+            ASSERT_TRUE(s.good()) << s.string();
+            ASSERT_EQ(value, key);
+        }
+    }
+}
+
+TEST(TableTest, LOG_ORDER) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.write_ahead_log = true;
+    string table_name = "table_" + random_string(16);
+
+    // threads race to overwrite the same keys, the log replays the values they were left with
+    const int thread_num = 8;
+    const int key_num = 16;
+    map<string, string> expected;
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        vector<thread> threads;
+        for (int t = 0; t < thread_num; ++t) {
+            threads.emplace_back([&table, t]() {
+                for (int i = 0; i < 2000; ++i) {
+                    string key = "key" + to_string(i % key_num);
+                    string value = to_string(t) + "-" + to_string(i);
+                    if (i % 10 == 0) {
+                        WriteBatch batch;
+                        batch.put(key, value);
+                        batch.put("key" + to_string((i + 1) % key_num), value);
+                        table.write(batch);
+                    } else {
+                        table.put(key, value);
+                    }
+                }
+            });
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+        expected = scan(&table);
+        ASSERT_EQ(expected.size(), static_cast<size_t>(key_num));
+    }
+
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(scan(&table), expected);
+}
+
+static off_t file_size(const string& path) {
+    ifstream file(path, ios::binary | ios::ate);
+    return file.good() ? static_cast<off_t>(file.tellg()) : -1;
+}
+
+TEST(TableTest, INCREMENTAL_DUMP) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.incremental_dump = true;
+    string table_name = "table_" + random_string(16);
+
+    vector<string> keys(1000);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+    map<string, string> expected;
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (const string& key : keys) {
+            s = table.put(key, key);
+            ASSERT_TRUE(s.good()) << s.string();
+            expected[key] = key;
+        }
+        // the first dump is a full one
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_GT(file_size(table_name + "/00000000"), 0);
+        ASSERT_EQ(file_size(table_name + "/00000000.delta"), -1);
+
+        for (size_t i = 0; i < 10; ++i) {
+            s = table.put(keys[i], "updated");
+            ASSERT_TRUE(s.good()) << s.string();
+            expected[keys[i]] = "updated";
+            s = table.del(keys[i + 10]);
+            ASSERT_TRUE(s.good()) << s.string();
+            expected.erase(keys[i + 10]);
+        }
+        // deleted and inserted again
+        s = table.del(keys[20]);
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.put(keys[20], "again");
+        ASSERT_TRUE(s.good()) << s.string();
+        expected[keys[20]] = "again";
+        s = table.put("new-key", "new-value");
+        ASSERT_TRUE(s.good()) << s.string();
+        expected["new-key"] = "new-value";
+
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        off_t delta_size = file_size(table_name + "/00000000.delta");
+        ASSERT_GT(delta_size, 0);
+        ASSERT_LT(delta_size * 10, file_size(table_name + "/00000000"));
+
+        // nothing changed, nothing written
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(file_size(table_name + "/00000001.delta"), -1);
+
+        s = table.del(keys[0]);
+        ASSERT_TRUE(s.good()) << s.string();
+        expected.erase(keys[0]);
+        s = table.dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_GT(file_size(table_name + "/00000001.delta"), 0);
+    }
+
+    auto check = [&]() {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        size_t count = 0;
+        Table::Iterator it(&table);
+        for (it.seek_to_first(); it.valid(); it.next(), ++count) {
+            string key(it.key().data(), it.key().size());
+            ASSERT_TRUE(expected.count(key)) << key;
+            ASSERT_EQ(it.value(), expected[key]);
+        }
+        ASSERT_EQ(count, expected.size());
+    };
+    check();
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        s = table.full_dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(file_size(table_name + "/00000000.delta"), -1);
+        ASSERT_EQ(file_size(table_name + "/00000001.delta"), -1);
+    }
+    check();
+}
+
+TEST(TableTest, CRASH_IN_DUMP) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.incremental_dump = true;
+    options.max_file_size = 16 * 1024;
+    string table_name = "table_" + random_string(16);
+
+    map<string, string> expected;
+    for (int i = 0; i < 1000; ++i) {
+        expected[random_string(16)] = random_string(32);
+    }
+    {
+        Table table(options, table_name);
+        ASSERT_TRUE(table.open().good());
+        for (auto& entry : expected) {
+            ASSERT_TRUE(table.put(entry.first, entry.second).good());
+        }
+        ASSERT_TRUE(table.full_dump().good());
+        auto it = expected.begin();
+        it->second = "delta";
+        ASSERT_TRUE(table.put(it->first, it->second).good());
+        ASSERT_TRUE(table.dump().good());
+        // a full dump takes fresh numbers and removes the files it replaces
+        ASSERT_TRUE(table.full_dump().good());
+        ASSERT_EQ(file_size(table_name + "/00000000"), -1);
+        ASSERT_EQ(file_size(table_name + "/00000000.delta"), -1);
+        ASSERT_TRUE(table.close().good());
+    }
+    vector<string> names;
+    for (int i = 0; i < 64; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "%08X", i);
+        if (file_size(table_name + "/" + name) > 0) {
+            names.push_back(name);
+        }
+    }
+    ASSERT_GT(names.size(), 1u);
+
+    // what a crash leaves behind: files being written, the files of a dump not yet in use,
+    // and the files a dump replaced but had not removed yet
+    auto write_file = [&table_name](const string& name, const string& content) {
+        ofstream file(table_name + "/" + name, ios::binary);
+        file << content;
+    };
+    write_file(names.back() + ".tmp", "torn");
+    write_file("00000100", "unpublished");
+    write_file("00000101.tmp", "torn");
+    write_file("00000000.delta", "replaced");
+    write_file("00000009.delta.tmp", "torn");
+    write_file("CURRENT.tmp", "torn");
+    write_file("00000000", "replaced");
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), expected);
+        ASSERT_TRUE(table.verify().good());
+    }
+    for (const string& name : {names.back() + ".tmp", string("00000100"), string("00000101.tmp"),
+                               string("00000000.delta"), string("00000009.delta.tmp"),
+                               string("00000000")}) {
+        ASSERT_EQ(file_size(table_name + "/" + name), -1) << name;
+    }
+
+    // a table without CURRENT uses all of its files
+    ASSERT_EQ(remove((table_name + "/CURRENT").c_str()), 0);
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), expected);
+    }
+    ASSERT_GT(file_size(table_name + "/CURRENT"), 0);
+
+    // the files CURRENT names must be there
+    ASSERT_EQ(remove((table_name + "/" + names.back()).c_str()), 0);
+    {
+        Table table(options, table_name);
+        ASSERT_EQ(table.open().code(), Status::IO_ERROR);
+    }
+    write_file("CURRENT", "garbage");
+    {
+        Table table(options, table_name);
+        ASSERT_EQ(table.open().code(), Status::IO_ERROR);
+    }
+}
+
+TEST(TableTest, DUMP_ASYNC) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    string table_name = "table_" + random_string(16);
+
+    const size_t entry_num = 100000;
+    vector<string> keys(entry_num);
+    generate_n(keys.begin(), keys.size(), bind(random_string, 16));
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (const string& key : keys) {
+            s = table.put(key, key);
+            ASSERT_TRUE(s.good()) << s.string();
+        }
+
+        // writes in the middle of the dump are not part of it
+        promise<DumpProgress> result;
+        size_t reports = 0;
+        s = table.dump_async([&](const DumpProgress& progress) {
+            if (progress.done) {
+                result.set_value(progress);
+                return;
+            }
+            if (reports++ == 0) {
+                for (size_t i = 0; i < keys.size(); i += 100) {
+                    table.put(keys[i], "changed");
+                    table.del(keys[i + 1]);
+                }
+                table.put("new-key", "new-value");
+            }
+        });
+        ASSERT_TRUE(s.good()) << s.string();
+        DumpProgress progress = result.get_future().get();
+        ASSERT_TRUE(progress.status.good()) << progress.status.string();
+        ASSERT_EQ(progress.entries, entry_num);
+        ASSERT_GT(reports, 0u);
+
+        string value;
+        s = table.get(keys[0], &value);
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(value, "changed");
+        s = table.close();
+        ASSERT_TRUE(s.good()) << s.string();
+    }
+
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (const string& key : keys) {
+            string value;
+            s = table.get(key, &value);
+            ASSERT_TRUE(s.good()) << s.string();
+            ASSERT_EQ(value, key);
+        }
+        s = table.get("new-key", nullptr);
+        ASSERT_EQ(s.code(), Status::NOT_FOUND);
+    }
+}
+
+TEST(TableTest, DUMP_ASYNC_OUT_OF_CORE) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.out_of_core = true;
+    options.max_file_size = 1024 * 1024;
+    string table_name = "table_" + random_string(16);
+
+    // the even keys are in the files, the odd ones only in the skiplist
+    auto key_of = [](int i) {
+        char key[16];
+        snprintf(key, sizeof(key), "key%08d", i);
+        return string(key);
+    };
+    const int entry_num = 200000;
+    map<string, string> expected;
+    {
+        Table table(options, table_name);
+        Status s = table.open();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (int i = 0; i < entry_num; i += 2) {
+            ASSERT_TRUE(table.put(key_of(i), "file").good());
+            expected[key_of(i)] = "file";
+        }
+        s = table.full_dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        for (int i = 1; i < entry_num; i += 2) {
+            ASSERT_TRUE(table.put(key_of(i), "memory").good());
+            expected[key_of(i)] = "memory";
+        }
+
+        // keys of the snapshot deleted in the middle of the dump stay deleted
+        // once the files written from it replace the old ones
+        promise<DumpProgress> result;
+        size_t reports = 0;
+        s = table.dump_async([&](const DumpProgress& progress) {
+            if (progress.done) {
+                result.set_value(progress);
+                return;
+            }
+            if (reports++ != 0) {
+                return;
+            }
+            for (int i = 0; i < entry_num; i += 1000) {
+                for (int j : {i, i + 1, entry_num - 1 - i}) {
+                    EXPECT_TRUE(table.del(key_of(j)).good()) << j;
+                    EXPECT_EQ(table.del(key_of(j)).code(), Status::NOT_FOUND) << j;
+                    expected.erase(key_of(j));
+                }
+                // deleted and inserted again
+                EXPECT_TRUE(table.del(key_of(i + 3)).good());
+                EXPECT_TRUE(table.put(key_of(i + 3), "again").good());
+                expected[key_of(i + 3)] = "again";
+            }
+        });
+        ASSERT_TRUE(s.good()) << s.string();
+        DumpProgress progress = result.get_future().get();
+        ASSERT_TRUE(progress.status.good()) << progress.status.string();
+        ASSERT_GT(reports, 0u);
+
+        for (int i = 0; i < entry_num; ++i) {
+            string value;
+            s = table.get(key_of(i), &value);
+            auto it = expected.find(key_of(i));
+            ASSERT_EQ(s.good(), it != expected.end()) << key_of(i);
+            if (s.good()) {
+                ASSERT_EQ(value, it->second);
+            }
+        }
+        ASSERT_EQ(scan(&table), expected);
+        ASSERT_EQ(table.get(key_of(entry_num - 1), nullptr).code(), Status::NOT_FOUND);
+
+        // and they are left out of the next dump
+        s = table.full_dump();
+        ASSERT_TRUE(s.good()) << s.string();
+        ASSERT_EQ(scan(&table), expected);
+        ASSERT_TRUE(table.close().good());
+    }
+
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    ASSERT_EQ(scan(&table), expected);
+}
+
+TEST(TableTest, DUMP_INTERVAL) {
+    Options options;
+    options.create_if_missing = true;
+    options.dump_when_close = false;
+    options.dump_interval_msec = 10;
+    atomic<int> dumps(0);
+    options.dump_callback = [&dumps](const DumpProgress& progress) {
+        if (progress.done && progress.status.good()) {
+            ++dumps;
+        }
+    };
+    string table_name = "table_" + random_string(16);
+
+    Table table(options, table_name);
+    Status s = table.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    s = table.put("key", "value");
+    ASSERT_TRUE(s.good()) << s.string();
+    while (dumps.load() < 2) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    s = table.close();
+    ASSERT_TRUE(s.good()) << s.string();
+
+    options.dump_interval_msec = 0;
+    Table reopened(options, table_name);
+    s = reopened.open();
+    ASSERT_TRUE(s.good()) << s.string();
+    string value;
+    ASSERT_TRUE(reopened.get("key", &value).good());
+    ASSERT_EQ(value, "value");
+}
+
 TEST(TableTest, IO_ERROR) {
     {
         // directory does not exist